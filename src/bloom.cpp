@@ -0,0 +1,94 @@
+
+#include "bloom.h"
+
+#include "hash.h"
+
+namespace cowbpt {
+
+namespace {
+
+uint32_t BloomHash(const SliceView& key) {
+  uint32_t h = Hash(key.data(), key.size(), 0xbc9f1d34);
+  // The filter of a leaf only has a few dozen bits, and the low bits of
+  // Hash() barely change with the last byte of a short key, so mix them
+  // in (the finalizer of murmur3).
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return h;
+}
+
+template <typename Key>
+void AppendBloomFilter(const std::vector<Key>& keys, int bits_per_key,
+                       std::string* dst) {
+  // We intentionally round down to reduce probing cost a little bit
+  size_t k = static_cast<size_t>(bits_per_key * 0.69);  // 0.69 =~ ln(2)
+  if (k < 1) k = 1;
+  if (k > 30) k = 30;
+
+  // Compute bloom filter size (in both bits and bytes)
+  size_t bits = keys.size() * bits_per_key;
+
+  // For small n, we can see a very high false positive rate.  Fix it
+  // by enforcing a minimum bloom filter length.
+  if (bits < 64) bits = 64;
+
+  size_t bytes = (bits + 7) / 8;
+  bits = bytes * 8;
+
+  const size_t init_size = dst->size();
+  dst->resize(init_size + bytes, 0);
+  dst->push_back(static_cast<char>(k));  // Remember # of probes in filter
+  char* array = &(*dst)[init_size];
+  for (const Key& key : keys) {
+    // Use double-hashing to generate a sequence of hash values.
+    // See analysis in [Kirsch,Mitzenmacher 2006].
+    uint32_t h = BloomHash(key);
+    const uint32_t delta = (h >> 17) | (h << 15);  // Rotate right 17 bits
+    for (size_t j = 0; j < k; j++) {
+      const uint32_t bitpos = h % bits;
+      array[bitpos / 8] |= (1 << (bitpos % 8));
+      h += delta;
+    }
+  }
+}
+
+}  // namespace
+
+void CreateBloomFilter(const std::vector<Slice>& keys, int bits_per_key,
+                       std::string* dst) {
+  AppendBloomFilter(keys, bits_per_key, dst);
+}
+
+void CreateBloomFilter(const std::vector<SliceView>& keys, int bits_per_key,
+                       std::string* dst) {
+  AppendBloomFilter(keys, bits_per_key, dst);
+}
+
+bool BloomFilterMayMatch(const Slice& key, const char* filter, size_t n) {
+  if (n < 2) return true;
+
+  const size_t bits = (n - 1) * 8;
+
+  // Use the encoded k so that we can read filters generated by
+  // bloom filters created using different parameters.
+  const size_t k = static_cast<unsigned char>(filter[n - 1]);
+  if (k > 30) {
+    // Reserved for potentially new encodings for short bloom filters.
+    // Consider it a match.
+    return true;
+  }
+
+  uint32_t h = BloomHash(key);
+  const uint32_t delta = (h >> 17) | (h << 15);  // Rotate right 17 bits
+  for (size_t j = 0; j < k; j++) {
+    const uint32_t bitpos = h % bits;
+    if ((filter[bitpos / 8] & (1 << (bitpos % 8))) == 0) return false;
+    h += delta;
+  }
+  return true;
+}
+
+}
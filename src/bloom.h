@@ -0,0 +1,27 @@
+
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "slice.h"
+
+namespace cowbpt {
+
+// Append to *dst a bloom filter of keys, with about bits_per_key bits per
+// key.  10 bits per key give about 1% of false positives.
+void CreateBloomFilter(const std::vector<Slice>& keys, int bits_per_key,
+                       std::string* dst);
+// The same, for keys whose bytes are kept by the caller
+void CreateBloomFilter(const std::vector<SliceView>& keys, int bits_per_key,
+                       std::string* dst);
+
+// Return false if key was certainly not one of the keys the filter
+// filter[0,n-1] was created from.  An empty filter matches every key.
+bool BloomFilterMayMatch(const Slice& key, const char* filter, size_t n);
+
+}
+
+#endif
@@ -11,7 +11,10 @@ namespace cowbpt {
         if (_root == nullptr) {
           LOG(INFO) << "initializing an empty b tree before replaying wal";
           _root.reset(new LeafNode<BptComparator>(_cmp));
-          if(_nm) _nm->add_new_node(_root);
+          if(_nm) {
+            _root->set_capacity(_nm->node_capacity());
+            _nm->add_new_node(_root);
+          }
         } else {
           LOG(INFO) << "initializing a b tree with checkpoint before replaying wal";
         }
@@ -29,6 +32,8 @@ namespace cowbpt {
         root->lock();
         root->stage();
         root->unlock();
+        // _tail is in the snapshot now, it is copied before its next write
+        _shape_version.fetch_add(1, std::memory_order_release);
       }
       return root;
     }
@@ -43,6 +48,23 @@ namespace cowbpt {
     }
 
     Slice Bpt::get(const Slice& key) {
+      Slice res;
+      get(key, &res);
+      return res;
+    }
+
+    Status Bpt::unwind(const Status& s, const NodePtr& parent, const NodePtr& child, bool hold_root_lock) {
+      child->unlock();
+      if (parent != nullptr) {
+        parent->unlock();
+      }
+      if (hold_root_lock) {
+        _mutex.unlock();
+      }
+      return s;
+    }
+
+    Status Bpt::get(const Slice& key, Slice* value, bool verify_checksums) {
       std::vector<NodePtr> parents;
       std::vector<int> parent_versions;
       while (true) {
@@ -60,15 +82,28 @@ namespace cowbpt {
           NodePtr new_child = nullptr;
 
           child->ref();
+          bool filtered = false;
           if (!child->is_in_memory()) {
+            Status s;
             child->lock();
-            if(_nm) _nm->fetch(child->get_node_id(), child);
+            if (!child->is_in_memory() && child->is_leafnode() && !child->key_may_match(key)) {
+              // the leaf does not have to be read back to know it
+              filtered = true;
+            } else if(_nm) {
+              s = _nm->fetch(child->get_node_id(), child, verify_checksums);
+            }
             child->unlock();
+            if (!s.ok()) {
+              child->unref();
+              return s;
+            }
           }
-          if (child->is_internalnode()) {
-            new_child = child->get_internalnode_value(key, parent_version);
+          if (filtered) {
+            // res stays empty
+          } else if (child->is_internalnode()) {
+            new_child = child->as_internal()->get_internalnode_value(key, parent_version);
           } else {
-            res = child->get_leafnode_value(key, parent_version);
+            res = child->as_leaf()->get_leafnode_value(key, parent_version);
           }
           child->unref();
 
@@ -99,7 +134,8 @@ namespace cowbpt {
 
           if (version_checked) {
             if (new_child == nullptr) {
-              return res;
+              *value = res;
+              return Status::OK();
             }
             else {
               parents.push_back(child);
@@ -124,13 +160,60 @@ namespace cowbpt {
       }
     }
 
-    void Bpt::put(const Slice& key, const Slice& value) {
+    bool Bpt::append(const Slice& key, const Slice& value) {
+      NodePtr leaf;
+      uint64_t version;
+      {
+        std::lock_guard<std::mutex> lck(_mutex);
+        if (_tail == nullptr) {
+          return false;
+        }
+        leaf = _tail;
+        version = _tail_version;
+      }
+      leaf->lock();
+      // the splits and fixes bump the version under the lock of the leaf
+      // or of its parent, before they change it
+      bool appended = version == _shape_version.load(std::memory_order_acquire) &&
+                      !leaf->is_staged() && leaf->is_in_memory() && !leaf->need_split() &&
+                      leaf->as_leaf()->is_after_last_key(key);
+      if (appended) {
+        leaf->as_leaf()->put(key, value);
+      }
+      leaf->unlock();
+      if (!appended) {
+        // found again by the next put at the end of the tree
+        std::lock_guard<std::mutex> lck(_mutex);
+        if (_tail == leaf) {
+          _tail = nullptr;
+        }
+      }
+      return appended;
+    }
+
+    Status Bpt::put(const Slice& key, const Slice& value) {
+      if (append(key, value)) {
+        return Status::OK();
+      }
       NodePtr parent = nullptr;
       NodePtr child = nullptr;
       bool hold_root_lock = false;
+      // one split per level, the parent was checked for one more entry
+      bool split = false;
+      // the shape of the tree when the root was locked, and the bumps of it
+      // by this put
+      uint64_t shape_version = 0;
+      uint64_t shape_changes = 0;
+      // child and parent are the last nodes of their levels
+      bool rightmost = true;
+      bool parent_rightmost = true;
       
           retry:
           _mutex.lock();
+          shape_version = _shape_version.load(std::memory_order_acquire);
+          shape_changes = 0;
+          rightmost = true;
+          parent_rightmost = true;
           parent = nullptr;
           child = _root;
           child->lock();
@@ -156,8 +239,11 @@ namespace cowbpt {
           }
         
       while (true) {
-        if (!child->is_in_memory()) {
-          if(_nm) _nm->fetch(child->get_node_id(), child);
+        if (!child->is_in_memory() && _nm) {
+          Status s = _nm->fetch(child->get_node_id(), child);
+          if (!s.ok()) {
+            return unwind(s, parent, child, hold_root_lock);
+          }
         }
 
         if (child->is_staged()) {
@@ -174,21 +260,26 @@ namespace cowbpt {
             if(_nm) _nm->replace_node(child->get_node_id(), copied_node);
             child = copied_node;
             if (parent != nullptr) {
-              parent->replace_internal_node_value(key, copied_node);
+              parent->as_internal()->replace_internal_node_value(key, copied_node);
             }
           }
 
-        if (child->need_split()) {
+        if (!split && child->need_split()) {
           if (parent == nullptr && !hold_root_lock) { // need split root, retry and get the root lock
             child->unlock();
             hold_root_lock = true;
             goto retry; 
           }
+          // keys put in increasing order leave the left halves full
+          const bool at_end = rightmost && (child->is_leafnode() ? child->as_leaf()->is_after_last_key(key)
+                                                                 : child->as_internal()->in_last_child(key));
+          _shape_version.fetch_add(1, std::memory_order_release);
+          shape_changes++;
           Slice split_key;
-          NodePtr new_child = child->split(split_key);
+          NodePtr new_child = child->split(split_key, at_end);
           if(_nm) _nm->add_new_node(new_child);
           if (parent != nullptr) { // split non root node
-            parent->put(split_key, new_child);
+            parent->as_internal()->put(split_key, new_child);
           } else { // split root node
             assert(hold_root_lock);
             NodePtr new_root_node(new InternalNode<BptComparator>(_cmp, child, split_key, new_child));
@@ -196,16 +287,21 @@ namespace cowbpt {
             if(_nm) _nm->add_new_node(new_root_node);
             _root = new_root_node; 
             parent = new_root_node;
+            parent_rightmost = true;
           }
           if (hold_root_lock) {
             _mutex.unlock();
             hold_root_lock = false;
           }
           child->unlock();
-          child = parent->get_internalnode_value(key);
+          child = parent->as_internal()->get_internalnode_value(key);
+          rightmost = parent_rightmost && parent->as_internal()->in_last_child(key);
           child->lock();
-          if (!child->is_in_memory()) {
-            if(_nm) _nm->fetch(child->get_node_id(), child);
+          if (!child->is_in_memory() && _nm) {
+            Status s = _nm->fetch(child->get_node_id(), child);
+            if (!s.ok()) {
+              return unwind(s, parent, child, hold_root_lock);
+            }
           }
 
           if (child->is_staged()) {
@@ -222,10 +318,11 @@ namespace cowbpt {
             if(_nm) _nm->replace_node(child->get_node_id(), copied_node);
             child = copied_node;
             if (parent != nullptr) {
-              parent->replace_internal_node_value(key, copied_node);
+              parent->as_internal()->replace_internal_node_value(key, copied_node);
             }
           }
 
+          split = true;
           continue;
         }
         if (hold_root_lock) {
@@ -239,17 +336,34 @@ namespace cowbpt {
           break;
         }
         parent = child;
-        child = parent->get_internalnode_value(key);
+        parent_rightmost = rightmost;
+        child = parent->as_internal()->get_internalnode_value(key);
+        rightmost = parent_rightmost && parent->as_internal()->in_last_child(key);
         child->lock();
+        split = false;
       }
-      child->put(key, value);
+      const bool appended = rightmost && child->as_leaf()->is_after_last_key(key);
+      child->as_leaf()->put(key, value);
       child->unlock();
+      if (appended) {
+        // the next keys may go after this one, see append().  Only if the
+        // shape of the tree was changed by this put alone since the root.
+        std::lock_guard<std::mutex> lck(_mutex);
+        if (_shape_version.load(std::memory_order_acquire) == shape_version + shape_changes) {
+          _tail = child;
+          _tail_version = shape_version + shape_changes;
+        }
+      }
+      return Status::OK();
     }
 
-    void Bpt::erase(const Slice& key) {
+    Status Bpt::erase(const Slice& key) {
       NodePtr parent = nullptr;
       NodePtr child = nullptr;
       bool hold_root_lock = false;
+      // one fix per level, a merge takes one entry from the parent, that
+      // was checked before
+      bool fixed = false;
 
           retry:
           _mutex.lock();
@@ -278,8 +392,11 @@ namespace cowbpt {
           }
     
       while (true) {
-        if (!child->is_in_memory()) {
-          if(_nm) _nm->fetch(child->get_node_id(), child);
+        if (!child->is_in_memory() && _nm) {
+          Status s = _nm->fetch(child->get_node_id(), child);
+          if (!s.ok()) {
+            return unwind(s, parent, child, hold_root_lock);
+          }
         }
 
         if (child->is_staged()) {
@@ -296,39 +413,70 @@ namespace cowbpt {
             if(_nm) _nm->replace_node(child->get_node_id(), copied_node);
             child = copied_node;
             if (parent != nullptr) {
-              parent->replace_internal_node_value(key, copied_node);
+              parent->as_internal()->replace_internal_node_value(key, copied_node);
             }
           }
 
-        if (child->need_fix(parent == nullptr)) {
+        if (!fixed && child->need_fix(parent == nullptr)) {
           if (parent == nullptr && !hold_root_lock) { // need fix root, retry and get the root lock
             child->unlock();
             hold_root_lock = true;
             goto retry; 
           }
+          // child or its sibling may be _tail, see append()
+          _shape_version.fetch_add(1, std::memory_order_release);
 
           if (parent != nullptr)  { // fix non root node
-            parent->fix_child(key);
+            // fix_child writes the sibling too, it has to be in memory and
+            // not shared with a snapshot
+            auto sibling_kv = parent->as_internal()->get_fix_sibling(key);
+            NodePtr sibling = sibling_kv.second;
+            sibling->lock();
+            if (!sibling->is_in_memory() && _nm) {
+              Status s = _nm->fetch(sibling->get_node_id(), sibling);
+              if (!s.ok()) {
+                sibling->unlock();
+                return unwind(s, parent, child, hold_root_lock);
+              }
+            }
+            if (sibling->is_staged()) {
+              if (sibling->is_internalnode()) {
+                for(auto nptr : sibling->get_child_nodes()) {
+                  nptr->lock();
+                  nptr->stage();
+                  nptr->unlock();
+                }
+              }
+              NodePtr copied_node = sibling->copy();
+              if(_nm) _nm->replace_node(sibling->get_node_id(), copied_node);
+              parent->as_internal()->replace_internal_node_value(sibling_kv.first, copied_node);
+            }
+            sibling->unlock();
+
+            parent->as_internal()->fix_child(key);
           } else { // fix root node
             assert(hold_root_lock);
-            NodePtr new_root_node = _root->get_internalnode_value(Slice());
-            new_root_node->lock();
-            _root = new_root_node; 
-            child = new_root_node;
+            _root = _root->as_internal()->get_internalnode_value(Slice());
+            // a reader may still hold the old root and wait for its lock
+            child->unlock();
+            _mutex.unlock();
+            hold_root_lock = false;
+            // start again from the new root, it may have to be fetched or copied
+            goto retry;
           }
 
           if (hold_root_lock) {
             _mutex.unlock();
             hold_root_lock = false;
           }
-          if (parent == nullptr) {
-            continue;
-          }
           child->unlock();
-          child = parent->get_internalnode_value(key);
+          child = parent->as_internal()->get_internalnode_value(key);
           child->lock();
-          if (!child->is_in_memory()) {
-            if(_nm) _nm->fetch(child->get_node_id(), child);
+          if (!child->is_in_memory() && _nm) {
+            Status s = _nm->fetch(child->get_node_id(), child);
+            if (!s.ok()) {
+              return unwind(s, parent, child, hold_root_lock);
+            }
           }
 
           if (child->is_staged()) {
@@ -345,10 +493,11 @@ namespace cowbpt {
             if(_nm) _nm->replace_node(child->get_node_id(), copied_node);
             child = copied_node;
             if (parent != nullptr) {
-              parent->replace_internal_node_value(key, copied_node);
+              parent->as_internal()->replace_internal_node_value(key, copied_node);
             }
           }
 
+          fixed = true;
           continue;
         }
 
@@ -363,12 +512,13 @@ namespace cowbpt {
           break;
         }
         parent = child;
-        child = parent->get_internalnode_value(key);
+        child = parent->as_internal()->get_internalnode_value(key);
         child->lock();
+        fixed = false;
       }
 
-      child->erase(key);
+      child->as_leaf()->erase(key);
       child->unlock();
-    
+      return Status::OK();
     }
 }
\ No newline at end of file
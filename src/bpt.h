@@ -1,10 +1,12 @@
+#include <atomic>
 #include <memory>
 
 #include "comparator.h"
 #include "glog/logging.h"
 #include "slice.h"
 #include "node.h"
-#include "leveldb/db.h"
+#include "page_format.h"
+#include "page_store.h"
 #include "coding.h"
 
 #ifndef BPT_H
@@ -19,18 +21,35 @@ namespace cowbpt
     {
     public:
         BptComparator(Comparator *user_comparator)
-            : _user_comparator(user_comparator)
+            : _user_comparator(user_comparator),
+              _fixed64(user_comparator == Fixed64KeyComparator()),
+              _bytewise(user_comparator->orders_by_bytes())
         {
         }
 
+        bool orders_by_bytes() const { return _bytewise; }
+
+        Slice shortest_separator(const Slice &left, const Slice &right) const
+        {
+            return _user_comparator->shortest_separator(left, right);
+        }
+
     private:
         Comparator *_user_comparator;
+        // the keys of 8 bytes are compared here, without the virtual call
+        bool _fixed64;
+        bool _bytewise;
 
     public:
         typedef std::shared_ptr<Node<BptComparator>> NodePtr;
 
     public:
-        bool operator()(const Slice &x, const Slice &y) const { return _user_comparator->operator()(x, y); }
+        bool operator()(const Slice &x, const Slice &y) const {
+            if (_fixed64 && x.size() == 8 && y.size() == 8) {
+                return DecodeBigEndian64(x.c_string()) < DecodeBigEndian64(y.c_string());
+            }
+            return _user_comparator->operator()(x, y);
+        }
     };
 
     class Bpt
@@ -45,9 +64,12 @@ namespace cowbpt
         Bpt &operator=(const Bpt &) = delete;
         ~Bpt() = default;
 
-        void put(const Slice &key, const Slice &value);
-        void erase(const Slice &key);
-        Slice get(const Slice &key); // return an empty slice if key do not exist
+        // return the error of the pages that could not be read back
+        Status put(const Slice &key, const Slice &value);
+        Status erase(const Slice &key);
+        // *value is an empty slice if key do not exist
+        Status get(const Slice &key, Slice *value, bool verify_checksums = false);
+        Slice get(const Slice &key); // return an empty slice if key do not exist or can not be read
 
         NodePtr snaphot();
 
@@ -56,10 +78,26 @@ namespace cowbpt
         NodePtr get_root_node();
 
     private:
+        // a writer could not read a page back, release the locks it holds
+        Status unwind(const Status &s, const NodePtr &parent, const NodePtr &child, bool hold_root_lock);
+
+        // put key in _tail without going down the tree, if it goes after
+        // all the keys.  Return false if put() has to go down.
+        bool append(const Slice &key, const Slice &value);
+
         std::mutex _mutex; // _root is a shared pointer, need to be protected when it is being read and write currently;
         BptComparator _cmp;
         NodePtr _root;
         NodeManager *_nm;
+        // The rightmost leaf, found by the last put of a key after all the
+        // others, and the _shape_version it was found at.  Protected by
+        // _mutex.
+        NodePtr _tail;
+        uint64_t _tail_version = 0;
+        // bumped before a node is split or fixed, and when the tree is
+        // staged for a snapshot.  _tail is the rightmost leaf and can be
+        // written in place while it is unchanged.
+        std::atomic<uint64_t> _shape_version{0};
     };
 
     class NodeManager
@@ -68,51 +106,86 @@ namespace cowbpt
         typedef Bpt::NodePtr NodePtr;
 
     public:
-        NodeManager(leveldb::DB *internalDB, Comparator *user_comparator, uint64_t snapshot_seq = 0, uint64_t next_node_id = 0)
-            : _internalDB(internalDB),
+        NodeManager(PageStore *page_store, Comparator *user_comparator, uint64_t snapshot_seq = 0, uint64_t next_node_id = 0)
+            : _page_store(page_store),
               _snapshot_seq(snapshot_seq),
               _next_node_id(next_node_id),
               _cmp(user_comparator) {}
 
-        // need to hold the lock if nptr not null
-        NodePtr fetch(uint64_t page_id, NodePtr nptr = nullptr) {
-            leveldb::ReadOptions options;
-            std::string page_id_string;
-            PutFixed64(&page_id_string, page_id);
-            std::string value;
-            leveldb::Status level_status = _internalDB->Get(options, page_id_string, &value, _snapshot_seq);
-            if (!level_status.ok()) {
-                LOG(FATAL) << "Fail to find page id: " << page_id << " " << level_status.ToString();
-                return nullptr;
+        // read the page of nptr back into it, need to hold the lock of nptr.
+        // The checksum of the page is verified if verify_checksums or if the
+        // manager verifies every page.
+        Status fetch(uint64_t page_id, const NodePtr& nptr, bool verify_checksums = false) {
+            assert(nptr != nullptr);
+            if (nptr->is_in_memory()) {
+                // another thread fetched it while we were waiting for the lock
+                return Status::OK();
             }
-            // var int 32 == 0 means is a leafnode
-            uint32_t nodetype;
-            if(GetVarint32Ptr(value.c_str(), value.c_str()+value.size(), &nodetype) == nullptr) {
-                LOG(FATAL) << "Fail to decode the first varint32 which incating the node type";
+            NodePtr result = nptr;
+            return load(page_id, verify_checksums, result);
+        }
+
+        // read a page that no node points to yet
+        Status fetch(uint64_t page_id, NodePtr* result, bool verify_checksums = false) {
+            result->reset();
+            return load(page_id, verify_checksums, *result);
+        }
+
+        // Read the pages of nodes with one request to the page store, and
+        // fill the nodes that are still not in memory under their locks.
+        // (*statuses)[i] is the result of nodes[i].  Returns the number of
+        // nodes filled by this call.
+        size_t fetch(const std::vector<NodePtr>& nodes, std::vector<Status>* statuses) {
+            std::vector<uint64_t> page_ids;
+            page_ids.reserve(nodes.size());
+            for (auto& nptr : nodes) {
+                page_ids.push_back(nptr->get_node_id());
             }
-            if (nodetype == 0) {
-                if (nptr == nullptr) nptr.reset(new LeafNode<BptComparator>(_cmp));
-                nptr->deserialize(value);
-                nptr->set_node_id(page_id);
-                nptr->set_is_dirty(false);
-                nptr->set_is_in_memory(true);
-            } else if (nodetype == 1) {
-                if (nptr == nullptr) nptr.reset(new InternalNode<BptComparator>(_cmp));
-                nptr->deserialize(value);
-                nptr->set_node_id(page_id);
-                nptr->set_is_dirty(false);
-                nptr->set_is_in_memory(true);
-            } else {
-                assert(false);
+            std::vector<std::string> pages(nodes.size());
+            statuses->assign(nodes.size(), Status::OK());
+            _page_store->GetPages(page_ids.data(), page_ids.size(), _snapshot_seq.load(std::memory_order_acquire),
+                                  pages.data(), statuses->data());
+            size_t filled = 0;
+            for (size_t i = 0; i < nodes.size(); i++) {
+                NodePtr nptr = nodes[i];
+                nptr->lock();
+                if (nptr->is_in_memory()) {
+                    // a request got there first
+                    (*statuses)[i] = Status::OK();
+                } else if ((*statuses)[i].ok()) {
+                    (*statuses)[i] = decode(page_ids[i], false, &pages[i], nptr);
+                    filled += (*statuses)[i].ok() ? 1 : 0;
+                } else {
+                    (*statuses)[i] = read_error(page_ids[i], (*statuses)[i]);
+                }
+                nptr->unlock();
             }
+            return filled;
+        }
 
-            // TODO xuexinlei : maintain node statics
-
-            return nptr;
+        // serialize the node into the page written to the page store.  The
+        // children of node have to be serialized first, their filters are
+        // written with it.
+        Status serialize(const NodePtr& node, std::string* page) {
+            if (node->is_leafnode()) {
+                build_filter(node);
+            } else if (_leaf_filter_bits_per_key > 0) {
+                // read back before the filters were enabled
+                for (auto& child : node->get_child_nodes()) {
+                    if (child->is_leafnode() && child->is_in_memory() && child->filter().empty()) {
+                        build_filter(child);
+                    }
+                }
+            }
+            Status s = node->serialize(*page);
+            if (s.ok()) {
+                s = SealPage(_page_compression, page);
+            }
+            return s;
         }
 
         void add_new_node(NodePtr new_node) {
-            new_node->set_node_id(_next_node_id++);
+            new_node->set_node_id(new_node_id());
             new_node->set_is_dirty(true);
             new_node->set_is_in_memory(true);
 
@@ -128,15 +201,128 @@ namespace cowbpt
             return Status::OK();
         }
 
+        // ids are never reused, a page of the last checkpoint keeps its id
+        uint64_t new_node_id() {
+            return _next_node_id.fetch_add(1, std::memory_order_relaxed);
+        }
+
         void set_snapshot_seq(uint64_t snapshot_seq) {
-            _snapshot_seq = snapshot_seq;
+            _snapshot_seq.store(snapshot_seq, std::memory_order_release);
+        }
+
+        void set_verify_checksums(bool verify_checksums) {
+            _verify_checksums = verify_checksums;
+        }
+
+        void set_page_compression(CompressionType page_compression) {
+            _page_compression = page_compression;
+        }
+
+        void set_leaf_filter_bits_per_key(int bits_per_key) {
+            _leaf_filter_bits_per_key = bits_per_key;
+        }
+
+        // the limits of the nodes of the tree, given to the pages read back
+        void set_node_capacity(const NodeCapacity& capacity) {
+            _node_capacity = capacity;
+        }
+
+        const NodeCapacity& node_capacity() const {
+            return _node_capacity;
         }
 
     private:
-        leveldb::DB *_internalDB;
-        uint64_t _snapshot_seq;
-        uint64_t _next_node_id;
+        void build_filter(const NodePtr& leaf) {
+            std::string filter;
+            if (_leaf_filter_bits_per_key > 0) {
+                auto l = leaf->as_leaf();
+                const size_t n = l->size();
+                const Slice& prefix = l->key_prefix();
+                // the whole keys are put together in one buffer
+                std::string buf;
+                if (!prefix.empty()) {
+                    size_t total = 0;
+                    for (size_t i = 0; i < n; i++) {
+                        total += prefix.size() + l->get_suffix_kv(i).first.size();
+                    }
+                    buf.reserve(total);
+                }
+                std::vector<SliceView> keys;
+                keys.reserve(n);
+                for (size_t i = 0; i < n; i++) {
+                    const Slice& suffix = l->get_suffix_kv(i).first;
+                    if (prefix.empty()) {
+                        keys.push_back(SliceView(suffix));
+                        continue;
+                    }
+                    keys.push_back(SliceView(buf.data() + buf.size(), prefix.size() + suffix.size()));
+                    buf.append(prefix.c_string(), prefix.size());
+                    buf.append(suffix.c_string(), suffix.size());
+                }
+                CreateBloomFilter(keys, _leaf_filter_bits_per_key, &filter);
+            }
+            leaf->lock();
+            leaf->set_filter(std::move(filter));
+            leaf->unlock();
+        }
+
+        Status load(uint64_t page_id, bool verify_checksums, NodePtr& nptr) {
+            std::string value;
+            Status s = _page_store->GetPage(page_id, _snapshot_seq.load(std::memory_order_acquire), &value);
+            if (!s.ok()) {
+                return read_error(page_id, s);
+            }
+            return decode(page_id, verify_checksums, &value, nptr);
+        }
+
+        Status read_error(uint64_t page_id, const Status& s) {
+            LOG(ERROR) << "Fail to find page id: " << page_id << " " << s.string();
+            return s.IsNotFound() ? Status::Corruption("missing page " + std::to_string(page_id)) : s;
+        }
+
+        // fill nptr, or a new node if it is nullptr, with the page read back
+        Status decode(uint64_t page_id, bool verify_checksums, std::string* page, NodePtr& nptr) {
+            std::string& value = *page;
+            uint32_t flags;
+            Status s = UnsealPage(page_id, verify_checksums || _verify_checksums, &value, &flags);
+            if (!s.ok()) {
+                LOG(ERROR) << "Fail to read page: " << s.string();
+                return s;
+            }
+            bool internal = (flags & kInternalPage) != 0;
+            if (nptr == nullptr) {
+                if (internal) {
+                    nptr.reset(new InternalNode<BptComparator>(_cmp));
+                } else {
+                    nptr.reset(new LeafNode<BptComparator>(_cmp));
+                }
+                nptr->set_capacity(_node_capacity);
+            } else if (nptr->is_internalnode() != internal) {
+                return Status::Corruption("page " + std::to_string(page_id) + ": unexpected node type");
+            }
+            s = nptr->deserialize(value);
+            if (!s.ok()) {
+                LOG(ERROR) << "Fail to deserialize page: " << page_id << " " << s.string();
+                return Status::Corruption("page " + std::to_string(page_id) + ": " + s.string());
+            }
+            nptr->set_node_id(page_id);
+            nptr->set_is_dirty(false);
+            nptr->set_is_in_memory(true);
+
+            // TODO xuexinlei : maintain node statics
+
+            return Status::OK();
+        }
+
+        PageStore *_page_store;
+        std::atomic<uint64_t> _snapshot_seq; // changed while the log is folded in the background
+        std::atomic<uint64_t> _next_node_id; // nodes are added by concurrent writers
         BptComparator _cmp;
+        // set before the tree is used
+        bool _verify_checksums = false;
+        CompressionType _page_compression = kNoCompression;
+        int _leaf_filter_bits_per_key = 0;
+        NodeCapacity _node_capacity = NodeCapacity::FromFlags();
     };
 }
 
@@ -66,9 +66,9 @@ void PutVarint64(std::string* dst, uint64_t v) {
   dst->append(buf, ptr - buf);
 }
 
-void PutLengthPrefixedSlice(std::string* dst, const Slice& value) {
+void PutLengthPrefixedSlice(std::string* dst, const SliceView& value) {
   PutVarint32(dst, value.size());
-  dst->append(value.c_string(), value.size());
+  dst->append(value.data(), value.size());
 }
 
 int VarintLength(uint64_t v) {
@@ -163,4 +163,27 @@ bool GetLengthPrefixedSlice(Slice* input, Slice* result) {
   }
 }
 
+bool GetVarint32(SliceView* input, uint32_t* value) {
+  const char* p = input->data();
+  const char* limit = p + input->size();
+  const char* q = GetVarint32Ptr(p, limit, value);
+  if (q == nullptr) {
+    return false;
+  } else {
+    input->remove_prefix(q - p);
+    return true;
+  }
+}
+
+bool GetLengthPrefixedSlice(SliceView* input, SliceView* result) {
+  uint32_t len;
+  if (GetVarint32(input, &len) && input->size() >= len) {
+    *result = SliceView(input->data(), len);
+    input->remove_prefix(len);
+    return true;
+  } else {
+    return false;
+  }
+}
+
 } 
@@ -1,23 +1,96 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
 #include "slice.h"
 
 #ifndef COMPARATOR_H
 #define COMPARATOR_H
 
 namespace cowbpt {
+    // the 8 bytes at p as a big-endian integer
+    inline uint64_t DecodeBigEndian64(const char* p) {
+        const unsigned char* b = reinterpret_cast<const unsigned char*>(p);
+        return (static_cast<uint64_t>(b[0]) << 56) | (static_cast<uint64_t>(b[1]) << 48) |
+               (static_cast<uint64_t>(b[2]) << 40) | (static_cast<uint64_t>(b[3]) << 32) |
+               (static_cast<uint64_t>(b[4]) << 24) | (static_cast<uint64_t>(b[5]) << 16) |
+               (static_cast<uint64_t>(b[6]) << 8) | static_cast<uint64_t>(b[7]);
+    }
+
     class Comparator {
     public:
         // return true if x is less than y
         virtual bool operator() (const Slice& x, const Slice& y) const = 0;
+
+        // A key s with left < s <= right, as short as the order allows.
+        // REQUIRES: left < right
+        // When a leaf is split, the internal nodes keep it in place of
+        // the first key of the right half.
+        virtual Slice shortest_separator(const Slice& left, const Slice& right) const {
+            return right;
+        }
+
+        // true if the keys are in the order of their bytes, the tree
+        // then searches its internal nodes by key prefixes first, and its
+        // leaves by key fingerprints
+        virtual bool orders_by_bytes() const { return false; }
+    };
+
+    // the bytes of right up to the first one that differs from left, the
+    // shortest_separator() of the comparators that order keys by bytes
+    inline Slice BytewiseShortestSeparator(const Slice& left, const Slice& right) {
+        const size_t min_len = std::min(left.size(), right.size());
+        size_t n = 0;
+        while (n < min_len && left.c_string()[n] == right.c_string()[n]) {
+            n++;
+        }
+        assert(n < right.size());
+        if (n + 1 == right.size()) {
+            return right;
+        }
+        // copied, the separator outlives the leaf and the page of right
+        return Slice(SliceView(right.c_string(), n + 1));
+    }
+
+    // Orders the keys by their bytes.  It is final: a comparator derived
+    // from it could change the order, and the tree would still search by
+    // the prefixes and separators of the bytes.
+    class SliceComparator final : public Comparator {
+    public:
+        bool operator() (const Slice& x, const Slice& y) const override {
+            return x.compare(y) < 0;
+        }
+
+        Slice shortest_separator(const Slice& left, const Slice& right) const override {
+            return BytewiseShortestSeparator(left, right);
+        }
+
+        bool orders_by_bytes() const override { return true; }
     };
 
-    class SliceComparator : public Comparator {
+    // The order of SliceComparator, with the keys of 8 bytes compared as
+    // big-endian integers, which gives the same order.  The tree compares
+    // the keys itself when it is given this comparator, see
+    // Options::key_format.
+    class Fixed64Comparator final : public Comparator {
     public:
         bool operator() (const Slice& x, const Slice& y) const override {
-            return _cmp(x.string(), y.string());
+            if (x.size() == 8 && y.size() == 8) {
+                return DecodeBigEndian64(x.c_string()) < DecodeBigEndian64(y.c_string());
+            }
+            return x.compare(y) < 0;
+        }
+
+        Slice shortest_separator(const Slice& left, const Slice& right) const override {
+            return BytewiseShortestSeparator(left, right);
         }
-    private:
-        std::less<std::string> _cmp;
+
+        bool orders_by_bytes() const override { return true; }
     };
+
+    // the comparator of the dbs with kFixed64Keys
+    Comparator* Fixed64KeyComparator();
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,100 @@
+
+#include "compression.h"
+
+#if HAVE_SNAPPY
+#include <snappy.h>
+#endif
+
+namespace cowbpt {
+
+bool Snappy_Compress(const char* input, size_t input_length,
+                     std::string* output) {
+#if HAVE_SNAPPY
+  output->resize(snappy::MaxCompressedLength(input_length));
+  size_t outlen;
+  snappy::RawCompress(input, input_length, &(*output)[0], &outlen);
+  output->resize(outlen);
+  return true;
+#else
+  // Silence compiler warnings about unused arguments.
+  (void)input;
+  (void)input_length;
+  (void)output;
+  return false;
+#endif
+}
+
+bool Snappy_GetUncompressedLength(const char* input, size_t length,
+                                  size_t* result) {
+#if HAVE_SNAPPY
+  return snappy::GetUncompressedLength(input, length, result);
+#else
+  (void)input;
+  (void)length;
+  (void)result;
+  return false;
+#endif
+}
+
+bool Snappy_Uncompress(const char* input_data, size_t input_length,
+                       char* output) {
+#if HAVE_SNAPPY
+  return snappy::RawUncompress(input_data, input_length, output);
+#else
+  (void)input_data;
+  (void)input_length;
+  (void)output;
+  return false;
+#endif
+}
+
+bool CompressBlock(CompressionType type, const char* input,
+                   size_t input_length, std::string* output) {
+  std::string compressed;
+  switch (type) {
+    case kSnappyCompression:
+      if (!Snappy_Compress(input, input_length, &compressed)) {
+        return false;
+      }
+      break;
+    default:
+      return false;
+  }
+
+  // Keep the raw form unless compression saves at least 12.5%, the codec
+  // byte and the decompression on the read path are not free.
+  if (compressed.size() + 1 >= input_length - (input_length / 8u)) {
+    return false;
+  }
+  output->clear();
+  output->reserve(compressed.size() + 1);
+  output->push_back(static_cast<char>(type));
+  output->append(compressed);
+  return true;
+}
+
+bool UncompressBlock(const char* input, size_t input_length,
+                     std::string* output) {
+  if (input_length < 1) {
+    return false;
+  }
+  const char* data = input + 1;
+  const size_t n = input_length - 1;
+  switch (static_cast<unsigned char>(input[0])) {
+    case kSnappyCompression: {
+      size_t ulength = 0;
+      if (!Snappy_GetUncompressedLength(data, n, &ulength)) {
+        return false;
+      }
+      output->resize(ulength);
+      if (ulength > 0 && !Snappy_Uncompress(data, n, &(*output)[0])) {
+        return false;
+      }
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+}
@@ -0,0 +1,48 @@
+
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <cstddef>
+#include <string>
+
+#include "options.h"
+
+namespace cowbpt {
+
+// Store the snappy compression of "input[0,input_length-1]" in *output.
+// Returns false if snappy is not supported by this build.
+bool Snappy_Compress(const char* input, size_t input_length,
+                     std::string* output);
+
+// If input[0,input_length-1] looks like a valid snappy compressed
+// buffer, store the size of the uncompressed data in *result and
+// return true.  Else return false.
+bool Snappy_GetUncompressedLength(const char* input, size_t length,
+                                  size_t* result);
+
+// Attempt to snappy uncompress input[0,input_length-1] into *output.
+// Returns true if successful, false if the input is invalid snappy
+// compressed data.
+//
+// REQUIRES: at least the first "n" bytes of output[] must be writable
+// where "n" is the result of a successful call to
+// Snappy_GetUncompressedLength.
+bool Snappy_Uncompress(const char* input_data, size_t input_length,
+                       char* output);
+
+// Compress input[0,input_length-1] with "type" and store the result in
+// *output.  The first byte of *output is the CompressionType, so that
+// UncompressBlock() does not need to be told which codec was used.
+// Returns false if "type" is not supported by this build, or if the
+// compressed form is not smaller than the input by at least 1/8.
+bool CompressBlock(CompressionType type, const char* input,
+                   size_t input_length, std::string* output);
+
+// Uncompress a buffer produced by CompressBlock() into *output.
+// Returns false if the codec is unknown or the data is corrupted.
+bool UncompressBlock(const char* input, size_t input_length,
+                     std::string* output);
+
+}
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 
 #include "coding.h"
 
@@ -256,22 +257,72 @@ constexpr inline const uint8_t* RoundUp(const uint8_t* pointer) {
 
 }  // namespace
 
-// // Determine if the CPU running this program can accelerate the CRC32C
-// // calculation.
-// static bool CanAccelerateCRC32C() {
-//   port::AcceleretedCRC32C returns zero when unable to accelerate.
-//   static const char kTestCRCBuffer[] = "TestCRCBuffer";
-//   static const char kBufSize = sizeof(kTestCRCBuffer) - 1;
-//   static const uint32_t kTestCRCValue = 0xdcbc59fa;
+namespace {
 
-//   return port::AcceleratedCRC32C(0, kTestCRCBuffer, kBufSize) == kTestCRCValue;
-// }
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define COWBPT_HAVE_SSE42_CRC32C 1
+#endif
+
+#if defined(COWBPT_HAVE_SSE42_CRC32C)
+// The crc32 instruction of SSE4.2 computes crc32c.  The function is built
+// for SSE4.2 on its own, so that the rest of the library does not need it.
+__attribute__((target("sse4.2")))
+uint32_t AcceleratedCRC32C(uint32_t crc, const char* data, size_t n) {
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+  const uint8_t* e = p + n;
+  uint32_t l = crc ^ kCRC32Xor;
+  while (p != e && (reinterpret_cast<uintptr_t>(p) & 7) != 0) {
+    l = __builtin_ia32_crc32qi(l, *p++);
+  }
+#if defined(__x86_64__)
+  uint64_t l64 = l;
+  while (e - p >= 8) {
+    uint64_t word;
+    std::memcpy(&word, p, sizeof(word));
+    l64 = __builtin_ia32_crc32di(l64, word);
+    p += 8;
+  }
+  l = static_cast<uint32_t>(l64);
+#endif
+  while (e - p >= 4) {
+    uint32_t word;
+    std::memcpy(&word, p, sizeof(word));
+    l = __builtin_ia32_crc32si(l, word);
+    p += 4;
+  }
+  while (p != e) {
+    l = __builtin_ia32_crc32qi(l, *p++);
+  }
+  return l ^ kCRC32Xor;
+}
+#endif
+
+// Determine if the CPU running this program can accelerate the CRC32C
+// calculation.
+bool CanAccelerateCRC32C() {
+#if defined(COWBPT_HAVE_SSE42_CRC32C)
+  if (!__builtin_cpu_supports("sse4.2")) {
+    return false;
+  }
+  static const char kTestCRCBuffer[] = "TestCRCBuffer";
+  static const char kBufSize = sizeof(kTestCRCBuffer) - 1;
+  static const uint32_t kTestCRCValue = 0xdcbc59fa;
+
+  return AcceleratedCRC32C(0, kTestCRCBuffer, kBufSize) == kTestCRCValue;
+#else
+  return false;
+#endif
+}
+
+}  // namespace
 
 uint32_t Extend(uint32_t crc, const char* data, size_t n) {
-  // static bool accelerate = CanAccelerateCRC32C();
-  // if (accelerate) {
-  //   return port::AcceleratedCRC32C(crc, data, n);
-  // }
+#if defined(COWBPT_HAVE_SSE42_CRC32C)
+  static bool accelerate = CanAccelerateCRC32C();
+  if (accelerate) {
+    return AcceleratedCRC32C(crc, data, n);
+  }
+#endif
 
   const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
   const uint8_t* e = p + n;
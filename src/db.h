@@ -68,6 +68,14 @@ class DB {
   virtual Status Get(const ReadOptions& options, const Slice& key,
                      std::string* value) = 0;
 
+  // Same as above, but *value shares the bytes of the value held by the
+  // database instead of copying them.  The bytes stay valid and unchanged
+  // as long as *value or a copy of it is held, even if the key is written
+  // again; holding it may keep the whole page the value was read from in
+  // memory.
+  virtual Status Get(const ReadOptions& options, const Slice& key,
+                     Slice* value) = 0;
+
   // manually take a checkponit on the inmemory bpt, will drop the previous log after finished checkointing
   virtual Status ManualCheckPoint() = 0;
 
@@ -79,6 +87,20 @@ class DB {
   // The returned iterator should be deleted before this db is deleted.
   virtual Iterator* NewIterator(const ReadOptions& options) = 0;
 
+  // DB implementations can export properties about their state
+  // via this method.  If "property" is a valid property understood by this
+  // DB implementation, fills "*value" with its current value and returns
+  // true.  Otherwise returns false.
+  //
+  // Valid property names include:
+  //
+  //  "cowbpt.row-cache-stats" - returns a multi-line string with the hits,
+  //     misses, inserts and evictions of the row cache, and the entries and
+  //     bytes it holds.
+  //  "cowbpt.row-cache-usage" - returns the approximate number of bytes of
+  //     the keys and values held by the row cache.
+  virtual bool GetProperty(const Slice& property, std::string* value) = 0;
+
   // // Return a handle to the current DB state.  Iterators created with
   // // this handle will all observe a stable snapshot of the current DB
   // // state.  The caller must call ReleaseSnapshot(result) when the
@@ -6,24 +6,101 @@
 #include "glog/logging.h"
 #include "coding.h"
 #include "log_reader.h"
-#include "leveldb/write_batch.h"
 
+#include <algorithm>
 #include <iostream>
-#include <condition_variable>
+#include <limits>
 
 namespace cowbpt {
 
-    Iterator* DBImpl::NewIterator(const ReadOptions&) {
+    namespace {
+        // operations of the overlay applied to the tree between two checks
+        // for the db closing
+        const size_t kFoldBatchOps = 1024;
+
+        // drops the keys of a batch from the row cache
+        class RowCacheEraser : public WriteBatch::Handler {
+        public:
+            explicit RowCacheEraser(RowCache* cache) : _cache(cache) {}
+
+            void Put(const Slice& key, const Slice& value) override {
+                _cache->Erase(key);
+            }
+
+            void Delete(const Slice& key) override {
+                _cache->Erase(key);
+            }
+
+        private:
+            RowCache* _cache;
+        };
+
+        // the limits of the nodes of a db created with options
+        NodeCapacity NodeCapacityOf(const Options& options) {
+            NodeCapacity capacity = NodeCapacity::FromFlags();
+            if (options.node_target_bytes > 0) {
+                capacity.leaf_max_entries = std::numeric_limits<uint32_t>::max();
+                capacity.internal_max_entries = std::numeric_limits<uint32_t>::max();
+                capacity.target_bytes = options.node_target_bytes;
+            }
+            if (options.leaf_node_max_entries > 0) {
+                capacity.leaf_max_entries = std::max<size_t>(options.leaf_node_max_entries, 3);
+            }
+            if (options.internal_node_max_entries > 0) {
+                capacity.internal_max_entries = std::max<size_t>(options.internal_node_max_entries, 3);
+            }
+            return capacity;
+        }
+
+        void EncodeNodeCapacity(const NodeCapacity& capacity, std::string* dst) {
+            PutFixed64(dst, capacity.leaf_max_entries);
+            PutFixed64(dst, capacity.internal_max_entries);
+            PutFixed64(dst, capacity.target_bytes);
+        }
+
+        bool DecodeNodeCapacity(const std::string& src, NodeCapacity* capacity) {
+            if (src.size() != 3 * sizeof(uint64_t)) {
+                return false;
+            }
+            capacity->leaf_max_entries = DecodeFixed64(src.data());
+            capacity->internal_max_entries = DecodeFixed64(src.data() + 8);
+            capacity->target_bytes = DecodeFixed64(src.data() + 16);
+            return capacity->leaf_max_entries >= 3 && capacity->internal_max_entries >= 3;
+        }
+    }
+
+    Iterator* DBImpl::NewIterator(const ReadOptions& options) {
+        // the overlay is not ordered with the tree
+        Status s = wait_for_fold();
+        if (!s.ok()) {
+            return new IteratorImpl(s);
+        }
         std::lock_guard<std::mutex> lck(_mutex);
-        return new IteratorImpl(_bpt->snaphot(), _nm);
+        return new IteratorImpl(_bpt->snaphot(), _nm, options.verify_checksums);
     }
 
-    IteratorImpl::IteratorImpl(NodePtr root, NodeManager* nm)
+    IteratorImpl::IteratorImpl(NodePtr root, NodeManager* nm, bool verify_checksums)
     : _root(root),
-      _s(Status::OK()),
       _nm(nm),
+      _verify_checksums(verify_checksums),
+      _s(Status::OK()),
+      _parents(),
+      _positions(),
+      _cur_prefix(),
+      _cur_suffix(),
+      _cur_key(),
+      _cur_value(),
+      _valid(false) {}
+
+    IteratorImpl::IteratorImpl(const Status& s)
+    : _root(),
+      _nm(nullptr),
+      _verify_checksums(false),
+      _s(s),
       _parents(),
       _positions(),
+      _cur_prefix(),
+      _cur_suffix(),
       _cur_key(),
       _cur_value(),
       _valid(false) {}
@@ -40,10 +117,9 @@ namespace cowbpt {
             _parents.push_back(p);
             _positions.push_back(0);
             p->ref();
-            if (!p->is_in_memory()) {
-                p->lock();
-                if(_nm) _nm->fetch(p->get_node_id(), p);
-                p->unlock();
+            if (!fetch(p)) {
+                p->unref();
+                return;
             }
             auto new_p = p->get_child_nodes()[0];
             p->unref();
@@ -53,15 +129,12 @@ namespace cowbpt {
         _positions.push_back(0);
 
         p->ref();
-        if (!p->is_in_memory()) {
-            p->lock();
-            if(_nm) _nm->fetch(p->get_node_id(), p);
-            p->unlock();
+        if (!fetch(p)) {
+            p->unref();
+            return;
         }
-        auto a = p->get_kv(0);
+        set_current(p, 0);
         p->unref();
-        _cur_key = a.first;
-        _cur_value = a.second;
         _valid = true;
     }
 
@@ -79,10 +152,9 @@ namespace cowbpt {
         }
         auto p = _parents.back();
         p->ref();
-        if (!p->is_in_memory()) {
-            p->lock();
-            if(_nm) _nm->fetch(p->get_node_id(), p);
-            p->unlock();
+        if (!fetch(p)) {
+            p->unref();
+            return;
         }
         while (!_parents.empty() && _positions.back() == p->size() - 1) {
             p->unref();
@@ -93,10 +165,9 @@ namespace cowbpt {
             }
             p = _parents.back();
             p->ref();
-            if (!p->is_in_memory()) {
-                p->lock();
-                if(_nm) _nm->fetch(p->get_node_id(), p);
-                p->unlock();
+            if (!fetch(p)) {
+                p->unref();
+                return;
             }
         }
         if (_parents.empty()) {
@@ -108,10 +179,9 @@ namespace cowbpt {
 
         while (p->is_internalnode()) {
             p->ref();
-            if (!p->is_in_memory()) {
-                p->lock();
-                if(_nm) _nm->fetch(p->get_node_id(), p);
-                p->unlock();
+            if (!fetch(p)) {
+                p->unref();
+                return;
             }
             auto new_p = p->get_child_nodes()[_positions.back()];
             p->unref();
@@ -121,15 +191,12 @@ namespace cowbpt {
         }
 
         p->ref();
-        if (!p->is_in_memory()) {
-            p->lock();
-            if(_nm) _nm->fetch(p->get_node_id(), p);
-            p->unlock();
+        if (!fetch(p)) {
+            p->unref();
+            return;
         }
-        auto a = p->get_kv(_positions.back());
+        set_current(p, _positions.back());
         p->unref();
-        _cur_key = a.first;
-        _cur_value = a.second;
         _valid = true;
     }
 
@@ -139,6 +206,12 @@ namespace cowbpt {
 
     Slice IteratorImpl::key() const {
         assert(Valid());
+        if (_cur_prefix.empty()) {
+            return _cur_suffix;
+        }
+        if (_cur_key.empty()) {
+            _cur_key = Slice::Concat(_cur_prefix, _cur_suffix);
+        }
         return _cur_key;
     }
 
@@ -151,6 +224,29 @@ namespace cowbpt {
         return _s;
     }
 
+    void IteratorImpl::set_current(const NodePtr& p, size_t offset) {
+        auto leaf = p->as_leaf();
+        const auto& kv = leaf->get_suffix_kv(offset);
+        _cur_prefix = leaf->key_prefix();
+        _cur_suffix = kv.first;
+        _cur_key.clear();
+        _cur_value = kv.second;
+    }
+
+    bool IteratorImpl::fetch(const NodePtr& p) {
+        if (!p->is_in_memory() && _nm) {
+            p->lock();
+            Status s = _nm->fetch(p->get_node_id(), p, _verify_checksums);
+            p->unlock();
+            if (!s.ok()) {
+                _s = s;
+                _valid = false;
+                return false;
+            }
+        }
+        return true;
+    }
+
 
     Status DB::Open(const Options& options, const std::string& dbname, DB** dbptr) {
         *dbptr = nullptr;
@@ -158,23 +254,30 @@ namespace cowbpt {
 
         impl->_mutex.lock();
 
-        Status s = impl->Recover();
+        Status s;
+        if (options.key_format == kFixed64Keys && options.comparator != Options().comparator &&
+            options.comparator != Fixed64KeyComparator()) {
+            s = Status::InvalidArgument("kFixed64Keys orders the keys by their bytes, it takes no comparator");
+        } else {
+            s = impl->Recover();
+        }
         if (s.ok()) {
             impl->RemoveObsoleteFiles();
-        }
 
-        impl->_logfile_number++;
-        s = impl->_env->NewWritableFile(LogFileName(impl->_dbname, impl->_logfile_number), impl->_logfile);
-        if (s.ok()) {
-            impl->_log = new log::Writer(impl->_logfile);
-        } else {
-            LOG(ERROR) << "Fail to open file " << LogFileName(impl->_dbname, impl->_logfile_number)  << " : " << s.string();
+            impl->_logfile_number++;
+            s = impl->_env->NewWritableFile(LogFileName(impl->_dbname, impl->_logfile_number), impl->_logfile);
+            if (s.ok()) {
+                impl->_log = new log::Writer(impl->_logfile, 0, options.wal_compression,
+                                             options.wal_compression_min_size);
+            } else {
+                LOG(ERROR) << "Fail to open file " << LogFileName(impl->_dbname, impl->_logfile_number)  << " : " << s.string();
+            }
         }
 
         impl->_mutex.unlock();
 
-        impl->start_checkpoint_thread();
         if (s.ok()) {
+            impl->start_background_threads();
             *dbptr = impl;
         } else {
             delete impl;
@@ -183,9 +286,94 @@ namespace cowbpt {
         return s;
     }
 
-    void DBImpl::start_checkpoint_thread() {
-        std::thread run_checkpoint(&DBImpl::run_period, this);
-        run_checkpoint.detach();
+    void DBImpl::start_background_threads() {
+        _checkpoint_thread = std::thread(&DBImpl::run_period, this);
+        if (_overlay_active.load(std::memory_order_acquire)) {
+            _fold_thread = std::thread(&DBImpl::fold_overlay, this);
+        }
+        if (!_warmup_manifest.empty()) {
+            _warmer.reset(new PageWarmer(_nm, _DB_options.warmup_threads,
+                                         _DB_options.warmup_pages_per_sec));
+            _warmer->Start(_bpt->get_root_node(), std::move(_warmup_manifest));
+            _warmup_manifest.clear();
+        }
+        if (_DB_options.scrub_pages_per_sec > 0) {
+            _scrubber.reset(new PageScrubber(_page_store, _DB_options.scrub_pages_per_sec));
+            _scrubber->Start();
+        }
+    }
+
+    void DBImpl::stop_background_threads() {
+        {
+            std::lock_guard<std::mutex> lck(_bg_mutex);
+            _shutting_down = true;
+            _bg_cv.notify_all();
+        }
+        if (_checkpoint_thread.joinable()) {
+            _checkpoint_thread.join();
+        }
+        if (_fold_thread.joinable()) {
+            _fold_thread.join();
+        }
+        if (_warmer != nullptr) {
+            _warmer->Stop();
+        }
+        if (_scrubber != nullptr) {
+            _scrubber->Stop();
+        }
+    }
+
+    void DBImpl::fold_overlay() {
+        LOG(INFO) << "Start applying " << _overlay->Size() << " operations of the log in the background";
+        bool done = false;
+        while (!done) {
+            {
+                std::lock_guard<std::mutex> lck(_bg_mutex);
+                if (_shutting_down) {
+                    LOG(INFO) << "Stop applying the log, " << _overlay->Size() << " operations left";
+                    return;
+                }
+            }
+            Status s = _overlay->Fold(_bpt, kFoldBatchOps, &done);
+            if (!s.ok()) {
+                LOG(ERROR) << "Stop applying the log, " << _overlay->Size() << " operations left: " << s.string();
+                std::lock_guard<std::mutex> lck(_bg_mutex);
+                _fold_status = s;
+                _bg_cv.notify_all();
+                return;
+            }
+        }
+
+        // same as the end of recover_log_files
+        _nm->set_snapshot_seq(0);
+
+        std::lock_guard<std::mutex> lck(_bg_mutex);
+        _overlay_active.store(false, std::memory_order_release);
+        _bg_cv.notify_all();
+        LOG(INFO) << "Finish applying the log in the background";
+    }
+
+    Status DBImpl::wait_for_fold() {
+        std::unique_lock<std::mutex> lck(_bg_mutex);
+        _bg_cv.wait(lck, [this]() {
+            return !_overlay_active.load(std::memory_order_acquire) || _shutting_down || !_fold_status.ok();
+        });
+        if (!_overlay_active.load(std::memory_order_acquire)) {
+            return Status::OK();
+        }
+        if (!_fold_status.ok()) {
+            return _fold_status;
+        }
+        return Status::IOError("The db is closed before the log is applied");
+    }
+
+    void DBImpl::run_period() {
+        std::unique_lock<std::mutex> lck(_bg_mutex);
+        while (!_bg_cv.wait_for(lck, std::chrono::seconds(600), [this]() { return _shutting_down; })) {
+            lck.unlock();
+            ManualCheckPoint();
+            lck.lock();
+        }
     }
 
     Status DestroyDB(const std::string& dbname, const Options& options) {
@@ -209,9 +397,10 @@ namespace cowbpt {
         }
         env->RemoveDir(dbname);  // Ignore error in case dir contains other files
 
-        leveldb::Options level_options;
-        leveldb::Status level_status = leveldb::DestroyDB(InternalDBName(dbname), level_options);
-        // TODO convert level status to cowbpt status
+        Status store_status = DestroyPageStore(options, InternalDBName(dbname));
+        if (result.ok() && !store_status.ok()) {
+            result = store_status;
+        }
         return result;
     }
 
@@ -249,12 +438,12 @@ namespace cowbpt {
         // may already exist from a previous failed creation attempt.
         _env->CreateDir(_dbname);
 
-        Status s = recover_meta_from_internalDB();
+        Status s = recover_meta_from_page_store();
         if (!s.ok()) {
             return s;
         }
 
-        s = recover_pages_from_internalDB();
+        s = recover_pages_from_page_store();
         if (!s.ok()) {
             return s;
         }
@@ -263,97 +452,211 @@ namespace cowbpt {
             _bpt = new Bpt(_DB_options.comparator, _nm);
         }
 
-        s = recover_log_files();
+        if (_clean_shutdown) {
+            LOG(INFO) << "The db was closed cleanly, skip replaying the logs";
+        }
+        s = recover_log_files(!_clean_shutdown);
         if (!s.ok()) {
             return s;
         }
 
+        if (_clean_shutdown) {
+            // the writes of this session go to a new log, a crash from now on
+            // has to replay it
+            PageBatch batch;
+            batch.DeleteMeta(CleanShutdownKey());
+            s = _page_store->Write(batch, true /* sync */);
+            if (!s.ok()) {
+                LOG(ERROR) << "Fail to clear the clean shutdown mark: " << s.string();
+                return s;
+            }
+            _clean_shutdown = false;
+        }
+
         return Status::OK();
     }
 
-    Status DBImpl::recover_meta_from_internalDB() {
-        leveldb::Status level_status = leveldb::DB::Open(_internalDB_options, InternalDBName(_dbname), &_internalDB);
-        if (!level_status.ok()) {
-            LOG(ERROR) << "Fail to open internal leveldb: " << level_status.ToString();
-            return Status::Corruption(level_status.ToString());
+    Status DBImpl::recover_meta_from_page_store() {
+        Status s = OpenPageStore(_DB_options, InternalDBName(_dbname), &_page_store);
+        if (!s.ok()) {
+            LOG(ERROR) << "Fail to open the page store: " << s.string();
+            return s;
         }
-        LOG(INFO) << "Succeed to open internal leveldb";
+        LOG(INFO) << "Succeed to open the page store";
 
         std::string value;
-        level_status = _internalDB->Get(leveldb::ReadOptions(), LogFileNumberKey(), &value);
-        if (level_status.ok()) {
+        s = _page_store->GetMeta(LogFileNumberKey(), &value);
+        if (s.ok()) {
             _last_obsolete_logfile_number = DecodeFixed64(value.c_str());
-        } else if (!level_status.IsNotFound()) {
-            LOG(ERROR) << "Error when reading logfile_number from internal db: " << level_status.ToString();
-            return Status::Corruption(level_status.ToString());
+        } else if (!s.IsNotFound()) {
+            LOG(ERROR) << "Error when reading logfile_number from page store: " << s.string();
+            return s;
         }
 
         value.clear();
-        level_status = _internalDB->Get(leveldb::ReadOptions(), LastSeqInLastLogFileKey(), &value);
-        if (level_status.ok()) {
+        s = _page_store->GetMeta(LastSeqInLastLogFileKey(), &value);
+        if (s.ok()) {
             SetLastSequence(DecodeFixed64(value.c_str()));
-        } else if (!level_status.IsNotFound()) {
-            LOG(ERROR) << "Error when reading LastSeqInLastLogFile from internal db: " << level_status.ToString();
-            return Status::Corruption(level_status.ToString());
+        } else if (!s.IsNotFound()) {
+            LOG(ERROR) << "Error when reading LastSeqInLastLogFile from page store: " << s.string();
+            return s;
         }
 
         value.clear();
-        level_status = _internalDB->Get(leveldb::ReadOptions(), LastCheckpointSnapshotSeqKey(), &value);
-        if (level_status.ok()) {
+        s = _page_store->GetMeta(LastCheckpointSnapshotSeqKey(), &value);
+        if (s.ok()) {
             _last_checkpoint_snapshot_seq = DecodeFixed64(value.c_str());
-        } else if (!level_status.IsNotFound()) {
-            LOG(ERROR) << "Error when reading LastCheckpointSnapshotSeq from internal DB: " << level_status.ToString();
-            return Status::Corruption(level_status.ToString());
+        } else if (!s.IsNotFound()) {
+            LOG(ERROR) << "Error when reading LastCheckpointSnapshotSeq from page store: " << s.string();
+            return s;
+        }
+
+        value.clear();
+        s = _page_store->GetMeta(NextNodeIDKey(), &value);
+        if (s.ok()) {
+            _max_node_id_in_page_store = DecodeFixed64(value.c_str());
+        } else if (!s.IsNotFound()) {
+            LOG(ERROR) << "Error when reading NextNodeID from page store: " << s.string();
+            return s;
+        }
+
+        value.clear();
+        s = _page_store->GetMeta(CleanShutdownKey(), &value);
+        if (s.ok()) {
+            _clean_shutdown = true;
+        } else if (!s.IsNotFound()) {
+            LOG(ERROR) << "Error when reading CleanShutdown from page store: " << s.string();
+            return s;
+        }
+
+        if (_DB_options.warmup_threads > 0) {
+            value.clear();
+            s = _page_store->GetMeta(WarmupManifestKey(), &value);
+            if (s.ok()) {
+                if (!DecodeWarmupManifest(value, &_warmup_manifest)) {
+                    // only a hint, open without it
+                    LOG(ERROR) << "Fail to decode WarmupManifest from page store, skip warming up";
+                    _warmup_manifest.clear();
+                }
+            } else if (!s.IsNotFound()) {
+                LOG(ERROR) << "Error when reading WarmupManifest from page store: " << s.string();
+                return s;
+            }
         }
 
+        // the tree is only split and fixed with the limits it was built with
         value.clear();
-        level_status = _internalDB->Get(leveldb::ReadOptions(), NextNodeIDKey(), &value);
-        if (level_status.ok()) {
-            _max_node_id_in_internalDB = DecodeFixed64(value.c_str());
-        } else if (!level_status.IsNotFound()) {
-            LOG(ERROR) << "Error when reading NextNodeID from internalDB: " << level_status.ToString();
-            return Status::Corruption(level_status.ToString());
+        const NodeCapacity requested = NodeCapacityOf(_DB_options);
+        s = _page_store->GetMeta(NodeCapacityKey(), &value);
+        if (s.ok()) {
+            if (!DecodeNodeCapacity(value, &_node_capacity)) {
+                LOG(ERROR) << "Fail to decode NodeCapacity from page store";
+                return Status::Corruption("bad NodeCapacity in page store");
+            }
+            if (requested.leaf_max_entries != _node_capacity.leaf_max_entries ||
+                requested.internal_max_entries != _node_capacity.internal_max_entries ||
+                requested.target_bytes != _node_capacity.target_bytes) {
+                LOG(WARNING) << "The node limits of the options differ from the ones the db was created with, keep "
+                             << _node_capacity.leaf_max_entries << "/" << _node_capacity.internal_max_entries
+                             << " entries and " << _node_capacity.target_bytes << " bytes";
+            }
+        } else if (s.IsNotFound()) {
+            // a new db, or one created before the limits were stored
+            _node_capacity = requested;
+            PageBatch batch;
+            EncodeNodeCapacity(_node_capacity, &value);
+            batch.PutMeta(NodeCapacityKey(), value);
+            s = _page_store->Write(batch, true /* sync */);
+            if (!s.ok()) {
+                LOG(ERROR) << "Fail to store NodeCapacity in page store: " << s.string();
+                return s;
+            }
+        } else {
+            LOG(ERROR) << "Error when reading NodeCapacity from page store: " << s.string();
+            return s;
+        }
+
+        // the keys are in the order of the format the db was created with
+        value.clear();
+        s = _page_store->GetMeta(KeyFormatKey(), &value);
+        if (s.ok()) {
+            if (value.size() != sizeof(uint32_t)) {
+                LOG(ERROR) << "Fail to decode KeyFormat from page store";
+                return Status::Corruption("bad KeyFormat in page store");
+            }
+            const uint32_t key_format = DecodeFixed32(value.data());
+            if (key_format != _DB_options.key_format) {
+                LOG(ERROR) << "The db was created with key format " << key_format << ", not "
+                           << _DB_options.key_format;
+                return Status::InvalidArgument("the key format differs from the one the db was created with");
+            }
+        } else if (s.IsNotFound()) {
+            // a new db, or one created before the format was stored
+            PageBatch batch;
+            PutFixed32(&value, _DB_options.key_format);
+            batch.PutMeta(KeyFormatKey(), value);
+            s = _page_store->Write(batch, true /* sync */);
+            if (!s.ok()) {
+                LOG(ERROR) << "Fail to store KeyFormat in page store: " << s.string();
+                return s;
+            }
+        } else {
+            LOG(ERROR) << "Error when reading KeyFormat from page store: " << s.string();
+            return s;
         }
 
         // TODO: recover others
 
-        LOG(INFO) << "Succeed to recover meta from internal db";
+        LOG(INFO) << "Succeed to recover meta from page store";
         return Status::OK();
     }
 
-    Status DBImpl::recover_pages_from_internalDB() {
+    Status DBImpl::recover_pages_from_page_store() {
 
         std::string value;
-        leveldb::Status level_status;
-        uint64_t next_node_id  = _max_node_id_in_internalDB + 1;
+        uint64_t next_node_id  = _max_node_id_in_page_store + 1;
 
         if (_last_checkpoint_snapshot_seq == 0) {
             LOG(INFO) << "There are no previous checkpoint, skip recovering pages";
-            _nm = new NodeManager(_internalDB, this->_DB_options.comparator);
+            _nm = new NodeManager(_page_store, this->_DB_options.comparator);
+            _nm->set_verify_checksums(_DB_options.verify_page_checksums);
+            _nm->set_page_compression(_DB_options.page_compression);
+            _nm->set_leaf_filter_bits_per_key(_DB_options.leaf_filter_bits_per_key);
+            _nm->set_node_capacity(_node_capacity);
             return Status::OK();
         }
 
         assert(next_node_id != 0);
 
-        _nm = new NodeManager(_internalDB, this->_DB_options.comparator, _last_checkpoint_snapshot_seq, next_node_id);
+        _nm = new NodeManager(_page_store, this->_DB_options.comparator, _last_checkpoint_snapshot_seq, next_node_id);
+        _nm->set_verify_checksums(_DB_options.verify_page_checksums);
+        _nm->set_page_compression(_DB_options.page_compression);
+        _nm->set_leaf_filter_bits_per_key(_DB_options.leaf_filter_bits_per_key);
+        _nm->set_node_capacity(_node_capacity);
 
         value.clear();
-        level_status = _internalDB->Get(leveldb::ReadOptions(), RootPageIDKey(), &value, _last_checkpoint_snapshot_seq);
+        // written together with LastCheckpointSnapshotSeq
+        Status s = _page_store->GetMeta(RootPageIDKey(), &value);
         uint64_t root_page_id;
-        if (level_status.ok()) {
+        if (s.ok()) {
             root_page_id = DecodeFixed64(value.c_str());
         } else {
-            LOG(ERROR) << "Fail to find root page id when there are LastCheckpointSnapshotSeq found in internalDB";
-            return Status::NotFound(level_status.ToString());
+            LOG(ERROR) << "Fail to find root page id when there are LastCheckpointSnapshotSeq found in page store";
+            return s.IsNotFound() ? s : Status::Corruption(s.string());
         }
 
-        NodePtr root = _nm->fetch(root_page_id);
+        NodePtr root;
+        s = _nm->fetch(root_page_id, &root, true /* verify_checksums */);
+        if (!s.ok()) {
+            LOG(ERROR) << "Fail to read the root page: " << s.string();
+            return s;
+        }
         _bpt = new Bpt(_DB_options.comparator, _nm, root);
         
         return Status::OK();
     }
 
-    Status DBImpl::recover_log_files() {
+    Status DBImpl::recover_log_files(bool replay) {
         std::vector<std::string> filenames;
         Status s = _env->GetChildren(_dbname, &filenames);
         if (!s.ok()) {
@@ -369,19 +672,47 @@ namespace cowbpt {
                 if (number > _logfile_number) {
                     _logfile_number = number;
                 }
-                if (number > _last_obsolete_logfile_number) {
+                if (replay && number > _last_obsolete_logfile_number) {
                     logs.push_back(number);
                 }
             }
         }
+        // the new log has to come after the logs covered by the last
+        // checkpoint, even if they have been removed already
+        if (_logfile_number < _last_obsolete_logfile_number) {
+            _logfile_number = _last_obsolete_logfile_number;
+        }
         // Recover in the order in which the logs were generated
         std::sort(logs.begin(), logs.end());
+        std::unique_ptr<LogReplayer> replayer;
+        if (_DB_options.background_recovery && !logs.empty()) {
+            _overlay.reset(new RecoveryOverlay(_DB_options.comparator));
+        } else if (_DB_options.recovery_threads > 1 && !logs.empty()) {
+            replayer.reset(new LogReplayer(_bpt, _DB_options.comparator,
+                                           _DB_options.recovery_threads,
+                                           _DB_options.recovery_sorted_apply));
+        }
         for(size_t i = 0; i < logs.size(); i++) {
-            s = recover_log(logs[i]);
+            s = recover_log(logs[i], replayer.get(), _overlay.get());
             if (!s.ok()) {
-                return s;
+                break;
             }
         }
+        if (replayer != nullptr) {
+            Status replay_status = replayer->Finish();
+            if (s.ok()) {
+                s = replay_status;
+            }
+        }
+        if (!s.ok()) {
+            return s;
+        }
+
+        if (_overlay != nullptr) {
+            // the pages of the checkpoint are read until the overlay is applied
+            _overlay_active.store(true, std::memory_order_release);
+            return Status::OK();
+        }
 
         // finish replaying wal after last check point, no need to read the snapshot version since now
         _nm->set_snapshot_seq(0);
@@ -389,7 +720,7 @@ namespace cowbpt {
         return Status::OK();
     }
 
-    Status DBImpl::recover_log(uint64_t log_number) {
+    Status DBImpl::recover_log(uint64_t log_number, LogReplayer* replayer, RecoveryOverlay* overlay) {
         struct LogReporter : public log::Reader::Reporter {
             Env* env;
             const std::string* fname;
@@ -426,15 +757,28 @@ namespace cowbpt {
                                     Status::Corruption("log record too small"));
                 continue;
             }
-            WriteBatchInternal::SetContents(&batch, record);
-
-            s = WriteBatchInternal::InsertInto(&batch, _bpt);
-            if (!s.ok()) {
-                LOG(ERROR) << "Fail to insert when recovering log file " << fname << " : " << s.string();
-                return s;
+            // the replayer owns the batches until it has applied them
+            std::unique_ptr<WriteBatch> queued(replayer != nullptr ? new WriteBatch() : nullptr);
+            WriteBatch* b = (queued != nullptr) ? queued.get() : &batch;
+            WriteBatchInternal::SetContents(b, record);
+            const SequenceNumber last_seq = WriteBatchInternal::Sequence(b) +
+                                            WriteBatchInternal::Count(b) - 1;
+
+            if (replayer != nullptr) {
+                replayer->Add(std::move(queued));
+            } else if (overlay != nullptr) {
+                s = overlay->Add(b);
+                if (!s.ok()) {
+                    LOG(ERROR) << "Fail to index a batch when recovering log file " << fname << " : " << s.string();
+                    return s;
+                }
+            } else {
+                s = WriteBatchInternal::InsertInto(b, _bpt);
+                if (!s.ok()) {
+                    LOG(ERROR) << "Fail to insert when recovering log file " << fname << " : " << s.string();
+                    return s;
+                }
             }
-            const SequenceNumber last_seq = WriteBatchInternal::Sequence(&batch) +
-                                            WriteBatchInternal::Count(&batch) - 1;
             if (last_seq > LastSequence()) {
                 SetLastSequence(last_seq);
             }
@@ -454,31 +798,59 @@ namespace cowbpt {
       _last_obsolete_logfile_number(0),
       _logfile(nullptr),
       _log(nullptr),
-      _internalDB(nullptr),
+      _page_store(nullptr),
       _mutex(),
+      _checkpoint_mutex(),
+      _bg_mutex(),
+      _bg_cv(),
+      _shutting_down(false),
+      _checkpoint_thread(),
+      _fold_thread(),
+      _overlay(),
+      _overlay_active(false),
+      _warmup_manifest(),
+      _warmer(),
+      _clean_shutdown(false),
       _dbname(dbname),
       _DB_options(raw_options),
-      _internalDB_options(),
       _tmp_batch(new WriteBatch),
       _last_checkpoint_snapshot_seq(0),
-      _max_node_id_in_internalDB(0) {
-          _internalDB_options.create_if_missing = _DB_options.create_if_missing;
-          _internalDB_options.error_if_exists = _DB_options.error_if_exists;
+      _max_node_id_in_page_store(0),
+      _node_capacity(NodeCapacity::FromFlags()) {
+        if (_DB_options.key_format == kFixed64Keys) {
+            // the tree, the overlay and the replay compare the keys alike
+            _DB_options.comparator = Fixed64KeyComparator();
+        }
+        if (_DB_options.row_cache_size > 0) {
+            _row_cache.reset(new RowCache(_DB_options.row_cache_size));
+        }
     }
       
     DBImpl::~DBImpl() {
+        stop_background_threads();
+
+        // _log is only set once the db is opened, and the logs are still
+        // needed if the overlay has not been applied
+        if (_log && _DB_options.checkpoint_on_close &&
+            !_overlay_active.load(std::memory_order_acquire)) {
+            Status s = CheckPoint(true /* clean_shutdown */);
+            if (!s.ok()) {
+                LOG(ERROR) << "Fail to checkpoint when closing the db, the logs will be replayed: " << s.string();
+            }
+        }
+
         if (_bpt) {
             delete _bpt;
         }
         if (_log) {
             delete _log;
         }
-        if (_internalDB) {
-            delete _internalDB;
-        }
         if (_nm) {
             delete _nm;
         }
+        if (_page_store) {
+            delete _page_store;
+        }
         delete _tmp_batch;
     }
 
@@ -495,67 +867,104 @@ namespace cowbpt {
     }
 
     Status DBImpl::Get(const ReadOptions& options, const Slice& key, std::string* value) {
-        Slice result = _bpt->get(key);
+        Slice result;
+        Status s = Get(options, key, &result);
+        if (s.ok()) {
+            value->assign(result.c_string(), result.size());
+        }
+        return s;
+    }
+
+    Status DBImpl::Get(const ReadOptions& options, const Slice& key, Slice* value) {
+        bool cache = false;
+        uint64_t ticket = 0;
+        if (_overlay_active.load(std::memory_order_acquire)) {
+            Slice logged;
+            bool deleted;
+            if (_overlay->Get(key, &logged, &deleted)) {
+                if (!deleted && !logged.empty()) {
+                    *value = logged;
+                    return Status::OK();
+                }
+                return Status::NotFound("Can't found "+key.string());
+            }
+        } else if (_row_cache != nullptr) {
+            // once inactive the overlay is not used again, the tree has every write
+            Slice cached;
+            if (_row_cache->Lookup(key, &cached, &ticket)) {
+                *value = cached;
+                return Status::OK();
+            }
+            cache = true;
+        }
+        Slice result;
+        Status s = _bpt->get(key, &result, options.verify_checksums);
+        if (!s.ok()) {
+            return s;
+        }
         if (!result.empty()) {
-            *value = result.string();
+            if (cache) {
+                _row_cache->Insert(key, result, ticket);
+            }
+            *value = result;
             return Status::OK();
         } else {
             return Status::NotFound("Can't found "+key.string());
         }
     }
 
-    // Information kept for every waiting writer
-    struct DBImpl::Writer {
-        explicit Writer()
-            : batch(nullptr), sync(false), done(false) {}
-
-        Status status;
-        WriteBatch* batch;
-        bool sync;
-        bool done;
-        std::condition_variable cv;
-    };
-
     Status DBImpl::Write(const WriteOptions& options, WriteBatch* updates) {
+        if (options.disable_wal) {
+            if (options.sync) {
+                return Status::InvalidArgument("Sync writes has to enable WAL");
+            }
+            return WriteUnlogged(updates);
+        }
+
         Writer w;
         w.batch = updates;
         w.sync = options.sync;
-        w.done = false;
 
-        std::unique_lock<std::mutex> lck(_mutex);
-        _writers.push_back(&w);
-        while (!w.done && &w != _writers.front()) {
-            w.cv.wait(lck);
-        }
-        if (w.done) {
+        if (!_write_queue.JoinBatchGroup(&w)) {
+            // a leader has committed our batch
             return w.status;
         }
 
-        uint64_t last_sequence = LastSequence();
         Writer* last_writer = &w;
         
-        WriteBatch* write_batch = BuildBatchGroup(&last_writer);
-        WriteBatchInternal::SetSequence(write_batch, last_sequence + 1);
-        last_sequence += WriteBatchInternal::Count(write_batch);
-
-        // Add to log and apply to memtable.  We can release the lock
-        // during this phase since &w is currently responsible for logging
-        // and protects against concurrent loggers and concurrent writes
-        // into mem.
-        
-        lck.unlock();
-        Status status = _log->AddRecord(WriteBatchInternal::Contents(write_batch));
+        WriteBatch* write_batch = BuildBatchGroup(&w, &last_writer);
+        WriteBatchInternal::SetSequence(write_batch,
+                                        AllocateSequence(WriteBatchInternal::Count(write_batch)));
+
+        // Add to log and apply to memtable.  No lock is needed during this
+        // phase since &w is currently the leader of _write_queue, which
+        // protects against concurrent loggers and concurrent writes into mem.
+        // a sync write sends the group with its sync
+        Status status = _log->AddRecord(WriteBatchInternal::Contents(write_batch), !options.sync);
         bool sync_error = false;
+        bool syncing = false;
         if (status.ok() && options.sync) {
-            status = _logfile->Sync();
+            // Let the disk sync the group while we apply it to the tree, the
+            // writers are not completed before the sync has finished.  Readers
+            // may see the group a bit before it is durable, like a non-sync
+            // write.
+            status = _logfile->AsyncSync();
             if (!status.ok()) {
             sync_error = true;
+            } else {
+            syncing = true;
             }
         }
         if (status.ok()) {
-            status = WriteBatchInternal::InsertInto(write_batch, _bpt);
+            status = ApplyToTree(write_batch);
+        }
+        if (syncing) {
+            Status sync_status = _logfile->WaitForSync();
+            if (!sync_status.ok()) {
+            sync_error = true;
+            status = sync_status;
+            }
         }
-        lck.lock();
 
         if (sync_error) {
             LOG(FATAL) << "Fail to sync log file :" << status.string();
@@ -563,31 +972,65 @@ namespace cowbpt {
         
         if (write_batch == _tmp_batch) _tmp_batch->Clear();
 
-        SetLastSequence(last_sequence);
-        
+        _write_queue.ExitAsBatchGroupLeader(&w, last_writer, status);
 
-        while (true) {
-            Writer* ready = _writers.front();
-            _writers.pop_front();
-            if (ready != &w) {
-                ready->status = status;
-                ready->done = true;
-                ready->cv.notify_one();
-            }
-            if (ready == last_writer) break;
-        }
+        return status;
+    }
+
+    Status DBImpl::WriteUnlogged(WriteBatch* updates) {
+        // Unlogged writes still consume sequence numbers, so that the last
+        // sequence recorded by a checkpoint covers every write it contains,
+        // and the sequence never goes backward after a restart.
+        WriteBatchInternal::SetSequence(updates,
+                                        AllocateSequence(WriteBatchInternal::Count(updates)));
+        return ApplyToTree(updates);
+    }
 
-        // Notify new head of write queue
-        if (!_writers.empty()) {
-            _writers.front()->cv.notify_one();
+    Status DBImpl::ApplyToTree(WriteBatch* updates) {
+        Status s;
+        if (_overlay_active.load(std::memory_order_acquire)) {
+            s = _overlay->Apply(updates, _bpt);
+        } else {
+            s = WriteBatchInternal::InsertInto(updates, _bpt);
         }
+        if (_row_cache != nullptr) {
+            // only once the writes are in the tree, a Get that read the
+            // tree before does not cache what it read
+            RowCacheEraser eraser(_row_cache.get());
+            updates->Iterate(&eraser);
+        }
+        return s;
+    }
 
-        return status;
+    bool DBImpl::GetProperty(const Slice& property, std::string* value) {
+        value->clear();
+        if (SliceView(property) == "cowbpt.row-cache-stats") {
+            RowCache::Stats stats;
+            if (_row_cache != nullptr) {
+                stats = _row_cache->GetStats();
+            }
+            char buf[256];
+            snprintf(buf, sizeof(buf),
+                     "hits: %llu\nmisses: %llu\ninserts: %llu\nevictions: %llu\n"
+                     "entries: %llu\nusage: %llu\n",
+                     static_cast<unsigned long long>(stats.hits),
+                     static_cast<unsigned long long>(stats.misses),
+                     static_cast<unsigned long long>(stats.inserts),
+                     static_cast<unsigned long long>(stats.evictions),
+                     static_cast<unsigned long long>(stats.entries),
+                     static_cast<unsigned long long>(stats.usage));
+            value->append(buf);
+            return true;
+        } else if (SliceView(property) == "cowbpt.row-cache-usage") {
+            size_t usage = _row_cache != nullptr ? _row_cache->GetStats().usage : 0;
+            value->append(std::to_string(usage));
+            return true;
+        }
+        return false;
     }
 
-    WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
-        assert(!_writers.empty());
-        Writer* first = _writers.front();
+    WriteBatch* DBImpl::BuildBatchGroup(Writer* leader, Writer** last_writer) {
+        Writer* first = leader;
         WriteBatch* result = first->batch;
         assert(result != nullptr);
 
@@ -602,37 +1045,52 @@ namespace cowbpt {
         }
 
         *last_writer = first;
-        std::deque<Writer*>::iterator iter = _writers.begin();
-        ++iter;  // Advance past "first"
-        for (; iter != _writers.end(); ++iter) {
-            Writer* w = *iter;
+        Writer* newest = _write_queue.LinkGroup(leader);
+        Writer* w = first;
+        while (w != newest) {
+            w = w->link_newer;
             if (w->sync && !first->sync) {
             // Do not include a sync write into a batch handled by a non-sync write.
             break;
             }
 
-            if (w->batch != nullptr) {
+            if (w->batch == nullptr) {
+            // Do not include a writer that wants to run alone.
+            break;
+            }
+
             size += WriteBatchInternal::ByteSize(w->batch);
             if (size > max_size) {
-                // Do not make batch too big
-                break;
+            // Do not make batch too big
+            break;
             }
 
             // Append to *result
             if (result == first->batch) {
-                // Switch to temporary batch instead of disturbing caller's batch
-                result = _tmp_batch;
-                assert(WriteBatchInternal::Count(result) == 0);
-                WriteBatchInternal::Append(result, first->batch);
+            // Switch to temporary batch instead of disturbing caller's batch
+            result = _tmp_batch;
+            assert(WriteBatchInternal::Count(result) == 0);
+            WriteBatchInternal::Append(result, first->batch);
             }
             WriteBatchInternal::Append(result, w->batch);
-            }
             *last_writer = w;
         }
         return result;
     }
 
     Status DBImpl::ManualCheckPoint() {
+        return CheckPoint(false);
+    }
+
+    Status DBImpl::CheckPoint(bool clean_shutdown) {
+        // the logs are needed until the overlay is in the tree
+        Status fold_status = wait_for_fold();
+        if (!fold_status.ok()) {
+            return fold_status;
+        }
+
+        std::lock_guard<std::mutex> checkpoint_lck(_checkpoint_mutex);
+
         WritableFilePtr new_logfile;
         Status s = _env->NewWritableFile(LogFileName(_dbname, _logfile_number+1), new_logfile);
         if (!s.ok()) {
@@ -643,99 +1101,171 @@ namespace cowbpt {
         uint64_t last_applied_seq_id;
         NodePtr root;
 
+        // become the leader of the write queue without any batch, so that
+        // no writer is appending to the log while we are switching it
+        Writer w;
         {
-            std::lock_guard<std::mutex> lck(_mutex);
+            bool is_leader = _write_queue.JoinBatchGroup(&w);
+            assert(is_leader);
+            (void)is_leader;
 
             _logfile = new_logfile;
             delete _log;
-            _log = new log::Writer(_logfile);
+            _log = new log::Writer(_logfile, 0, _DB_options.wal_compression,
+                                   _DB_options.wal_compression_min_size);
             _logfile_number++;
 
-            last_applied_seq_id = _last_seq_id;
-        
             root = _bpt->snaphot();
+
+            // read the sequence after taking the snapshot, an unlogged write
+            // that made it into the snapshot has allocated its sequence already
+            last_applied_seq_id = LastSequence();
+
+            if (!clean_shutdown) {
+                _write_queue.ExitAsBatchGroupLeader(&w, &w, Status::OK());
+            }
         }
 
-        // traverse the tree and put serialized pages into internalDB
-        DeepTraverse(root);
+        // traverse the tree and put serialized pages into the page store
+        WarmupManifest manifest;
+        bool root_moved = false;
+        s = DeepTraverse(root, &root_moved, &manifest);
 
         root->lock();
         root->un_stage();
         root->unlock();
 
-        std::string value;
-        leveldb::Status level_status;
-        value.clear();
-        PutFixed64(&value, root->get_node_id());
-        level_status = _internalDB->Put(leveldb::WriteOptions(), RootPageIDKey(), value);
-        if (!level_status.ok()) {
-            LOG(FATAL) << "Fail to update RootPageID at the end of checkpoint: " << root->get_node_id() << " " << level_status.ToString();
+        if (!s.ok()) {
+            // the meta still points at the last checkpoint, and the logs
+            // since then are kept
+            LOG(ERROR) << "Fail to serialize the pages of the checkpoint: " << s.string();
+            if (clean_shutdown) {
+                _write_queue.ExitAsBatchGroupLeader(&w, &w, s);
+            }
+            return s;
         }
-        
+        TrimWarmupManifest(&manifest, _DB_options.warmup_max_pages);
+
+        PageBatch wb;
+        std::string value;
 
-        leveldb::WriteBatch wb;
+        // the meta is not versioned, the root of the checkpoint is switched
+        // in the same batch as its snapshot
+        PutFixed64(&value, root->get_node_id());
+        wb.PutMeta(RootPageIDKey(), value);
 
         value.clear();
         uint64_t new_checkpoint_snapshot_seq = 0;
-        new_checkpoint_snapshot_seq = _internalDB->GetDurableSnapshot();
+        new_checkpoint_snapshot_seq = _page_store->GetDurableSnapshot();
         PutFixed64(&value, new_checkpoint_snapshot_seq);
-        wb.Put(LastCheckpointSnapshotSeqKey(), value);
+        wb.PutMeta(LastCheckpointSnapshotSeqKey(), value);
 
         value.clear();
         _last_obsolete_logfile_number = _logfile_number - 1;
         PutFixed64(&value, _last_obsolete_logfile_number);
-        wb.Put(LogFileNumberKey(), value);
+        wb.PutMeta(LogFileNumberKey(), value);
 
         value.clear();
         PutFixed64(&value, last_applied_seq_id);
-        wb.Put(LastSeqInLastLogFileKey(), value);
+        wb.PutMeta(LastSeqInLastLogFileKey(), value);
+
+        value.clear();
+        EncodeWarmupManifest(manifest, &value);
+        wb.PutMeta(WarmupManifestKey(), value);
+
+        if (clean_shutdown) {
+            // the new log is empty, nothing has to be replayed at the next open
+            wb.PutMeta(CleanShutdownKey(), std::string());
+        }
 
-        level_status = _internalDB->Write(leveldb::WriteOptions(), &wb);
-        if (!level_status.ok()) {
-            LOG(FATAL) << "Fail to update meta after finished checkpointing: " << level_status.ToString();
-            return Status::IOError(level_status.ToString());
+        s = _page_store->Write(wb, clean_shutdown /* sync */);
+        if (!s.ok()) {
+            LOG(FATAL) << "Fail to update meta after finished checkpointing: " << s.string();
+            return s;
         }
 
-        _internalDB->ReleaseDurableSnapshot(_last_checkpoint_snapshot_seq);
+        // the pages that are not in memory are the same in both checkpoints,
+        // and the store may drop the versions only the old one reads
+        _nm->set_snapshot_seq(new_checkpoint_snapshot_seq);
+        _page_store->ReleaseDurableSnapshot(_last_checkpoint_snapshot_seq);
         _last_checkpoint_snapshot_seq = new_checkpoint_snapshot_seq;
 
         RemoveObsoleteFiles();
 
-        
+        if (clean_shutdown) {
+            _write_queue.ExitAsBatchGroupLeader(&w, &w, Status::OK());
+        }
+
         return Status::OK();
     }
 
-    void DBImpl::DeepTraverse(const NodePtr& root) {
+    Status DBImpl::DeepTraverse(const NodePtr& root, bool* moved, WarmupManifest* manifest, size_t depth) {
+        *moved = false;
         if (root == nullptr || !root->is_in_memory()) {
-            return;
+            return Status::OK();
+        }
+
+        // children first, so that they get their new ids before the parent
+        // is serialized
+        bool child_moved = false;
+        if (root->is_internalnode()) {
+            std::vector<NodePtr> child_nodes = root->get_child_nodes();
+            for (auto & child_node : child_nodes) {
+                bool moved_child = false;
+                Status s = DeepTraverse(child_node, &moved_child, manifest, depth + 1);
+                if (!s.ok()) {
+                    return s;
+                }
+                child_moved |= moved_child;
+            }
         }
 
-        // Serialize dirty page and flush into internalDB
-        if (root->is_dirty()) {
-            leveldb::WriteBatch wb;
-            if (root->get_node_id() > _max_node_id_in_internalDB) {
+        // Serialize dirty page and flush into the page store
+        if (root->is_dirty() || child_moved) {
+            PageBatch wb;
+            if (_DB_options.checkpoint_reassign_page_ids) {
+                uint64_t old_id = root->get_node_id();
+                if (old_id <= _max_node_id_in_page_store) {
+                    // the last checkpoint still reads it at its snapshot
+                    wb.DeletePage(old_id);
+                }
+                // a writer copies the node with its id under the lock
+                root->lock();
+                root->set_node_id(_nm->new_node_id());
+                root->unlock();
+                *moved = true;
+            }
+            if (root->get_node_id() > _max_node_id_in_page_store) {
                 std::string value;
                 PutFixed64(&value, root->get_node_id() + 1);
-                wb.Put(NextNodeIDKey(), value);
-                _max_node_id_in_internalDB = root->get_node_id();
+                wb.PutMeta(NextNodeIDKey(), value);
+                _max_node_id_in_page_store = root->get_node_id();
             }
-            std::string key;
             std::string value;
-            PutFixed64(&key, root->get_node_id());
-            assert(root->serialize(value).ok());
-            wb.Put(key, value);
-            leveldb::Status level_status = _internalDB->Write(leveldb::WriteOptions(), &wb);
-            if (!level_status.ok()) {
-                LOG(FATAL) << "Fail to flush page: " << root->get_node_id() << " " << level_status.ToString();
+            Status s = _nm->serialize(root, &value);
+            if (!s.ok()) {
+                // root stays dirty, its old page is not deleted
+                return s;
+            }
+            wb.PutPage(root->get_node_id(), std::move(value));
+            s = _page_store->Write(wb, false /* sync */);
+            if (!s.ok()) {
+                LOG(FATAL) << "Fail to flush page: " << root->get_node_id() << " " << s.string();
             }
+            // the page is staged, a writer modifies a copy of it, so the next
+            // checkpoint only writes the pages modified since this one
+            root->lock();
+            root->set_is_dirty(false);
+            root->unlock();
         }
 
-        if (root->is_internalnode()) {
-            std::vector<NodePtr> child_nodes = root->get_child_nodes();
-            for (auto & child_node : child_nodes) {
-                DeepTraverse(child_node);
+        if (manifest != nullptr) {
+            if (manifest->size() <= depth) {
+                manifest->resize(depth + 1);
             }
+            (*manifest)[depth].push_back(root->get_node_id());
         }
+        return Status::OK();
     }
 
 }
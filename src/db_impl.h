@@ -3,21 +3,27 @@
 
 #include <cassert>
 #include <thread>
+#include <atomic>
 #include <condition_variable>
 
 
 #include "db.h"
 #include "bpt.h"
 #include "env.h"
-#include "leveldb/db.h"
-#include "leveldb/db.h"
+#include "page_store.h"
 #include "log_writer.h"
+#include "write_queue.h"
+#include "replay.h"
+#include "row_cache.h"
+#include "recovery_overlay.h"
+#include "scrubber.h"
+#include "warmup.h"
 
 namespace cowbpt {
     
     class DBImpl : public DB {
     private:
-        struct Writer;
+        typedef WriteQueue::Writer Writer;
     public:
         DBImpl(const Options& options, const std::string& dbname);
 
@@ -33,35 +39,69 @@ namespace cowbpt {
         Status Write(const WriteOptions& options, WriteBatch* updates) override;
         Status Get(const ReadOptions& options, const Slice& key,
                     std::string* value) override;
+        Status Get(const ReadOptions& options, const Slice& key,
+                    Slice* value) override;
         Status ManualCheckPoint() override;
-        void DeepTraverse(const Bpt::NodePtr& root);
+        // write the dirty pages under root, and add the pages in memory to
+        // manifest if it is not null
+        // *moved is set to true if the page of root was written under a new id.
+        // Stops at the first page that can not be serialized, and returns its error.
+        Status DeepTraverse(const Bpt::NodePtr& root, bool* moved,
+                            WarmupManifest* manifest = nullptr, size_t depth = 0);
         Iterator* NewIterator(const ReadOptions&) override;
+        bool GetProperty(const Slice& property, std::string* value) override;
         // const Snapshot* GetSnapshot() override;
         // void ReleaseSnapshot(const Snapshot* snapshot) override;
     
     private:
 
         // Return the last sequence number.
-        uint64_t LastSequence() const { return _last_seq_id; }
+        uint64_t LastSequence() const { return _last_seq_id.load(std::memory_order_acquire); }
 
         // Set the last sequence number to s.
+        // only used when recovering, when there are no concurrent writers
         void SetLastSequence(uint64_t s) {
-            assert(s >= _last_seq_id);
-            _last_seq_id = s;
+            assert(s >= LastSequence());
+            _last_seq_id.store(s, std::memory_order_release);
         }
-        void run_period(){
-            std::this_thread::sleep_for(std::chrono::seconds(600));
-            ManualCheckPoint();
+
+        // Reserve count sequence numbers, return the first one.
+        uint64_t AllocateSequence(uint64_t count) {
+            return _last_seq_id.fetch_add(count, std::memory_order_acq_rel) + 1;
         }
+        // checkpoint every 10 minutes until the db is closing
+        void run_period();
 
-        Status Recover();
-        void start_checkpoint_thread();
-        Status recover_meta_from_internalDB();
-        Status recover_pages_from_internalDB();
-        Status recover_log_files();
-        Status recover_log(uint64_t log_number);
+        // apply the overlay to the tree until it is empty, the db is closing
+        // or the tree fails to take an operation
+        void fold_overlay();
+        // an error if the db is closing or the fold stopped before the
+        // overlay is applied
+        Status wait_for_fold();
+
+        // if clean_shutdown is true, writers are kept out until the end and
+        // the checkpoint is marked as the last one before closing the db
+        Status CheckPoint(bool clean_shutdown);
 
-        WriteBatch* BuildBatchGroup(Writer** last_writer);
+        Status Recover();
+        void start_background_threads();
+        void stop_background_threads();
+        Status recover_meta_from_page_store();
+        Status recover_pages_from_page_store();
+        // find the logs written after the last checkpoint, and replay them
+        // if replay is true
+        Status recover_log_files(bool replay);
+        // replay the log into the tree, or hand it to replayer or overlay
+        // if one of them is not null
+        Status recover_log(uint64_t log_number, LogReplayer* replayer, RecoveryOverlay* overlay);
+
+        // apply the updates to the tree, or through _overlay while it is active
+        Status ApplyToTree(WriteBatch* updates);
+
+        // REQUIRES: leader is the leader of _write_queue
+        WriteBatch* BuildBatchGroup(Writer* leader, Writer** last_writer);
+        // apply updates to the tree without logging it
+        Status WriteUnlogged(WriteBatch* updates);
         void RemoveObsoleteFiles();
     
     private:
@@ -74,29 +114,64 @@ namespace cowbpt {
 
         NodeManager* _nm;
 
-        uint64_t _last_seq_id;
+        // Both logged and unlogged writes take their sequence numbers from
+        // here, so unlogged writes leave gaps in the sequence of the log
+        std::atomic<uint64_t> _last_seq_id;
         uint64_t _logfile_number;
         uint64_t _last_obsolete_logfile_number;
 
         WritableFilePtr _logfile;
         log::Writer* _log; 
 
-        leveldb::DB* _internalDB;
+        PageStore* _page_store;
 
         std::mutex _mutex;
 
+        std::mutex _checkpoint_mutex; // only one checkpoint at a time
+
+        // stops the periodic checkpoint
+        std::mutex _bg_mutex;
+        std::condition_variable _bg_cv;
+        bool _shutting_down;
+        std::thread _checkpoint_thread;
+        std::thread _fold_thread;
+
+        // the log that has not been applied to the tree yet, only with
+        // background_recovery.  It is kept until the db is closed, and only
+        // used while _overlay_active is true.
+        std::unique_ptr<RecoveryOverlay> _overlay;
+        std::atomic<bool> _overlay_active; // changed with _bg_mutex held
+        // the error that stopped fold_overlay(), the overlay stays active
+        // and the logs are kept.  Protected by _bg_mutex.
+        Status _fold_status;
+
+        // the pages to read back after opening the db, only with warmup_threads
+        WarmupManifest _warmup_manifest;
+        std::unique_ptr<PageWarmer> _warmer;
+
+        // verifies the pages of the last checkpoint, only with scrub_pages_per_sec
+        std::unique_ptr<PageScrubber> _scrubber;
+
+        // the values read by Get, only with row_cache_size
+        std::unique_ptr<RowCache> _row_cache;
+
+        // the db was closed by a checkpoint, no log needs to be replayed
+        bool _clean_shutdown;
+
         const std::string _dbname;
 
         Options _DB_options;
-        leveldb::Options _internalDB_options;
 
-        std::deque<Writer*> _writers;
+        WriteQueue _write_queue;
 
-        WriteBatch* _tmp_batch;
+        WriteBatch* _tmp_batch; // only accessed by the leader of _write_queue
         
         uint64_t _last_checkpoint_snapshot_seq;
 
-        uint64_t _max_node_id_in_internalDB;
+        uint64_t _max_node_id_in_page_store;
+
+        // the limits of the nodes, as stored when the db was created
+        NodeCapacity _node_capacity;
     };
     
     class IteratorImpl : public Iterator {
@@ -104,7 +179,10 @@ namespace cowbpt {
         typedef Bpt::NodePtr NodePtr;
 
         public:
-        IteratorImpl(NodePtr root, NodeManager* nm);
+        IteratorImpl(NodePtr root, NodeManager* nm, bool verify_checksums = false);
+
+        // an iterator that is not valid, with the error s
+        explicit IteratorImpl(const Status& s);
 
         IteratorImpl(const IteratorImpl&) = delete;
         IteratorImpl& operator=(const IteratorImpl&) = delete;
@@ -154,13 +232,24 @@ namespace cowbpt {
         virtual Status status() const override;
 
         private:
+        // read p back if it is not in memory, false if it can not be read,
+        // the iterator is then invalid and status() has the error
+        bool fetch(const NodePtr& p);
+
+        // position at the entry at offset of leaf p
+        void set_current(const NodePtr& p, size_t offset);
 
         NodePtr _root;
         NodeManager* _nm;
+        bool _verify_checksums;
         Status _s;
         std::vector<NodePtr> _parents;
         std::vector<size_t> _positions;
-        Slice _cur_key;
+        // the key is put together by key(), from the prefix of the leaf
+        // and the rest of the key
+        Slice _cur_prefix;
+        Slice _cur_suffix;
+        mutable Slice _cur_key;
         Slice _cur_value;
         bool _valid;
 
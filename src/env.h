@@ -50,7 +50,7 @@ namespace cowbpt {
         //
         // The returned file may be concurrently accessed by multiple threads.
         virtual Status NewRandomAccessFile(const std::string& fname,
-                                           RandomAccessFilePtr result) = 0;
+                                           RandomAccessFilePtr& result) = 0;
 
         // Create an object that writes to a new file with the specified
         // name.  Deletes any existing file with the same name and creates a
@@ -203,10 +203,21 @@ namespace cowbpt {
 
         virtual ~WritableFile() = default;
 
-        virtual Status Append(const Slice& data) = 0;
+        virtual Status Append(const SliceView& data) = 0;
         virtual Status Close() = 0;
         virtual Status Flush() = 0;
         virtual Status Sync() = 0;
+
+        // Start making everything appended so far durable, without waiting
+        // for it.  The caller may keep doing other work, but must call
+        // WaitForSync() before it relies on the data being durable, and must
+        // not Append() in between.
+        //
+        // The default implementation only flushes, and syncs in WaitForSync().
+        virtual Status AsyncSync() { return Flush(); }
+
+        // Wait for the sync started by the last AsyncSync() to finish.
+        virtual Status WaitForSync() { return Sync(); }
     };
 
     class RandomAccessFile {
@@ -228,11 +239,46 @@ namespace cowbpt {
         //
         // Safe for concurrent use by multiple threads.
         virtual Status Read(uint64_t offset, size_t n, Slice& result) const = 0;
+
+        struct ReadRequest {
+            uint64_t offset;
+            size_t n;
+            Slice result;   // set by MultiRead()
+            Status status;  // set by MultiRead()
+        };
+
+        // Read every request in reqs[0, num-1], as if Read() was called for
+        // each of them.  Implementations may issue the reads at once instead
+        // of one after another, e.g. when faulting in several pages.
+        // Returns the first non-OK status of the requests, if any.
+        //
+        // Safe for concurrent use by multiple threads.
+        virtual Status MultiRead(ReadRequest* reqs, size_t num) const {
+            Status status;
+            for (size_t i = 0; i < num; i++) {
+                reqs[i].status = Read(reqs[i].offset, reqs[i].n, reqs[i].result);
+                if (status.ok() && !reqs[i].status.ok()) {
+                    status = reqs[i].status;
+                }
+            }
+            return status;
+        }
     };
 
 
     Status ReadFileToString(Env* env, const std::string& fname, std::string* data);
 
+    // Return an Env that does file IO through io_uring.  Appends and syncs of
+    // a WritableFile are submitted without blocking, so AsyncSync() really
+    // overlaps with the caller, and RandomAccessFile::MultiRead() submits all
+    // of its reads with one syscall.  Everything else is done by Env::Default().
+    //
+    // Returns Env::Default() if cowbpt is built without liburing or the
+    // kernel does not support io_uring.
+    //
+    // The result belongs to cowbpt and must never be deleted.
+    Env* IoUringEnv();
+
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,584 @@
+#include "env.h"
+
+#if COWBPT_HAVE_LIBURING
+
+#include <liburing.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#endif
+
+namespace cowbpt {
+
+#if COWBPT_HAVE_LIBURING
+
+    Status PosixError(const std::string& context, int error_number);
+
+    namespace {
+
+    constexpr const size_t kUringWritableFileBufferSize = 65536;
+
+    constexpr const unsigned kUringQueueDepth = 64;
+
+    // Writes that are submitted but not reaped yet keep their buffer alive,
+    // a full buffer waits for some of them to finish beyond this.
+    constexpr const size_t kMaxInflightWrites = 16;
+
+    constexpr const int kUringOpenBaseFlags = O_CLOEXEC;
+
+    // Appends are buffered like PosixWritableFile does.  Flush() hands the
+    // buffer to the kernel without waiting for the write, so that nothing
+    // is lost if only the process dies and readers of the file see it.  A
+    // sync sends what is left in the buffer with its fsync request, in one
+    // io_uring_enter(), the fsync is drained behind every write submitted
+    // before it.
+    //
+    // Writes go to explicit offsets, so requests in flight never overlap.
+    class IoUringWritableFile final : public WritableFile {
+    public:
+        // The new instance takes ownership of |fd|, which has "offset" bytes.
+        IoUringWritableFile(std::string filename, int fd, uint64_t offset)
+            : fd_(fd),
+              offset_(offset),
+              filename_(std::move(filename)),
+              ring_initialized_(false),
+              unsubmitted_(0),
+              inflight_(0),
+              sync_stale_(false) {}
+
+        ~IoUringWritableFile() override {
+            if (fd_ >= 0) {
+                // Ignoring any potential errors
+                Close();
+            }
+        }
+
+        Status Init() {
+            int r = io_uring_queue_init(kUringQueueDepth, &ring_, 0);
+            if (r < 0) {
+                return PosixError(filename_, -r);
+            }
+            ring_initialized_ = true;
+            return Status::OK();
+        }
+
+        Status Append(const SliceView& data) override {
+            if (!error_.ok()) {
+                return error_;
+            }
+            buf_.append(data.data(), data.size());
+            if (buf_.size() >= kUringWritableFileBufferSize) {
+                return WriteBuffer();
+            }
+            return Status::OK();
+        }
+
+        Status Close() override {
+            Status status = error_;
+            if (status.ok() && !buf_.empty()) {
+                status = WriteBuffer();
+            }
+            Status drain = Reap();
+            if (status.ok()) {
+                status = drain;
+            }
+            if (ring_initialized_) {
+                io_uring_queue_exit(&ring_);
+                ring_initialized_ = false;
+            }
+            const int close_result = ::close(fd_);
+            if (close_result < 0 && status.ok()) {
+                status = PosixError(filename_, errno);
+            }
+            fd_ = -1;
+            return status;
+        }
+
+        Status Flush() override {
+            if (error_.ok() && !buf_.empty()) {
+                return WriteBuffer();
+            }
+            return error_;
+        }
+
+        Status Sync() override {
+            Status status = AsyncSync();
+            if (status.ok()) {
+                status = WaitForSync();
+            }
+            return status;
+        }
+
+        // The tail of the buffer and the fsync go to the kernel with a single
+        // io_uring_enter().
+        Status AsyncSync() override {
+            if (!error_.ok()) {
+                return error_;
+            }
+            if (!buf_.empty() && !PrepareWrite()) {
+                return error_;
+            }
+            io_uring_sqe* sqe = GetSqe();
+            if (sqe == nullptr) {
+                return error_;
+            }
+            io_uring_prep_fsync(sqe, fd_, 0);
+            // start only after every write submitted before it has finished
+            io_uring_sqe_set_flags(sqe, IOSQE_IO_DRAIN);
+            io_uring_sqe_set_data(sqe, nullptr);
+            unsubmitted_++;
+            return Submit();
+        }
+
+        Status WaitForSync() override {
+            Status status = Reap();
+            if (status.ok() && sync_stale_) {
+                // a short write was finished synchronously, maybe after the
+                // fsync had completed
+                if (::fsync(fd_) != 0) {
+                    status = SetError(PosixError(filename_, errno));
+                }
+                sync_stale_ = false;
+            }
+            return status;
+        }
+
+    private:
+        struct PendingWrite {
+            std::string data;
+            uint64_t offset;
+        };
+
+        // nullptr if the submission queue stays full
+        io_uring_sqe* GetSqe() {
+            io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+            if (sqe == nullptr && Submit().ok()) {
+                sqe = io_uring_get_sqe(&ring_);
+            }
+            if (sqe == nullptr) {
+                SetError(Status::IOError(filename_ + " io_uring submission queue is full"));
+            }
+            return sqe;
+        }
+
+        // submit buf_, and bound the buffers in flight
+        Status WriteBuffer() {
+            if (!PrepareWrite()) {
+                return error_;
+            }
+            Status status = Submit();
+            while (status.ok() && inflight_ > kMaxInflightWrites) {
+                bool reaped = false;
+                status = ReapOne(true /*wait*/, &reaped);
+            }
+            return status;
+        }
+
+        // move buf_ into a write request, without submitting it.  buf_ gets
+        // the buffer of a write that has completed, if any.
+        bool PrepareWrite() {
+            io_uring_sqe* sqe = GetSqe();
+            if (sqe == nullptr) {
+                return false;
+            }
+            PendingWrite* w;
+            if (free_writes_.empty()) {
+                writes_.emplace_back(new PendingWrite);
+                w = writes_.back().get();
+            } else {
+                w = free_writes_.back();
+                free_writes_.pop_back();
+            }
+            w->data.swap(buf_);
+            w->offset = offset_;
+            offset_ += w->data.size();
+
+            io_uring_prep_write(sqe, fd_, w->data.data(),
+                                static_cast<unsigned>(w->data.size()), w->offset);
+            io_uring_sqe_set_data(sqe, w);
+            unsubmitted_++;
+            return true;
+        }
+
+        // Only the requests taken by the kernel are waited for, the others
+        // never complete.
+        Status Submit() {
+            if (!error_.ok()) {
+                return error_;
+            }
+            int r;
+            do {
+                r = io_uring_submit(&ring_);
+            } while (r == -EINTR);
+            if (r < 0) {
+                return SetError(PosixError(filename_, -r));
+            }
+            const size_t submitted = std::min<size_t>(r, unsubmitted_);
+            unsubmitted_ -= submitted;
+            inflight_ += submitted;
+            return Status::OK();
+        }
+
+        // Reap one completion, block for it if wait is true.
+        // *reaped is set to false if nothing was reaped, because nothing had
+        // completed or because the ring failed.
+        Status ReapOne(bool wait, bool* reaped) {
+            io_uring_cqe* cqe = nullptr;
+            int r;
+            do {
+                r = wait ? io_uring_wait_cqe(&ring_, &cqe)
+                         : io_uring_peek_cqe(&ring_, &cqe);
+            } while (r == -EINTR);
+            *reaped = (r == 0);
+            if (r == -EAGAIN && !wait) {
+                return error_;
+            }
+            if (r < 0) {
+                return SetError(PosixError(filename_, -r));
+            }
+
+            PendingWrite* w = static_cast<PendingWrite*>(io_uring_cqe_get_data(cqe));
+            const int res = cqe->res;
+            io_uring_cqe_seen(&ring_, cqe);
+            inflight_--;
+
+            if (res < 0) {
+                SetError(PosixError(filename_, -res));
+            } else if (w != nullptr && static_cast<size_t>(res) < w->data.size()) {
+                // Rare for regular files, finish the rest synchronously
+                // rather than reordering it behind a pending fsync.
+                Status s = WriteUnbuffered(w->data.data() + res,
+                                           w->data.size() - res, w->offset + res);
+                if (!s.ok()) {
+                    SetError(s);
+                }
+                sync_stale_ = true;
+            }
+            if (w != nullptr) {
+                w->data.clear();  // keeps its capacity for the next write
+                free_writes_.push_back(w);
+            }
+            return error_;
+        }
+
+        // Reap completions until nothing is in flight, or the ring fails.
+        Status Reap() {
+            while (inflight_ > 0) {
+                bool reaped = false;
+                Status s = ReapOne(true /*wait*/, &reaped);
+                if (!reaped) {
+                    return s;
+                }
+            }
+            return error_;
+        }
+
+        Status WriteUnbuffered(const char* data, size_t size, uint64_t offset) {
+            while (size > 0) {
+                ssize_t write_result = ::pwrite(fd_, data, size, static_cast<off_t>(offset));
+                if (write_result < 0) {
+                    if (errno == EINTR) {
+                        continue;  // Retry
+                    }
+                    return PosixError(filename_, errno);
+                }
+                data += write_result;
+                size -= write_result;
+                offset += write_result;
+            }
+            return Status::OK();
+        }
+
+        // An asynchronous error can't be tied to the call that caused it, so
+        // the first one is kept and returned by every later call.
+        Status SetError(const Status& s) {
+            if (error_.ok()) {
+                error_ = s;
+            }
+            return error_;
+        }
+
+        std::string buf_;  // data appended but not submitted
+        int fd_;
+        uint64_t offset_;  // file offset of buf_[0]
+        const std::string filename_;
+
+        io_uring ring_;
+        bool ring_initialized_;
+        size_t unsubmitted_;  // requests prepared but not taken by the kernel
+        size_t inflight_;     // submitted requests not reaped yet
+        bool sync_stale_;
+        Status error_;
+
+        // every write buffer, reused once its write completes
+        std::vector<std::unique_ptr<PendingWrite>> writes_;
+        std::vector<PendingWrite*> free_writes_;
+    };
+
+    // Single reads are a plain pread(), a ring round trip can't beat that.
+    // MultiRead() prepares one read per request and submits them together.
+    // The requests the ring does not complete are read with Read().  Once
+    // the ring fails it is not used again: a request may be left in it.
+    class IoUringRandomAccessFile final : public RandomAccessFile {
+    public:
+        // The new instance takes ownership of |fd|.
+        IoUringRandomAccessFile(std::string filename, int fd)
+            : fd_(fd), filename_(std::move(filename)), ring_initialized_(false), ring_failed_(false) {}
+
+        ~IoUringRandomAccessFile() override {
+            if (ring_initialized_) {
+                io_uring_queue_exit(&ring_);
+            }
+            ::close(fd_);
+        }
+
+        Status Init() {
+            int r = io_uring_queue_init(kUringQueueDepth, &ring_, 0);
+            if (r < 0) {
+                return PosixError(filename_, -r);
+            }
+            ring_initialized_ = true;
+            return Status::OK();
+        }
+
+        Status Read(uint64_t offset, size_t n, Slice& result) const override {
+            std::unique_ptr<char[]> scratch(new char[n + 1]());
+            Status status;
+            ssize_t read_size = ::pread(fd_, scratch.get(), n, static_cast<off_t>(offset));
+            result = Slice(scratch.get(), (read_size < 0) ? 0 : read_size);
+            if (read_size < 0) {
+                status = PosixError(filename_, errno);
+            }
+            return status;
+        }
+
+        Status MultiRead(ReadRequest* reqs, size_t num) const override {
+            Status status;
+            std::vector<std::unique_ptr<char[]>> scratch(num);
+            std::vector<bool> done(num, false);
+
+            std::lock_guard<std::mutex> lck(mutex_);
+            for (size_t start = 0; start < num && !ring_failed_; start += kUringQueueDepth) {
+                const size_t end = std::min<size_t>(num, start + kUringQueueDepth);
+                size_t prepared = 0;
+                for (size_t i = start; i < end; i++) {
+                    io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+                    if (sqe == nullptr) {
+                        break;
+                    }
+                    scratch[i].reset(new char[reqs[i].n + 1]());
+                    io_uring_prep_read(sqe, fd_, scratch[i].get(),
+                                       static_cast<unsigned>(reqs[i].n), reqs[i].offset);
+                    io_uring_sqe_set_data(sqe, &reqs[i]);
+                    prepared++;
+                }
+
+                // the kernel takes the prepared requests in order
+                size_t submitted = 0;
+                while (submitted < prepared) {
+                    int r;
+                    do {
+                        r = io_uring_submit(&ring_);
+                    } while (r == -EINTR);
+                    if (r <= 0) {
+                        // the rest stay in the submission queue
+                        ring_failed_ = true;
+                        break;
+                    }
+                    submitted += r;
+                }
+
+                for (size_t reaped = 0; reaped < submitted; reaped++) {
+                    io_uring_cqe* cqe = nullptr;
+                    int r;
+                    do {
+                        r = io_uring_wait_cqe(&ring_, &cqe);
+                    } while (r == -EINTR);
+                    if (r < 0) {
+                        // the reads not reaped may still fill their buffers
+                        ring_failed_ = true;
+                        for (size_t i = start; i < start + submitted; i++) {
+                            if (!done[i]) {
+                                orphaned_.push_back(std::move(scratch[i]));
+                            }
+                        }
+                        break;
+                    }
+                    ReadRequest* req = static_cast<ReadRequest*>(io_uring_cqe_get_data(cqe));
+                    const int res = cqe->res;
+                    io_uring_cqe_seen(&ring_, cqe);
+                    const size_t i = req - reqs;
+                    if (res < 0) {
+                        req->result = Slice();
+                        req->status = PosixError(filename_, -res);
+                    } else {
+                        req->result = Slice(scratch[i].get(), res);
+                        req->status = Status::OK();
+                    }
+                    scratch[i].reset();
+                    done[i] = true;
+                }
+            }
+
+            for (size_t i = 0; i < num; i++) {
+                if (!done[i]) {
+                    reqs[i].status = Read(reqs[i].offset, reqs[i].n, reqs[i].result);
+                }
+                if (status.ok() && !reqs[i].status.ok()) {
+                    status = reqs[i].status;
+                }
+            }
+            return status;
+        }
+
+    private:
+        const int fd_;
+        const std::string filename_;
+        mutable std::mutex mutex_;  // protects ring_
+        mutable io_uring ring_;
+        bool ring_initialized_;
+        mutable bool ring_failed_;  // MultiRead() only calls Read()
+        // the buffers of the reads left in a failed ring
+        mutable std::vector<std::unique_ptr<char[]>> orphaned_;
+    };
+
+    // Files that benefit from io_uring are opened here, everything else is
+    // forwarded to the posix Env.
+    class UringEnv final : public Env {
+    public:
+        explicit UringEnv(Env* posix) : posix_(posix) {}
+
+        Status NewSequentialFile(const std::string& fname,
+                                 SequentialFilePtr& result) override {
+            return posix_->NewSequentialFile(fname, result);
+        }
+
+        Status NewRandomAccessFile(const std::string& fname,
+                                   RandomAccessFilePtr& result) override {
+            int fd = ::open(fname.c_str(), O_RDONLY | kUringOpenBaseFlags);
+            if (fd < 0) {
+                result = nullptr;
+                return PosixError(fname, errno);
+            }
+            std::shared_ptr<IoUringRandomAccessFile> file(new IoUringRandomAccessFile(fname, fd));
+            if (!file->Init().ok()) {
+                // e.g. out of locked memory for the ring
+                file.reset();
+                return posix_->NewRandomAccessFile(fname, result);
+            }
+            result = file;
+            return Status::OK();
+        }
+
+        Status NewWritableFile(const std::string& fname,
+                               WritableFilePtr& result) override {
+            return NewUringWritableFile(fname, O_TRUNC, result);
+        }
+
+        Status NewAppendableFile(const std::string& fname,
+                                 WritableFilePtr& result) override {
+            return NewUringWritableFile(fname, 0, result);
+        }
+
+        bool FileExists(const std::string& fname) override {
+            return posix_->FileExists(fname);
+        }
+
+        Status GetChildren(const std::string& dir,
+                           std::vector<std::string>* result) override {
+            return posix_->GetChildren(dir, result);
+        }
+
+        Status RemoveFile(const std::string& fname) override {
+            return posix_->RemoveFile(fname);
+        }
+
+        Status CreateDir(const std::string& dirname) override {
+            return posix_->CreateDir(dirname);
+        }
+
+        Status RemoveDir(const std::string& dirname) override {
+            return posix_->RemoveDir(dirname);
+        }
+
+        Status GetFileSize(const std::string& fname, uint64_t* file_size) override {
+            return posix_->GetFileSize(fname, file_size);
+        }
+
+        Status RenameFile(const std::string& src,
+                          const std::string& target) override {
+            return posix_->RenameFile(src, target);
+        }
+
+        Status GetTestDirectory(std::string* path) override {
+            return posix_->GetTestDirectory(path);
+        }
+
+    private:
+        // Appendable files are not opened with O_APPEND, writes carry their
+        // own offset starting at the current end of the file.
+        Status NewUringWritableFile(const std::string& fname, int extra_flags,
+                                    WritableFilePtr& result) {
+            int fd = ::open(fname.c_str(),
+                            extra_flags | O_WRONLY | O_CREAT | kUringOpenBaseFlags, 0644);
+            if (fd < 0) {
+                result = nullptr;
+                return PosixError(fname, errno);
+            }
+            off_t offset = ::lseek(fd, 0, SEEK_END);
+            if (offset < 0) {
+                Status s = PosixError(fname, errno);
+                ::close(fd);
+                result = nullptr;
+                return s;
+            }
+            std::shared_ptr<IoUringWritableFile> file(
+                new IoUringWritableFile(fname, fd, static_cast<uint64_t>(offset)));
+            if (!file->Init().ok()) {
+                file.reset();
+                return extra_flags == O_TRUNC ? posix_->NewWritableFile(fname, result)
+                                              : posix_->NewAppendableFile(fname, result);
+            }
+            result = file;
+            return Status::OK();
+        }
+
+        Env* const posix_;
+    };
+
+    // io_uring can be compiled in but disabled by the kernel, e.g. by
+    // io_uring_disabled or a seccomp filter.
+    bool IoUringSupported() {
+        io_uring ring;
+        if (io_uring_queue_init(1, &ring, 0) < 0) {
+            return false;
+        }
+        io_uring_queue_exit(&ring);
+        return true;
+    }
+
+    }  // namespace
+
+    Env* IoUringEnv() {
+        // Like Env::Default(), never destroyed.
+        static Env* env = IoUringSupported() ? new UringEnv(Env::Default())
+                                             : Env::Default();
+        return env;
+    }
+
+#else
+
+    Env* IoUringEnv() {
+        return Env::Default();
+    }
+
+#endif
+
+}
@@ -37,9 +37,9 @@ namespace cowbpt {
         }
     }
 
-    Status Append(const Slice& data) override {
+    Status Append(const SliceView& data) override {
         size_t write_size = data.size();
-        const char* write_data = data.c_string();
+        const char* write_data = data.data();
 
         // Fit as much as possible into buffer.
         size_t copy_size = std::min(write_size, kWritableFileBufferSize - pos_);
@@ -294,9 +294,10 @@ namespace cowbpt {
     }
 
     Status NewRandomAccessFile(const std::string& filename,
-                                RandomAccessFilePtr result) override {
+                                RandomAccessFilePtr& result) override {
         int fd = ::open(filename.c_str(), O_RDONLY | kOpenBaseFlags);
         if (fd < 0) {
+        result = nullptr;
         return PosixError(filename, errno);
         }
 
@@ -49,10 +49,41 @@ std::string TempFileName(const std::string& dbname, uint64_t number) {
   return MakeFileName(dbname, number, "dbtmp");
 }
 
+std::string PageSegmentFileName(const std::string& dirname, uint64_t number) {
+  assert(number > 0);
+  return MakeFileName(dirname, number, "seg");
+}
+
+Status SetCurrentFile(Env* env, const std::string& dbname,
+                      uint64_t descriptor_number) {
+  // Remove leading "dbname/" and add newline to manifest file name
+  std::string manifest = DescriptorFileName(dbname, descriptor_number);
+  Slice contents(manifest.substr(dbname.size() + 1) + "\n");
+  std::string tmp = TempFileName(dbname, descriptor_number);
+  WritableFilePtr file;
+  Status s = env->NewWritableFile(tmp, file);
+  if (s.ok()) {
+    s = file->Append(contents);
+  }
+  if (s.ok()) {
+    s = file->Sync();
+  }
+  if (s.ok()) {
+    s = file->Close();
+  }
+  if (s.ok()) {
+    s = env->RenameFile(tmp, CurrentFileName(dbname));
+  }
+  if (!s.ok()) {
+    env->RemoveFile(tmp);
+  }
+  return s;
+}
+
 // Owned filenames have the form:
 //    dbname/CURRENT
 //    dbname/MANIFEST-[0-9]+
-//    dbname/[0-9]+.(log)
+//    dbname/[0-9]+.(log|dbtmp|seg)
 bool ParseFileName(const std::string& filename, uint64_t* number,
                    FileType* type) {
   Slice rest(filename);
@@ -82,6 +113,8 @@ bool ParseFileName(const std::string& filename, uint64_t* number,
       *type = kLogFile;
     } else if (suffix == Slice(".dbtmp")) {
       *type = kTempFile;
+    } else if (suffix == Slice(".seg")) {
+      *type = kPageSegmentFile;
     } else {
       return false;
     }
@@ -132,4 +165,12 @@ std::string LastCheckpointSnapshotSeqKey() { return "LastCheckpointSnapshotSeq";
 std::string RootPageIDKey() { return "RootPageID"; }
 
 std::string NextNodeIDKey() {return "NextNodeID"; }
+
+std::string CleanShutdownKey() { return "CleanShutdown"; }
+
+std::string WarmupManifestKey() { return "WarmupManifest"; }
+
+std::string NodeCapacityKey() { return "NodeCapacity"; }
+
+std::string KeyFormatKey() { return "KeyFormat"; }
 } 
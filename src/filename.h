@@ -17,6 +17,7 @@ enum FileType {
   kDescriptorFile,
   kCurrentFile,
   kTempFile,
+  kPageSegmentFile,
 };
 
 // Return the name of the log file with the specified number
@@ -42,26 +43,49 @@ std::string InternalDBName(const std::string& dbname);
 // The result will be prefixed with "dbname".
 std::string TempFileName(const std::string& dbname, uint64_t number);
 
+// Return the name of the segment file with the specified number of the
+// page store in the directory "dirname".  The result will be prefixed
+// with "dirname".
+std::string PageSegmentFileName(const std::string& dirname, uint64_t number);
+
+// Make the CURRENT file point to the descriptor file with the
+// specified number.
+Status SetCurrentFile(Env* env, const std::string& dbname,
+                      uint64_t descriptor_number);
+
 // If filename is a leveldb file, store the type of the file in *type.
 // The number encoded in the filename is stored in *number.  If the
 // filename was successfully parsed, returns true.  Else return false.
 bool ParseFileName(const std::string& filename, uint64_t* number,
                    FileType* type);
 
-// log_number key that stores in leveldb
+// log_number key that stores in the page store
 std::string LogFileNumberKey();
 
-// LastSeqInLastLogFile key that stores in leveldb
+// LastSeqInLastLogFile key that stores in the page store
 std::string LastSeqInLastLogFileKey();
 
-// LastCheckpointSnapshotSeq key stores in leveldb
+// LastCheckpointSnapshotSeq key stores in the page store
 std::string LastCheckpointSnapshotSeqKey();
 
-// RootPageID key stores in leveldb
+// RootPageID key stores in the page store
 std::string RootPageIDKey();
 
-// NextNodeID key stores in leveldb
+// NextNodeID key stores in the page store
 std::string NextNodeIDKey();
+
+// CleanShutdown key stores in the page store, present only while the db is closed
+// cleanly
+std::string CleanShutdownKey();
+
+// WarmupManifest key stores in the page store
+std::string WarmupManifestKey();
+
+// NodeCapacity key stores in the page store, written when the db is created
+std::string NodeCapacityKey();
+
+// KeyFormat key stores in the page store, written when the db is created
+std::string KeyFormatKey();
 }  
 
 #endif
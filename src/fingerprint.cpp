@@ -0,0 +1,36 @@
+#include "fingerprint.h"
+
+#include "hash.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace cowbpt {
+
+    uint8_t KeyFingerprint(const char* data, size_t n) {
+        // not the seed of the bloom filters, the keys that collide there
+        // should not collide here too
+        return static_cast<uint8_t>(Hash(data, n, 0x5f3759df) >> 24);
+    }
+
+    size_t FindFingerprint(const uint8_t* fingerprints, size_t n, size_t from, uint8_t fp) {
+        size_t i = from;
+#if defined(__SSE2__)
+        const __m128i key = _mm_set1_epi8(static_cast<char>(fp));
+        for (; i + 16 <= n; i += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(fingerprints + i));
+            int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, key));
+            if (mask != 0) {
+                return i + __builtin_ctz(mask);
+            }
+        }
+#endif
+        for (; i < n; i++) {
+            if (fingerprints[i] == fp) {
+                return i;
+            }
+        }
+        return n;
+    }
+}
@@ -0,0 +1,19 @@
+#ifndef FINGERPRINT_H
+#define FINGERPRINT_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace cowbpt {
+
+    // A byte of the hash of a key.  Keys with different fingerprints are
+    // different, keys with equal ones have to be compared.
+    uint8_t KeyFingerprint(const char* data, size_t n);
+
+    // Return the first offset in [from, n) of fingerprints whose
+    // fingerprint is fp, n if there is none.  16 fingerprints are
+    // compared at once with SSE2 if the CPU has it.
+    size_t FindFingerprint(const uint8_t* fingerprints, size_t n, size_t from, uint8_t fp);
+}
+
+#endif
@@ -0,0 +1,16 @@
+
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace cowbpt {
+
+// Simple hash function used by the bloom filters of the leaves and the
+// row cache
+uint32_t Hash(const char* data, size_t n, uint32_t seed);
+
+}
+
+#endif
@@ -0,0 +1,109 @@
+#include "key_prefix.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define COWBPT_PREFIX_SIMD 1
+#endif
+
+namespace cowbpt {
+
+    namespace {
+        // the prefixes in a cache line
+        const size_t kWindow = 8;
+
+        // the number of a[0, n-1] less than p, n <= kWindow
+        typedef size_t (*CountLessFn)(const int64_t* a, size_t n, int64_t p);
+
+        size_t CountLessScalar(const int64_t* a, size_t n, int64_t p) {
+            size_t count = 0;
+            for (size_t i = 0; i < n; i++) {
+                count += a[i] < p;
+            }
+            return count;
+        }
+
+#ifdef COWBPT_PREFIX_SIMD
+        __attribute__((target("sse4.2")))
+        size_t CountLessSSE42(const int64_t* a, size_t n, int64_t p) {
+            if (n < kWindow) {
+                return CountLessScalar(a, n, p);
+            }
+            const __m128i key = _mm_set1_epi64x(p);
+            int mask = 0;
+            for (size_t i = 0; i < kWindow; i += 2) {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+                mask |= _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(key, v))) << i;
+            }
+            return __builtin_popcount(mask);
+        }
+
+        __attribute__((target("avx2")))
+        size_t CountLessAVX2(const int64_t* a, size_t n, int64_t p) {
+            if (n < kWindow) {
+                return CountLessScalar(a, n, p);
+            }
+            const __m256i key = _mm256_set1_epi64x(p);
+            __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a));
+            __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + 4));
+            int mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(key, lo))) |
+                       _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(key, hi))) << 4;
+            return __builtin_popcount(mask);
+        }
+#endif
+
+        struct Kernel {
+            CountLessFn count_less;
+            const char* name;
+        };
+
+        Kernel PickKernel() {
+#ifdef COWBPT_PREFIX_SIMD
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2")) {
+                return Kernel{CountLessAVX2, "avx2"};
+            }
+            if (__builtin_cpu_supports("sse4.2")) {
+                return Kernel{CountLessSSE42, "sse4.2"};
+            }
+#endif
+            return Kernel{CountLessScalar, "scalar"};
+        }
+
+        const Kernel& kernel() {
+            static const Kernel k = PickKernel();
+            return k;
+        }
+    }
+
+    int64_t KeyPrefix(const char* data, size_t n) {
+        const unsigned char* b = reinterpret_cast<const unsigned char*>(data);
+        uint64_t prefix = 0;
+        for (size_t i = 0; i < 8; i++) {
+            prefix = (prefix << 8) | (i < n ? b[i] : 0);
+        }
+        return static_cast<int64_t>(prefix ^ (uint64_t(1) << 63));
+    }
+
+    size_t PrefixLowerBound(const int64_t* prefixes, size_t n, int64_t p) {
+        if (n <= kWindow) {
+            return kernel().count_less(prefixes, n, p);
+        }
+        // the result is in [base, base + len]
+        size_t base = 0;
+        size_t len = n;
+        while (len > kWindow) {
+            const size_t half = len / 2;
+            base = prefixes[base + half - 1] < p ? base + half : base;
+            len -= half;
+        }
+        // a whole window, the prefixes before base are less than p
+        if (base > n - kWindow) {
+            base = n - kWindow;
+        }
+        return base + kernel().count_less(prefixes + base, kWindow, p);
+    }
+
+    const char* PrefixSearchKernel() {
+        return kernel().name;
+    }
+}
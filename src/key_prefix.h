@@ -0,0 +1,25 @@
+#ifndef KEY_PREFIX_H
+#define KEY_PREFIX_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace cowbpt {
+
+    // The first 8 bytes of a key as a big-endian integer, padded with
+    // zeros, with the top bit flipped.  If a key is before another one by
+    // their bytes, its prefix is less or equal, compared as signed
+    // integers.  Keys with equal prefixes have to be compared in full.
+    int64_t KeyPrefix(const char* data, size_t n);
+
+    // Return the first offset of the sorted prefixes[0, n-1] whose prefix
+    // is not less than p, n if there is none.  The search halves the
+    // range down to a cache line, that is compared at once with AVX2 or
+    // SSE4.2 if the CPU has them.
+    size_t PrefixLowerBound(const int64_t* prefixes, size_t n, int64_t p);
+
+    // the instructions PrefixLowerBound() uses: "avx2", "sse4.2" or "scalar"
+    const char* PrefixSearchKernel();
+}
+
+#endif
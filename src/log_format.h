@@ -14,10 +14,16 @@ namespace cowbpt {
     // For fragments
     kFirstType = 2,
     kMiddleType = 3,
-    kLastType = 4
+    kLastType = 4,
+
+    // Same as kFullType and kFirstType, but the logical record is
+    // compressed, see CompressBlock().  The rest of a compressed
+    // fragmented record uses kMiddleType and kLastType.
+    kCompressedFullType = 5,
+    kCompressedFirstType = 6
     };
 
-    static const int kMaxRecordType = kLastType;
+    static const int kMaxRecordType = kCompressedFirstType;
 
     static const int kBlockSize = 32768;
 
@@ -6,6 +6,7 @@
 #include "env.h"
 #include "coding.h"
 #include "crc32c.h"
+#include "compression.h"
 
 namespace cowbpt {
 namespace log {
@@ -60,6 +61,8 @@ bool Reader::ReadRecord(Slice* record, std::string* scratch) {
   scratch->clear();
   record->clear();
   bool in_fragmented_record = false;
+  // True if the fragmented record being assembled has to be uncompressed
+  bool in_compressed_record = false;
   // Record offset of the logical record that we're reading
   // 0 is a dummy value to make compilers happy
   uint64_t prospective_record_offset = 0;
@@ -102,6 +105,23 @@ bool Reader::ReadRecord(Slice* record, std::string* scratch) {
         last_record_offset_ = prospective_record_offset;
         return true;
 
+      case kCompressedFullType:
+        if (in_fragmented_record) {
+          if (!scratch->empty()) {
+            ReportCorruption(scratch->size(), "partial record without end(3)");
+          }
+          in_fragmented_record = false;
+        }
+        prospective_record_offset = physical_record_offset;
+        if (!UncompressBlock(fragment.c_string(), fragment.size(), scratch)) {
+          ReportCorruption(fragment.size(), "corrupted compressed record");
+          scratch->clear();
+          break;
+        }
+        *record = Slice(*scratch);
+        last_record_offset_ = prospective_record_offset;
+        return true;
+
       case kFirstType:
         if (in_fragmented_record) {
           // Handle bug in earlier versions of log::Writer where
@@ -115,6 +135,19 @@ bool Reader::ReadRecord(Slice* record, std::string* scratch) {
         prospective_record_offset = physical_record_offset;
         scratch->assign(fragment.c_string(), fragment.size());
         in_fragmented_record = true;
+        in_compressed_record = false;
+        break;
+
+      case kCompressedFirstType:
+        if (in_fragmented_record) {
+          if (!scratch->empty()) {
+            ReportCorruption(scratch->size(), "partial record without end(4)");
+          }
+        }
+        prospective_record_offset = physical_record_offset;
+        scratch->assign(fragment.c_string(), fragment.size());
+        in_fragmented_record = true;
+        in_compressed_record = true;
         break;
 
       case kMiddleType:
@@ -132,6 +165,17 @@ bool Reader::ReadRecord(Slice* record, std::string* scratch) {
                            "missing start of fragmented record(2)");
         } else {
           scratch->append(fragment.c_string(), fragment.size());
+          if (in_compressed_record) {
+            if (!UncompressBlock(scratch->data(), scratch->size(),
+                                 &uncompressed_)) {
+              ReportCorruption(scratch->size(), "corrupted compressed record");
+              in_fragmented_record = false;
+              in_compressed_record = false;
+              scratch->clear();
+              break;
+            }
+            scratch->swap(uncompressed_);
+          }
           *record = Slice(*scratch);
           last_record_offset_ = prospective_record_offset;
           return true;
@@ -151,6 +195,7 @@ bool Reader::ReadRecord(Slice* record, std::string* scratch) {
         if (in_fragmented_record) {
           ReportCorruption(scratch->size(), "error in middle of record");
           in_fragmented_record = false;
+          in_compressed_record = false;
           scratch->clear();
         }
         break;
@@ -162,6 +207,7 @@ bool Reader::ReadRecord(Slice* record, std::string* scratch) {
             (fragment.size() + (in_fragmented_record ? scratch->size() : 0)),
             buf);
         in_fragmented_record = false;
+        in_compressed_record = false;
         scratch->clear();
         break;
       }
@@ -91,6 +91,7 @@ class Reader {
   char* const backing_store_;
   Slice buffer_;
   bool eof_;  // Last Read() indicated EOF by returning < kBlockSize
+  std::string uncompressed_;  // Reused buffer for fragmented compressed records
 
   // Offset of the last record returned by ReadRecord.
   uint64_t last_record_offset_;
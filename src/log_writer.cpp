@@ -2,6 +2,7 @@
 #include "env.h"
 #include "coding.h"
 #include "crc32c.h"
+#include "compression.h"
 
 
 namespace cowbpt {
@@ -13,21 +14,49 @@ namespace cowbpt {
         }
         }
 
-        Writer::Writer(WritableFilePtr dest) : dest_(dest), block_offset_(0) {
+        Writer::Writer(WritableFilePtr dest)
+            : dest_(dest),
+              block_offset_(0),
+              compression_(kNoCompression),
+              compression_min_size_(0) {
         InitTypeCrc(type_crc_);
         }
 
         Writer::Writer(WritableFilePtr dest, uint64_t dest_length)
-            : dest_(dest), block_offset_(dest_length % kBlockSize) {
+            : dest_(dest),
+              block_offset_(dest_length % kBlockSize),
+              compression_(kNoCompression),
+              compression_min_size_(0) {
+        InitTypeCrc(type_crc_);
+        }
+
+        Writer::Writer(WritableFilePtr dest, uint64_t dest_length,
+                       CompressionType compression, size_t compression_min_size)
+            : dest_(dest),
+              block_offset_(dest_length % kBlockSize),
+              compression_(compression),
+              compression_min_size_(compression_min_size) {
         InitTypeCrc(type_crc_);
         }
 
         Writer::~Writer() = default;
 
-        Status Writer::AddRecord(const Slice& slice) {
-        const char* ptr = slice.c_string();
+        Status Writer::AddRecord(const SliceView& slice, bool flush) {
+        const char* ptr = slice.data();
         size_t left = slice.size();
 
+        // Only the type of the first fragment tells the reader that the
+        // record is compressed, the following fragments are plain
+        // kMiddleType/kLastType.
+        bool compressed = false;
+        if (compression_ != kNoCompression && left > 0 &&
+            left >= compression_min_size_ &&
+            CompressBlock(compression_, ptr, left, &compressed_)) {
+            ptr = compressed_.data();
+            left = compressed_.size();
+            compressed = true;
+        }
+
         // Fragment the record if necessary and emit it.  Note that if slice
         // is empty, we still want to iterate once to emit a single
         // zero-length record
@@ -41,7 +70,7 @@ namespace cowbpt {
             if (leftover > 0) {
                 // Fill the trailer (literal below relies on kHeaderSize being 7)
                 static_assert(kHeaderSize == 7, "");
-                dest_->Append(Slice("\x00\x00\x00\x00\x00\x00", leftover));
+                dest_->Append(SliceView("\x00\x00\x00\x00\x00\x00", leftover));
             }
             block_offset_ = 0;
             }
@@ -55,16 +84,16 @@ namespace cowbpt {
             RecordType type;
             const bool end = (left == fragment_length);
             if (begin && end) {
-            type = kFullType;
+            type = compressed ? kCompressedFullType : kFullType;
             } else if (begin) {
-            type = kFirstType;
+            type = compressed ? kCompressedFirstType : kFirstType;
             } else if (end) {
             type = kLastType;
             } else {
             type = kMiddleType;
             }
 
-            s = EmitPhysicalRecord(type, ptr, fragment_length);
+            s = EmitPhysicalRecord(type, ptr, fragment_length, flush);
             ptr += fragment_length;
             left -= fragment_length;
             begin = false;
@@ -73,7 +102,7 @@ namespace cowbpt {
         }
 
         Status Writer::EmitPhysicalRecord(RecordType t, const char* ptr,
-                                        size_t length) {
+                                        size_t length, bool flush) {
         assert(length <= 0xffff);  // Must fit in two bytes
         assert(block_offset_ + kHeaderSize + length <= kBlockSize);
 
@@ -89,10 +118,10 @@ namespace cowbpt {
         EncodeFixed32(buf, crc);
 
         // Write the header and the payload
-        Status s = dest_->Append(Slice(buf, kHeaderSize));
+        Status s = dest_->Append(SliceView(buf, kHeaderSize));
         if (s.ok()) {
-            s = dest_->Append(Slice(ptr, length));
-            if (s.ok()) {
+            s = dest_->Append(SliceView(ptr, length));
+            if (s.ok() && flush) {
             s = dest_->Flush();
             }
         }
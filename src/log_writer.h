@@ -2,6 +2,7 @@
 #include "status.h"
 #include "slice.h"
 #include "log_format.h"
+#include "options.h"
 
 #ifndef LOG_WRITER_H
 #define LOG_WRITER_H
@@ -26,19 +27,30 @@ namespace cowbpt {
     // "*dest" must remain live while this Writer is in use.
     Writer(WritableFilePtr dest, uint64_t dest_length);
 
+    // Same as above, but records that are at least "compression_min_size"
+    // bytes long are compressed with "compression" when that saves space.
+    Writer(WritableFilePtr dest, uint64_t dest_length,
+           CompressionType compression, size_t compression_min_size);
+
     Writer(const Writer&) = delete;
     Writer& operator=(const Writer&) = delete;
 
     ~Writer();
 
-    Status AddRecord(const Slice& slice);
+    // flush false leaves the record to the Sync() or AsyncSync() of the
+    // file that follows, which may send it together with the sync
+    Status AddRecord(const SliceView& slice, bool flush = true);
 
     private:
-    Status EmitPhysicalRecord(RecordType type, const char* ptr, size_t length);
+    Status EmitPhysicalRecord(RecordType type, const char* ptr, size_t length, bool flush);
 
     WritableFilePtr dest_;
     int block_offset_;  // Current offset in block
 
+    CompressionType compression_;
+    size_t compression_min_size_;
+    std::string compressed_;  // Reused buffer for compressed records
+
     // crc32c values for all supported record types.  These are
     // pre-computed to reduce the overhead of computing the crc of the
     // record type stored in the header.
@@ -1,20 +1,65 @@
 #include <deque>
+#include <limits>
 #include <algorithm>
+#include <cassert>
+#include <cstdint>
 #include <memory>
 #include <vector>
 
+#include "fingerprint.h"
+#include "key_prefix.h"
+#include "slice.h"
+
 #ifndef NODEMAP_H
 #define NODEMAP_H
 
 namespace cowbpt {
 
+    // the first offset of v whose entries before it take half of bytes,
+    // kept min_entries away from both ends
+    template <typename ArrayMap, typename Charge>
+    size_t middle_offset(const ArrayMap& v, size_t bytes, size_t min_entries, Charge charge) {
+        assert(v.size() >= 2 * min_entries);
+        size_t offset = 0;
+        size_t left = 0;
+        while (offset < v.size() && left < bytes / 2) {
+            left += charge(v[offset]);
+            offset++;
+        }
+        return std::min(std::max(offset, min_entries), v.size() - min_entries);
+    }
+
+    // the first offset of v in [begin, end) whose key is not less than k,
+    // end if there is none.  The halving does not branch on the
+    // comparisons, that can not be predicted in a search.
+    template <typename ArrayMap, typename Key, typename Comparator>
+    size_t find_first_not_less(const ArrayMap& v, size_t begin, size_t end, const Key& k, const Comparator& cmp) {
+        if (end <= begin) {
+            return end;
+        }
+        size_t base = begin;
+        size_t n = end - begin;
+        while (n > 1) {
+            const size_t half = n / 2;
+            base = cmp(v[base + half].first, k) ? base + half : base;
+            n -= half;
+        }
+        return base + (cmp(v[base].first, k) ? 1 : 0);
+    }
+
     template <typename Key, typename Value, typename Comparator>
     class LeafNodeMap {
     private:
         typedef std::deque<std::pair<Key, Value>> ArrayMap;
-        LeafNodeMap(Comparator cmp, typename ArrayMap::iterator begin, typename ArrayMap::iterator end)
+        LeafNodeMap(Comparator cmp, const Key& prefix, typename ArrayMap::iterator begin, typename ArrayMap::iterator end,
+                    std::vector<uint8_t>::const_iterator fingerprints)
         : _v(begin, end),
+          _fingerprints(fingerprints, fingerprints + (end - begin)),
+          _prefix(prefix),
           _cmp(cmp) {
+            for (auto& p : _v) {
+                _bytes += charge(p);
+            }
         }
     public:
         LeafNodeMap() = delete;
@@ -25,27 +70,87 @@ namespace cowbpt {
         size_t size() {
             return _v.size();
         }
+        // the bytes of the keys and values
+        size_t bytes() {
+            return _bytes;
+        }
+        // the bytes all the keys start with, the keys of get_kv_array()
+        // are stored without them
+        const Key& prefix() const {
+            return _prefix;
+        }
         ArrayMap* get_kv_array() {
             return &_v;
         }
+        // the entry at offset, with its whole key
+        std::pair<Key, Value> get_kv(size_t offset) {
+            return std::make_pair(key_at(offset), _v[offset].second);
+        }
+        // the entry at offset, its key without prefix(), nothing is copied
+        const std::pair<Key, Value>& get_suffix_kv(size_t offset) const {
+            return _v[offset];
+        }
         void put(const Key& k, const Value& v) {
-            auto offset = find_greater_or_equal(k);
-            if (offset < _v.size() && !_cmp(k, _v[offset].first) && !_cmp(_v[offset].first, k)) {
+            if (!k.starts_with(_prefix)) {
+                // the keys are copied back whole once, the prefix is found
+                // again when the map is split, merged or read back
+                set_prefix_length(0);
+            }
+            Key suffix = strip(k);
+            auto offset = find_greater_or_equal(suffix);
+            std::pair<Key, Value> entry(suffix, v);
+            if (!_prefix.empty()) {
+                // the suffix would keep the whole key alive, with the
+                // value in the allocation of its write batch
+                Key::CopyPair(SliceView(suffix), SliceView(v), &entry.first, &entry.second);
+            }
+            if (offset < _v.size() && !_cmp(suffix, _v[offset].first) && !_cmp(_v[offset].first, suffix)) {
                 // this is an update
-                _v[offset] = std::make_pair(k, v);
+                _bytes -= charge(_v[offset]);
+                _v[offset] = std::move(entry);
             } else {
                 // this is an insertion
-                _v.insert(_v.begin()+offset, std::make_pair(k, v));
+                _v.insert(_v.begin()+offset, std::move(entry));
+                _fingerprints.insert(_fingerprints.begin() + offset, fingerprint(suffix));
             }
+            _bytes += charge(_v[offset]);
         }
         void erase(const Key& k) {
-            auto offset = find_greater_or_equal(k);
-            if (offset < _v.size() && !_cmp(k, _v[offset].first) && !_cmp(_v[offset].first, k)) {
+            if (!k.starts_with(_prefix)) {
+                return;
+            }
+            Key suffix = strip(k);
+            auto offset = find_greater_or_equal(suffix);
+            if (offset < _v.size() && !_cmp(suffix, _v[offset].first) && !_cmp(_v[offset].first, suffix)) {
                 // found k
+                _bytes -= charge(_v[offset]);
                 _v.erase(_v.begin() + offset);
+                _fingerprints.erase(_fingerprints.begin() + offset);
+                if (_v.empty()) {
+                    _prefix = Key();
+                }
             }
         }
         Value get(const Key& k) {
+            if (!k.starts_with(_prefix)) {
+                return Value();
+            }
+            if (_cmp.orders_by_bytes()) {
+                // the keys are equal iff their bytes are, only the keys
+                // with the fingerprint of k are compared
+                const SliceView suffix(k.c_string() + _prefix.size(), k.size() - _prefix.size());
+                const uint8_t fp = KeyFingerprint(suffix.data(), suffix.size());
+                const size_t n = _fingerprints.size();
+                for (size_t i = FindFingerprint(_fingerprints.data(), n, 0, fp); i < n;
+                     i = FindFingerprint(_fingerprints.data(), n, i + 1, fp)) {
+                    if (SliceView(_v[i].first) == suffix) {
+                        return _v[i].second;
+                    }
+                }
+                return Value();
+            }
+            // only the keys in the order of their bytes have a prefix
+            assert(_prefix.empty());
             auto offset = find_greater_or_equal(k);
             if (offset < _v.size() && !_cmp(k, _v[offset].first) && !_cmp(_v[offset].first, k)) {
                 return _v[offset].second;
@@ -54,63 +159,194 @@ namespace cowbpt {
             }
         }; 
         LeafNodeMap<Key, Value, Comparator>* split(Key& k) {
-            auto offset = _v.size() / 2;
-            k = _v[offset].first;
-            auto right_split_node = new LeafNodeMap(_cmp, _v.begin() + offset, _v.end());
+            return split(k, _v.size() / 2);
+        }
+        // the entries from offset on are moved to the returned map
+        LeafNodeMap<Key, Value, Comparator>* split(Key& k, size_t offset) {
+            assert(offset > 0 && offset < _v.size());
+            k = _cmp.shortest_separator(key_at(offset - 1), key_at(offset));
+            auto right_split_node = new LeafNodeMap(_cmp, _prefix, _v.begin() + offset, _v.end(),
+                                                    _fingerprints.begin() + offset);
             _v.erase(_v.begin() + offset, _v.end());
+            _fingerprints.resize(offset);
+            _bytes -= right_split_node->_bytes;
+            // each half may share more bytes
+            update_prefix();
+            right_split_node->update_prefix();
             return right_split_node;
         }
+        // the offset that splits the bytes in two halves, with at least
+        // min_entries entries on each side
+        size_t middle_by_bytes(size_t min_entries) {
+            return middle_offset(_v, _bytes, min_entries,
+                                 [this](const std::pair<Key, Value>& p) { return charge(p); });
+        }
         LeafNodeMap<Key, Value, Comparator>* copy() {
-            return new LeafNodeMap(_cmp, _v.begin(), _v.end());
+            return new LeafNodeMap(_cmp, _prefix, _v.begin(), _v.end(), _fingerprints.begin());
         }
         std::pair<Key, Value> pop_first_leaf_node_value_and_second_key(Key& first_key) {
             assert(size() >= 2);
-            auto p = _v.front();
+            first_key = key_at(0);
+            Value value = _v.front().second;
+            _bytes -= charge(_v.front());
             _v.pop_front();
-            first_key = p.first;
-            return std::make_pair(_v.front().first, p.second);
+            _fingerprints.erase(_fingerprints.begin());
+            return std::make_pair(key_at(0), value);
         }
         std::pair<Key, Value> pop_last_leaf_node_value_and_last_key() {
             assert(size() >= 2);
-            auto p = _v.back();
+            auto p = get_kv(_v.size() - 1);
+            _bytes -= charge(_v.back());
             _v.pop_back();
+            _fingerprints.pop_back();
             return p;
         }
         void append_right(LeafNodeMap<Key, Value, Comparator>* right) {
+            // the keys of both keep the prefix they share
+            const size_t shared = common_prefix(_prefix, right->_prefix);
+            set_prefix_length(shared);
+            right->set_prefix_length(shared);
             _v.insert(_v.end(), right->_v.begin(), right->_v.end());
+            _fingerprints.insert(_fingerprints.end(), right->_fingerprints.begin(), right->_fingerprints.end());
+            _bytes += right->_bytes;
             right->_v.clear();
+            right->_fingerprints.clear();
+            right->_prefix = Key();
+            right->_bytes = 0;
+            update_prefix();
+        }
+
+        // true if k goes after all the keys, or the map is empty
+        bool is_after_last(const Key& k) {
+            if (_v.empty()) {
+                return true;
+            }
+            if (!k.starts_with(_prefix)) {
+                // all the keys start with the prefix
+                return k.compare(_prefix) > 0;
+            }
+            return _cmp(_v.back().first, strip(k));
+        }
+
+        // For the entries read back in order: set the prefix of the empty
+        // map, push_back() the keys without it, then update_prefix().
+        void set_prefix(const Key& prefix) {
+            assert(_v.empty());
+            _prefix = prefix;
+        }
+        // REQUIRES: suffix is after the keys of the map, without prefix()
+        void push_back(const Key& suffix, const Value& v) {
+            assert(_v.empty() || _cmp(_v.back().first, suffix));
+            _v.push_back(std::make_pair(suffix, v));
+            _fingerprints.push_back(fingerprint(suffix));
+            _bytes += charge(_v.back());
+        }
+        // make prefix() all the bytes the keys start with, only if the keys
+        // are in the order of their bytes
+        void update_prefix() {
+            if (!_cmp.orders_by_bytes() || _v.size() < 2) {
+                return;
+            }
+            // the keys are sorted, the first and the last share the least
+            const size_t shared = _prefix.size() + common_prefix(_v.front().first, _v.back().first);
+            if (shared != _prefix.size()) {
+                set_prefix_length(shared);
+            }
         }
 
         std::string dump() {
             std::string s;
             s.append("-----------------------------------------\n");
             for(size_t i = 0; i < _v.size(); i++) {
-                s.append("| K: "+_v[i].first.string()+" V: "+_v[i].second.string()+" |\n");
+                s.append("| K: "+key_at(i).string()+" V: "+_v[i].second.string()+" |\n");
             }
             s.append("-----------------------------------------\n");
             return s;
         }
     private:
-        // find the offset of _v where _v[offset] is greater or equal to k
+        // find the offset of _v where _v[offset] is greater or equal to
+        // suffix, a key without prefix()
         // return _v length if not found
-        size_t find_greater_or_equal(const Key& k) {
-            if(size() == 0)
-                return 0;
-            if(_cmp(_v[size() - 1].first, k))
-                return size();
-            size_t l = 0, r = _v.size() - 1;
-            while(l < r){
-                size_t m = (l + r) / 2;
-                if(_cmp(_v[m].first, k))
-                    l = m + 1;
-                else
-                    r = m;
+        size_t find_greater_or_equal(const Key& suffix) {
+            return find_first_not_less(_v, 0, _v.size(), suffix, _cmp);
+        }
+
+        // REQUIRES: k starts with prefix()
+        Key strip(const Key& k) const {
+            Key suffix = k;
+            suffix.remove_prefix(_prefix.size());
+            return suffix;
+        }
+
+        Key key_at(size_t offset) const {
+            if (_prefix.empty()) {
+                return _v[offset].first;
             }
-            return l;
+            return Key::Concat(_prefix, _v[offset].first);
         }
 
-        ArrayMap _v; // sorted by Key
+        static size_t common_prefix(const Key& a, const Key& b) {
+            const size_t n = std::min(a.size(), b.size());
+            size_t shared = 0;
+            while (shared < n && a.c_string()[shared] == b.c_string()[shared]) {
+                shared++;
+            }
+            return shared;
+        }
+
+        // make the first n bytes of the keys prefix(), the keys have to
+        // share them
+        void set_prefix_length(size_t n) {
+            const size_t old = _prefix.size();
+            if (n > old) {
+                Key prefix = Key::Concat(_prefix, SliceView(_v.front().first.c_string(), n - old));
+                for (auto& p : _v) {
+                    p.first.remove_prefix(n - old);
+                }
+                _prefix = std::move(prefix);
+            } else if (n < old) {
+                // the keys get back the end of the prefix, copied together
+                const SliceView back(_prefix.c_string() + n, old - n);
+                size_t total = 0;
+                for (auto& p : _v) {
+                    total += back.size() + p.first.size();
+                }
+                std::string buf;
+                buf.reserve(total);
+                for (auto& p : _v) {
+                    buf.append(back.data(), back.size());
+                    buf.append(p.first.c_string(), p.first.size());
+                }
+                Key keys(std::move(buf));
+                for (auto& p : _v) {
+                    const size_t len = back.size() + p.first.size();
+                    p.first = Key(keys, len);
+                    keys.remove_prefix(len);
+                }
+                _prefix = (n == 0) ? Key() : Key(_prefix, n);
+            } else {
+                return;
+            }
+            for (size_t i = 0; i < _v.size(); i++) {
+                _fingerprints[i] = fingerprint(_v[i].first);
+            }
+        }
+
+        // the bytes of the whole key and the value
+        size_t charge(const std::pair<Key, Value>& p) const {
+            return _prefix.size() + p.first.size() + p.second.size();
+        }
+
+        static uint8_t fingerprint(const Key& k) {
+            return KeyFingerprint(k.c_string(), k.size());
+        }
+
+        ArrayMap _v; // sorted by Key, without _prefix
+        // _fingerprints[i] is the fingerprint of _v[i].first, for get()
+        std::vector<uint8_t> _fingerprints;
+        Key _prefix;
         const Comparator _cmp;
+        size_t _bytes = 0;
     };
 
     template <typename Key, typename Value, typename Comparator>
@@ -120,6 +356,10 @@ namespace cowbpt {
         InternalNodeMap(Comparator cmp, typename ArrayMap::iterator begin, typename ArrayMap::iterator end)
         : _v(begin, end),
           _cmp(cmp) {
+            for (auto& p : _v) {
+                _bytes += charge(p);
+            }
+            build_prefixes();
         }
     public:
         InternalNodeMap() = delete;
@@ -133,10 +373,35 @@ namespace cowbpt {
           _cmp(cmp) {
             _v.push_back(std::make_pair(Key(), v1));
             _v.push_back(std::make_pair(k2, v2));
+            _bytes = charge(_v[0]) + charge(_v[1]);
+            build_prefixes();
         }
         size_t size() {
             return _v.size();
         }
+        // about the bytes of the entries in a page, see charge()
+        size_t bytes() {
+            return _bytes;
+        }
+
+        // For the entries read back in order: push_back() them to the empty
+        // map, then build_prefixes().
+        // REQUIRES: k is after the keys of the map
+        void push_back(const Key& k, const Value& v) {
+            assert(_v.size() < 2 || _cmp(_v.back().first, k));
+            _v.push_back(std::make_pair(k, v));
+            _bytes += charge(_v.back());
+        }
+        // make _prefixes[i] the prefix of _v[i].first, the writes keep it so
+        void build_prefixes() {
+            if (!_cmp.orders_by_bytes()) {
+                return;
+            }
+            _prefixes.resize(_v.size());
+            for (size_t i = 0; i < _v.size(); i++) {
+                _prefixes[i] = prefix_of(i);
+            }
+        }
 
         std::vector<Value> get_values() {
             std::vector<Value> res;
@@ -154,18 +419,33 @@ namespace cowbpt {
             assert(size() == 1 || offset == size() ||_cmp(k, _v[offset].first));
             // this is an insertion
             _v.insert(_v.begin()+offset, std::make_pair(k, v));
+            _bytes += charge(_v[offset]);
+            if (_cmp.orders_by_bytes()) {
+                _prefixes.insert(_prefixes.begin() + offset, prefix_of(offset));
+            }
         }
         // push this internalnodevalue to the front of is node, and the previous front key is set to right_k
         void push_front(const Value& v, const Key& right_k) {
            assert(size() > 0);
+           _bytes -= charge(_v[0]);
            _v[0].first = right_k;
+           _bytes += charge(_v[0]);
            _v.push_front(std::make_pair(Key(), v)); 
+           _bytes += charge(_v[0]);
+           if (_cmp.orders_by_bytes()) {
+               _prefixes[0] = prefix_of(1);
+               _prefixes.insert(_prefixes.begin(), prefix_of(0));
+           }
         }
         void erase(const Key& k) {
             auto offset = find_greater_or_equal(k);
             // internal node will not delete a not existing key
             assert(offset < _v.size() && !_cmp(k, _v[offset].first) && !_cmp(_v[offset].first, k));
+            _bytes -= charge(_v[offset]);
             _v.erase(_v.begin() + offset);
+            if (_cmp.orders_by_bytes()) {
+                _prefixes.erase(_prefixes.begin() + offset);
+            }
         }
         Value get(const Key& k) {
             if (size() == 0) {
@@ -178,6 +458,11 @@ namespace cowbpt {
             return _v[offset-1].second;
         }
 
+        // true if k goes down to the last child, see get()
+        bool in_last_child(const Key& k) {
+            return _v.size() == 1 || !_cmp(k, _v.back().first);
+        }
+
         void replace(const Key& k, Value v) {
             if (size() == 0) {
                 return;
@@ -185,6 +470,7 @@ namespace cowbpt {
             auto offset = find_greater_or_equal(k);
             if (size() > 1 && offset < size() && !_cmp(k, _v[offset].first) && !_cmp(_v[offset].first, k)) {
                 _v[offset].second = v;
+                return;
             }
             _v[offset-1].second = v;
         }
@@ -231,12 +517,25 @@ namespace cowbpt {
 
 
         InternalNodeMap<Key, Value, Comparator>* split(Key& k) {
-            auto offset = _v.size() / 2;
+            return split(k, _v.size() / 2);
+        }
+        // the entries from offset on are moved to the returned map
+        InternalNodeMap<Key, Value, Comparator>* split(Key& k, size_t offset) {
+            assert(offset > 0 && offset < _v.size());
             k = _v[offset].first;
             auto right_split_node = new InternalNodeMap(_cmp, _v.begin() + offset, _v.end());
             _v.erase(_v.begin() + offset, _v.end());
+            _bytes -= right_split_node->_bytes;
+            if (_cmp.orders_by_bytes()) {
+                _prefixes.resize(offset);
+            }
             return right_split_node;
         }
+        // the offset that splits the bytes in two halves, with at least
+        // min_entries entries on each side
+        size_t middle_by_bytes(size_t min_entries) {
+            return middle_offset(_v, _bytes, min_entries, charge);
+        }
         InternalNodeMap<Key, Value, Comparator>* copy() {
             return new InternalNodeMap(_cmp, _v.begin(), _v.end());
         }
@@ -244,19 +543,35 @@ namespace cowbpt {
             assert(size() >= 2);
             auto p = _v.front();
             _v.pop_front();
+            _bytes -= charge(p);
+            if (_cmp.orders_by_bytes()) {
+                _prefixes.erase(_prefixes.begin());
+            }
             return std::make_pair(_v.front().first, p.second);
         }
         std::pair<Key, Value> pop_last_internal_node_value_and_last_key() {
             assert(size() >= 2);
             auto p = _v.back();
             _v.pop_back();
+            _bytes -= charge(p);
+            if (_cmp.orders_by_bytes()) {
+                _prefixes.pop_back();
+            }
             return p;
         }
         virtual void append_right(InternalNodeMap<Key, Value, Comparator>* right, Key right_k) {
             auto offset = _v.size();
             _v.insert(_v.end(), right->_v.begin(), right->_v.end());
+            _bytes += right->_bytes - charge(_v[offset]);
             _v[offset].first = right_k;
+            _bytes += charge(_v[offset]);
+            if (_cmp.orders_by_bytes()) {
+                _prefixes.insert(_prefixes.end(), right->_prefixes.begin(), right->_prefixes.end());
+                _prefixes[offset] = prefix_of(offset);
+            }
             right->_v.clear();
+            right->_bytes = 0;
+            right->_prefixes.clear();
         }
 
         std::string dump() {
@@ -274,31 +589,40 @@ namespace cowbpt {
     private:
         // find the offset of _v where _v[offset]'s child node may contains Key down below
         size_t find_greater_or_equal(const Key& k) {
-
-            if(size() == 0)
-                return 0;
-            if(_cmp(_v[size() - 1].first, k))
-                return size();
-
-            assert(size() >= 1);
-            // TODO: use binary search
             // we don't check i = 0 for internal node map, this is different from leaf node map
             // since in the leaf node _v[0] represent the exact key-value pair
             // however int internal node _v[0] represent any keys that are smaller than _v[1]
             // or the whole key space that belongs to this node if _v[1] does not exist
-            size_t l = 1, r = _v.size() - 1;
-            while(l < r){
-                size_t m = (l + r) / 2;
-                if(_cmp(_v[m].first, k))
-                    l = m + 1;
-                else
-                    r = m;
+            if (!_cmp.orders_by_bytes() || size() <= 1) {
+                return find_first_not_less(_v, 1, _v.size(), k, _cmp);
+            }
+            // the keys with another prefix than k are ordered by it, the
+            // ones with the same prefix are compared in full
+            const int64_t p = KeyPrefix(k.c_string(), k.size());
+            const int64_t* prefixes = _prefixes.data() + 1;
+            const size_t n = size() - 1;
+            size_t lo = 1 + PrefixLowerBound(prefixes, n, p);
+            if (lo == size() || _prefixes[lo] != p) {
+                return lo;
             }
-            return l;
+            size_t hi = p == std::numeric_limits<int64_t>::max() ? size() : 1 + PrefixLowerBound(prefixes, n, p + 1);
+            return find_first_not_less(_v, lo, hi, k, _cmp);
+        }
+
+        int64_t prefix_of(size_t i) {
+            return KeyPrefix(_v[i].first.c_string(), _v[i].first.size());
+        }
+
+        // the key, the type and the id of the child in the page
+        static size_t charge(const std::pair<Key, Value>& p) {
+            return p.first.size() + 1 + sizeof(uint64_t);
         }
 
         ArrayMap _v; // sorted by Key
         const Comparator _cmp;
+        size_t _bytes = 0;
+        // the prefixes of the keys of _v, packed for the search
+        std::vector<int64_t> _prefixes;
     };
 }
 
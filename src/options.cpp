@@ -8,6 +8,11 @@ namespace cowbpt {
 
 SliceComparator cmp;
 
+Comparator* Fixed64KeyComparator() {
+  static Fixed64Comparator fixed64;
+  return &fixed64;
+}
+
 Options::Options() : comparator(&cmp), env(Env::Default()) {}
 
 }
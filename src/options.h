@@ -11,6 +11,39 @@ class Comparator;
 class Env;
 // class Snapshot;
 
+// The codec of the write ahead log records (wal_compression), of the
+// pages written by checkpoints (page_compression) and of the blocks of
+// the RocksDB page store (rocksdb_compression).  The records and pages
+// are tagged with it, so that they are read back with the codec they
+// were written with.
+enum CompressionType {
+  // NOTE: do not change the values of existing entries, as these are
+  // part of the persistent format on disk.
+  kNoCompression = 0x0,
+  kSnappyCompression = 0x1
+};
+
+// Where the pages of the checkpoints and their metadata are stored.
+enum PageStoreType {
+  // The leveldb fork in third_party, keeps its snapshots across reopens.
+  kLevelDBPageStore = 0x0,
+  // RocksDB, with a block cache, bloom filters and block compression.
+  kRocksDBPageStore = 0x1,
+  // Pages appended to segment files of their own and read with pread(),
+  // with the page locations kept in memory.
+  kFilePageStore = 0x2
+};
+
+// How the keys of a database are compared.
+enum KeyFormat {
+  // Any keys, compared by Options::comparator.
+  kVariableKeys = 0x0,
+  // Mostly 8 byte big-endian integers, e.g. ids.  They are compared as
+  // integers, in the order of their bytes, without calling a comparator.
+  // Other keys are compared by their bytes.
+  kFixed64Keys = 0x1
+};
+
 // Options to control the behavior of a database (passed to DB::Open)
 struct Options {
   // Create an Options object with default values for all fields.
@@ -27,6 +60,12 @@ struct Options {
   // comparator provided to previous open calls on the same DB.
   Comparator* comparator;
 
+  // With kFixed64Keys the keys are ordered by their bytes, and comparator
+  // has to be left to its default.  The keys are still stored as they are,
+  // only their comparisons are cheaper.  A database is always opened with
+  // the format it was created with.
+  KeyFormat key_format = kVariableKeys;
+
   // If true, the database will be created if it is missing.
   bool create_if_missing = true;
 
@@ -35,8 +74,130 @@ struct Options {
 
   // Use the specified object to interact with the environment,
   // e.g. to read/write files, schedule background work, etc.
+  // IoUringEnv() cuts the syscalls of log writes and syncs on Linux.
   // Default: Env::Default()
   Env* env;
+
+  // Compress write ahead log records with the specified compression
+  // algorithm.  A record is stored compressed only when it is at least
+  // wal_compression_min_size bytes long and compression actually shrinks
+  // it, so small batches don't pay for the codec.
+  //
+  // If snappy is not available in this build, records are written
+  // uncompressed.  Logs written with compression can only be recovered
+  // by a build that supports the same codec.
+  CompressionType wal_compression = kNoCompression;
+
+  // See wal_compression.
+  size_t wal_compression_min_size = 512;
+
+  // Number of threads that apply the write ahead log to the tree when the
+  // database is opened.  With more than one thread, reading the log,
+  // decoding the batches and applying them run in a pipeline, and the
+  // keys are split into ranges that are applied in parallel.  The result
+  // is the same as replaying the log on a single thread.
+  int recovery_threads = 1;
+
+  // If true, each recovery thread sorts the operations it has received
+  // by key before applying them, so that consecutive operations mostly
+  // land in the same leaf.  Only used if recovery_threads > 1.
+  bool recovery_sorted_apply = false;
+
+  // If true, closing the database takes a last checkpoint and marks it as
+  // cleanly shut down, so that the next open does not replay the log.
+  // Closing is slower, since every dirty page is written out.
+  bool checkpoint_on_close = true;
+
+  // If true, a checkpoint gives new page ids to the pages it writes, in
+  // key order and children before their parent, so that the leaves of a
+  // range and the pages of a subtree get adjacent ids in the page store.
+  // The parents of a page that moves are written too.
+  bool checkpoint_reassign_page_ids = false;
+
+  // If true, DB::Open returns once the log has been read into memory,
+  // without applying it to the tree.  Reads look at the operations of the
+  // log first, and a background thread applies them to the tree.
+  // NewIterator() and checkpoints wait until the log is applied.
+  // recovery_threads is not used.
+  bool background_recovery = false;
+
+  // Number of threads that read back, in the background after the
+  // database is opened, the pages that were in memory at the last
+  // checkpoint.  The top levels of the tree are read first.  0 disables
+  // the warmup.
+  int warmup_threads = 0;
+
+  // Most pages read per second by the warmup, 0 means no limit.
+  size_t warmup_pages_per_sec = 0;
+
+  // Most pages a checkpoint records for the warmup of the next open.  The
+  // deepest pages are dropped first.
+  size_t warmup_max_pages = 1 << 20;
+
+  // The store of the checkpoints.  A database has to be reopened with the
+  // store it was created with.
+  PageStoreType page_store = kLevelDBPageStore;
+
+  // Size in bytes of the block cache of kRocksDBPageStore, 0 disables it.
+  size_t rocksdb_block_cache_size = 8 << 20;
+
+  // Bits per page id of the bloom filters of kRocksDBPageStore, 0 disables
+  // them.  10 gives about 1% of false positives.
+  int rocksdb_bloom_bits_per_key = 10;
+
+  // Compression of the blocks of kRocksDBPageStore.
+  CompressionType rocksdb_compression = kNoCompression;
+
+  // Size at which kFilePageStore starts a new segment file.  The segments
+  // that are mostly made of dropped page versions are rewritten by a
+  // background thread.
+  size_t page_segment_size = 64 << 20;
+
+  // Compression of the pages written by checkpoints.  The keys of a
+  // compressed page are stored as the prefix they share with the key
+  // before them and the rest of them, then the page goes through the
+  // codec if that makes it at least 1/8 smaller.  Without snappy in this
+  // build only the keys are compressed.  A database can be reopened with
+  // another setting, the pages are read back either way.
+  CompressionType page_compression = kNoCompression;
+
+  // Bits per key of the bloom filter built for each leaf a checkpoint
+  // writes, 0 disables them.  The filters are stored in the page of the
+  // parent, so that a Get of a missing key does not have to read back a
+  // leaf that is not in memory.  10 gives about 1% of false positives.
+  int leaf_filter_bits_per_key = 0;
+
+  // Most entries of a leaf and of an internal node, a node is split when
+  // it has that many and fixed when it is down to half of them.  0 is
+  // 2*b+1 of the process wide COWBPT_NODE_B_SZIE flag, or no limit when
+  // node_target_bytes is set.  At least 3.
+  size_t leaf_node_max_entries = 0;
+  size_t internal_node_max_entries = 0;
+
+  // Size in bytes of the keys and values at which a node is split, so
+  // that the pages are about that big whatever the size of the values.
+  // A node is fixed when it is down to a quarter of it.  4-16KB nodes
+  // keep the tree a few levels deep.  0 only counts the entries.
+  //
+  // The node limits are stored when the database is created, it keeps
+  // them when it is reopened with other options.
+  size_t node_target_bytes = 0;
+
+  // Size in bytes of a cache of the values read by Get, in front of the
+  // tree, 0 disables it.  A write drops the keys it changes from the
+  // cache.  See the "cowbpt.row-cache-stats" property.
+  size_t row_cache_size = 0;
+
+  // If true, the checksum of every page read back from the page store is
+  // verified, by reads, writes and the warmup.  Otherwise only the reads
+  // with ReadOptions::verify_checksums verify the pages they read back.
+  // A damaged page fails the operation with a Corruption status.
+  bool verify_page_checksums = false;
+
+  // Most pages per second a background thread reads back from the last
+  // checkpoint to verify their checksums, 0 disables it.  The damaged
+  // pages are logged.
+  size_t scrub_pages_per_sec = 0;
 };
 
 // Options that control read operations
@@ -73,6 +234,15 @@ struct WriteOptions {
   // with sync==true has similar crash semantics to a "write()"
   // system call followed by "fsync()".
   bool sync = false;
+
+  // If true, the write will not go to the write ahead log, and will be
+  // applied to the tree right away without waiting in the writer queue.
+  // The write becomes durable only when the next checkpoint finishes,
+  // if the process crashes before that, the write is lost.
+  //
+  // Use this for data that can be rebuilt, e.g. caches.
+  // REQUIRES: sync == false
+  bool disable_wal = false;
 };
 
 }  
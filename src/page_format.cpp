@@ -0,0 +1,208 @@
+#include "page_format.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "coding.h"
+#include "compression.h"
+#include "crc32c.h"
+
+namespace cowbpt {
+
+    namespace {
+        Status Damaged(uint64_t page_id, const char* what) {
+            return Status::Corruption("page " + std::to_string(page_id) + ": " + what);
+        }
+
+        const char* SkipLengthPrefixed(const char* p, const char* limit) {
+            uint32_t len;
+            p = GetVarint32Ptr(p, limit, &len);
+            return (p == nullptr || len > static_cast<size_t>(limit - p)) ? nullptr : p + len;
+        }
+
+        // copy the part of an entry after its key, return nullptr if it is
+        // malformed
+        const char* CopyEntryValue(uint32_t flags, const char* p, const char* limit, std::string* output) {
+            const char* start = p;
+            if (flags & kInternalPage) {
+                uint32_t child_type;
+                uint64_t child_id;
+                p = GetVarint32Ptr(p, limit, &child_type);
+                p = (p == nullptr) ? nullptr : GetVarint64Ptr(p, limit, &child_id);
+                if (p != nullptr && (flags & kPageChildFilters)) {
+                    p = SkipLengthPrefixed(p, limit);
+                }
+            } else {
+                p = SkipLengthPrefixed(p, limit);
+            }
+            if (p != nullptr) {
+                output->append(start, p - start);
+            }
+            return p;
+        }
+
+        // copy the prefix of the keys of a leaf page, return nullptr if it
+        // is malformed
+        const char* CopyKeyPrefix(uint32_t flags, const char* p, const char* limit, std::string* output) {
+            if ((flags & kPageKeyPrefix) == 0) {
+                return p;
+            }
+            const char* end = SkipLengthPrefixed(p, limit);
+            if (end != nullptr) {
+                output->append(p, end - p);
+            }
+            return end;
+        }
+
+        bool PrefixKeys(uint32_t flags, const char* p, const char* limit, std::string* output) {
+            p = CopyKeyPrefix(flags, p, limit, output);
+            if (p == nullptr) {
+                return false;
+            }
+            const char* last_key = p;
+            size_t last_size = 0;
+            while (p != limit) {
+                uint32_t size;
+                p = GetVarint32Ptr(p, limit, &size);
+                if (p == nullptr || size > static_cast<size_t>(limit - p)) {
+                    return false;
+                }
+                size_t shared = 0;
+                const size_t n = std::min<size_t>(size, last_size);
+                while (shared < n && p[shared] == last_key[shared]) {
+                    shared++;
+                }
+                PutVarint32(output, shared);
+                PutVarint32(output, size - shared);
+                output->append(p + shared, size - shared);
+                last_key = p;
+                last_size = size;
+                p = CopyEntryValue(flags, p + size, limit, output);
+                if (p == nullptr) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        bool ExpandKeys(uint32_t flags, const char* p, const char* limit, std::string* output) {
+            p = CopyKeyPrefix(flags, p, limit, output);
+            if (p == nullptr) {
+                return false;
+            }
+            std::string key;
+            while (p != limit) {
+                uint32_t shared, unshared;
+                p = GetVarint32Ptr(p, limit, &shared);
+                p = (p == nullptr) ? nullptr : GetVarint32Ptr(p, limit, &unshared);
+                if (p == nullptr || shared > key.size() || unshared > static_cast<size_t>(limit - p)) {
+                    return false;
+                }
+                key.resize(shared);
+                key.append(p, unshared);
+                p += unshared;
+                PutVarint32(output, key.size());
+                output->append(key);
+                p = CopyEntryValue(flags, p, limit, output);
+                if (p == nullptr) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    }
+
+    Status SealPage(CompressionType compression, std::string* page) {
+        // the node type is a one byte varint, the flags fit in it
+        assert(!page->empty() && ((*page)[0] & 0x80) == 0);
+        if (compression != kNoCompression) {
+            const uint32_t flags = static_cast<unsigned char>((*page)[0]);
+            std::string packed(1, (*page)[0] | static_cast<char>(kPagePrefixKeys));
+            if (!PrefixKeys(flags, page->data() + 1, page->data() + page->size(), &packed)) {
+                return Status::Corruption("the serialized node has bad entries");
+            }
+            std::string compressed;
+            if (CompressBlock(compression, packed.data() + 1, packed.size() - 1, &compressed)) {
+                packed.resize(1);
+                packed[0] |= static_cast<char>(kPageCompressed);
+                packed.append(compressed);
+            }
+            page->swap(packed);
+        }
+        (*page)[0] |= static_cast<char>(kPageChecksum);
+        uint32_t crc = crc32c::Value(page->data(), page->size());
+        PutFixed32(page, crc32c::Mask(crc));
+        return Status::OK();
+    }
+
+    Status UnsealPage(uint64_t page_id, bool verify_checksum, std::string* page, uint32_t* flags) {
+        if (GetVarint32Ptr(page->data(), page->data() + page->size(), flags) == nullptr) {
+            return Damaged(page_id, "bad page flags");
+        }
+        if ((*flags & ~kKnownPageFlags) != 0) {
+            return Damaged(page_id, "unknown page flags");
+        }
+        if ((*flags & kPageChecksum) == 0) {
+            return Status::OK();
+        }
+        if (page->size() < 1 + 4) {
+            return Damaged(page_id, "truncated page");
+        }
+        size_t n = page->size() - 4;
+        if (verify_checksum) {
+            uint32_t expected = crc32c::Unmask(DecodeFixed32(page->data() + n));
+            uint32_t actual = crc32c::Value(page->data(), n);
+            if (actual != expected) {
+                return Damaged(page_id, "checksum mismatch");
+            }
+        }
+        page->resize(n);
+
+        // the flags are one byte if there are any
+        (*page)[0] = static_cast<char>(*flags & kNodePageFlags);
+        std::string entries;
+        if (*flags & kPageCompressed) {
+            if (!UncompressBlock(page->data() + 1, page->size() - 1, &entries)) {
+                return Damaged(page_id, "bad compressed entries");
+            }
+        } else if (*flags & kPagePrefixKeys) {
+            entries.assign(page->data() + 1, page->size() - 1);
+        } else {
+            return Status::OK();
+        }
+        std::string node(1, (*page)[0]);
+        if (*flags & kPagePrefixKeys) {
+            if (!ExpandKeys(*flags, entries.data(), entries.data() + entries.size(), &node)) {
+                return Damaged(page_id, "bad prefix compressed keys");
+            }
+        } else {
+            node.append(entries);
+        }
+        page->swap(node);
+        return Status::OK();
+    }
+
+    Status GetChildPageIDs(uint64_t page_id, const std::string& page, std::vector<uint64_t>* child_ids) {
+        const char* p = page.data();
+        const char* limit = p + page.size();
+        uint32_t flags;
+        p = GetVarint32Ptr(p, limit, &flags);
+        while (p != nullptr && p != limit) {
+            uint32_t child_type;
+            uint64_t child_id;
+            p = SkipLengthPrefixed(p, limit);
+            p = (p == nullptr) ? nullptr : GetVarint32Ptr(p, limit, &child_type);
+            p = (p == nullptr) ? nullptr : GetVarint64Ptr(p, limit, &child_id);
+            if (p != nullptr && (flags & kPageChildFilters)) {
+                p = SkipLengthPrefixed(p, limit);
+            }
+            if (p != nullptr) {
+                child_ids->push_back(child_id);
+            }
+        }
+        if (p == nullptr) {
+            return Damaged(page_id, "bad child entry");
+        }
+        return Status::OK();
+    }
+}
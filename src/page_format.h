@@ -0,0 +1,52 @@
+#ifndef PAGE_FORMAT_H
+#define PAGE_FORMAT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "options.h"
+#include "status.h"
+
+namespace cowbpt {
+
+    // A page is a node serialized by Node::serialize.  Its first varint32 is
+    // the node type, 0 for a leaf and 1 for an internal node, and the other
+    // bits of it are flags of the page.  Pages written before the flags
+    // existed have none of them.
+    const uint32_t kInternalPage = 0x1;
+    // the page ends with the masked crc32c of the rest of it, in fixed32
+    const uint32_t kPageChecksum = 0x2;
+    // each key is stored as the length of the prefix it shares with the key
+    // before it, in varint32, and the rest of it, length prefixed
+    const uint32_t kPagePrefixKeys = 0x4;
+    // the entries are compressed by CompressBlock
+    const uint32_t kPageCompressed = 0x8;
+    // each entry of an internal page ends with the bloom filter of the keys
+    // of its child, length prefixed, empty for the internal children
+    const uint32_t kPageChildFilters = 0x10;
+    // a leaf page starts with the bytes all its keys start with, length
+    // prefixed, and its keys are stored without them
+    const uint32_t kPageKeyPrefix = 0x20;
+    const uint32_t kKnownPageFlags = kInternalPage | kPageChecksum | kPagePrefixKeys | kPageCompressed |
+                                     kPageChildFilters | kPageKeyPrefix;
+    // the flags written by Node::serialize, the others are added by SealPage
+    const uint32_t kNodePageFlags = kInternalPage | kPageChildFilters | kPageKeyPrefix;
+
+    // Turn a serialized node into a page: unless compression is
+    // kNoCompression, prefix compress its keys and compress its entries
+    // with the codec, if that makes them smaller.  Then append the checksum.
+    // Returns Corruption, with page left as it was, if the entries of the
+    // node can not be parsed.
+    Status SealPage(CompressionType compression, std::string* page);
+
+    // Check the flags of a page read back from the page store, and its
+    // checksum if verify_checksum, and turn it back into the serialized node
+    // it was sealed from.  Returns Corruption if the page is damaged.
+    Status UnsealPage(uint64_t page_id, bool verify_checksum, std::string* page, uint32_t* flags);
+
+    // The ids of the children of an unsealed internal page
+    Status GetChildPageIDs(uint64_t page_id, const std::string& page, std::vector<uint64_t>* child_ids);
+}
+
+#endif
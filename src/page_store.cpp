@@ -0,0 +1,29 @@
+#include "page_store.h"
+
+namespace cowbpt {
+
+    Status OpenPageStore(const Options& options, const std::string& name, PageStore** result) {
+        *result = nullptr;
+        switch (options.page_store) {
+            case kLevelDBPageStore:
+                return OpenLevelDBPageStore(options, name, result);
+            case kRocksDBPageStore:
+                return OpenRocksDBPageStore(options, name, result);
+            case kFilePageStore:
+                return OpenFilePageStore(options, name, result);
+        }
+        return Status::InvalidArgument("unknown page store");
+    }
+
+    Status DestroyPageStore(const Options& options, const std::string& name) {
+        switch (options.page_store) {
+            case kLevelDBPageStore:
+                return DestroyLevelDBPageStore(name);
+            case kRocksDBPageStore:
+                return DestroyRocksDBPageStore(name);
+            case kFilePageStore:
+                return DestroyFilePageStore(options, name);
+        }
+        return Status::InvalidArgument("unknown page store");
+    }
+}
@@ -0,0 +1,116 @@
+#ifndef PAGE_STORE_H
+#define PAGE_STORE_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "options.h"
+#include "status.h"
+
+namespace cowbpt {
+
+    // A set of page and metadata updates that a PageStore applies atomically.
+    class PageBatch {
+    public:
+        enum OpType {
+            kPutPage,
+            kDeletePage,
+            kPutMeta,
+            kDeleteMeta
+        };
+
+        struct Op {
+            OpType type;
+            uint64_t page_id;   // kPutPage and kDeletePage
+            std::string key;    // kPutMeta and kDeleteMeta
+            std::string value;  // kPutPage and kPutMeta
+        };
+
+        PageBatch() = default;
+
+        void PutPage(uint64_t page_id, std::string page) {
+            _ops.push_back(Op{kPutPage, page_id, std::string(), std::move(page)});
+        }
+        void DeletePage(uint64_t page_id) {
+            _ops.push_back(Op{kDeletePage, page_id, std::string(), std::string()});
+        }
+        void PutMeta(const std::string& key, std::string value) {
+            _ops.push_back(Op{kPutMeta, 0, key, std::move(value)});
+        }
+        void DeleteMeta(const std::string& key) {
+            _ops.push_back(Op{kDeleteMeta, 0, key, std::string()});
+        }
+
+        void Clear() { _ops.clear(); }
+        bool Empty() const { return _ops.empty(); }
+        const std::vector<Op>& ops() const { return _ops; }
+
+    private:
+        std::vector<Op> _ops;
+    };
+
+    // Where the checkpoints are stored: the serialized pages of the tree,
+    // keyed by node id, and a few metadata keys (see filename.h).
+    //
+    // Pages are versioned.  A durable snapshot pins the version of every
+    // page as of the moment it is taken, so that a checkpoint can be read
+    // back while later checkpoints keep rewriting the same pages.  Only the
+    // page writes covered by a snapshot are sure to be read back after the
+    // store is reopened.  The metadata keys are not versioned.
+    //
+    // Implementations are safe for concurrent use.
+    class PageStore {
+    public:
+        PageStore() = default;
+
+        PageStore(const PageStore&) = delete;
+        PageStore& operator=(const PageStore&) = delete;
+
+        virtual ~PageStore() = default;
+
+        // Read the page as of the durable snapshot "snapshot", 0 reads the
+        // latest version.  Returns NotFound if the page does not exist.
+        virtual Status GetPage(uint64_t page_id, uint64_t snapshot, std::string* page) = 0;
+
+        // GetPage() of every page_ids[i] into pages[i], with its result in
+        // statuses[i].  A store of files issues the reads together.
+        virtual void GetPages(const uint64_t* page_ids, size_t n, uint64_t snapshot,
+                              std::string* pages, Status* statuses) {
+            for (size_t i = 0; i < n; i++) {
+                statuses[i] = GetPage(page_ids[i], snapshot, &pages[i]);
+            }
+        }
+
+        // Returns NotFound if the key does not exist.
+        virtual Status GetMeta(const std::string& key, std::string* value) = 0;
+
+        virtual Status Write(const PageBatch& batch, bool sync) = 0;
+
+        // Pin the current version of every page.  The result is never 0,
+        // stays readable across reopens once it is recorded in the store,
+        // and is kept until it is released.
+        virtual uint64_t GetDurableSnapshot() = 0;
+
+        // The versions only needed by "snapshot" may be dropped
+        virtual void ReleaseDurableSnapshot(uint64_t snapshot) = 0;
+    };
+
+    // Open the store selected by options.page_store in the directory "name"
+    Status OpenPageStore(const Options& options, const std::string& name, PageStore** result);
+
+    // Remove the store selected by options.page_store in the directory "name"
+    Status DestroyPageStore(const Options& options, const std::string& name);
+
+    Status OpenLevelDBPageStore(const Options& options, const std::string& name, PageStore** result);
+    Status DestroyLevelDBPageStore(const std::string& name);
+
+    Status OpenRocksDBPageStore(const Options& options, const std::string& name, PageStore** result);
+    Status DestroyRocksDBPageStore(const std::string& name);
+
+    Status OpenFilePageStore(const Options& options, const std::string& name, PageStore** result);
+    Status DestroyFilePageStore(const Options& options, const std::string& name);
+}
+
+#endif
@@ -0,0 +1,959 @@
+#include "page_store.h"
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "coding.h"
+#include "crc32c.h"
+#include "env.h"
+#include "filename.h"
+#include "glog/logging.h"
+#include "log_reader.h"
+#include "log_writer.h"
+
+namespace cowbpt {
+
+    namespace {
+        // A page in a segment file:
+        //     masked crc32c (fixed32) | page id (fixed64) | version (fixed64) |
+        //     size (fixed32) | page
+        // the crc covers everything after itself.
+        const size_t kRecordHeaderSize = 4 + 8 + 8 + 4;
+
+        // a segment is rewritten once less than 1/kCleanRatio of it is live
+        const uint64_t kCleanRatio = 2;
+
+        // the descriptor is rewritten once its edits take kCompactRatio
+        // times the space of the pages and meta they describe
+        const uint64_t kCompactRatio = 4;
+        const uint64_t kMinCompactSize = 1 << 20;
+
+        // page versions written to a fresh descriptor in one record
+        const size_t kVersionsPerRecord = 4096;
+
+        // The index of the pages is a log of edits in a descriptor file, and
+        // CURRENT names the descriptor in use, as in leveldb.
+        enum EditTag {
+            kPageEdit = 1,        // page id, version, segment, offset, size
+                                  // segment 0 is a deleted page
+            kDropEdit = 2,        // page id, version
+            kMetaEdit = 3,        // key, value
+            kMetaDeleteEdit = 4,  // key
+            kEpochEdit = 5        // epoch
+        };
+
+        struct PageVersion {
+            uint64_t version;
+            uint64_t segment;
+            uint64_t offset;
+            uint32_t size;
+        };
+
+        struct Segment {
+            RandomAccessFilePtr file;
+            uint64_t size = 0;  // bytes appended
+            uint64_t live = 0;  // bytes of the versions in the index
+        };
+
+        uint64_t RecordSize(const PageVersion& v) {
+            return v.segment == 0 ? 0 : kRecordHeaderSize + v.size;
+        }
+
+        void EncodePageEdit(std::string* dst, uint64_t page_id, const PageVersion& v) {
+            dst->push_back(static_cast<char>(kPageEdit));
+            PutVarint64(dst, page_id);
+            PutVarint64(dst, v.version);
+            PutVarint64(dst, v.segment);
+            PutVarint64(dst, v.offset);
+            PutVarint32(dst, v.size);
+        }
+
+        void EncodeDropEdit(std::string* dst, uint64_t page_id, uint64_t version) {
+            dst->push_back(static_cast<char>(kDropEdit));
+            PutVarint64(dst, page_id);
+            PutVarint64(dst, version);
+        }
+
+        void EncodeString(std::string* dst, const std::string& value) {
+            PutVarint32(dst, value.size());
+            dst->append(value);
+        }
+
+        const char* DecodeString(const char* p, const char* limit, std::string* value) {
+            uint32_t len;
+            p = GetVarint32Ptr(p, limit, &len);
+            if (p == nullptr || static_cast<size_t>(limit - p) < len) {
+                return nullptr;
+            }
+            value->assign(p, len);
+            return p + len;
+        }
+
+        // Appends each page to the current segment file, and each write to
+        // the descriptor.  The versions of the pages, their locations and
+        // the meta are kept in memory.
+        //
+        // Versions are dropped as in RocksDBPageStore: when a snapshot is
+        // released, the versions that are neither the newest one of their
+        // page nor read by a pinned snapshot, also those of earlier
+        // sessions.  The writes of the epoch that was open when the store
+        // was closed are dropped by the next open.
+        //
+        // A background thread copies the live versions of the segments that
+        // are mostly dropped into the current segment, then removes them.
+        class FilePageStore : public PageStore {
+        public:
+            FilePageStore(const Options& options, const std::string& dirname)
+            : _env(options.env),
+              _dirname(dirname),
+              _segment_size(options.page_segment_size),
+              _epoch(1),
+              _next_file_number(1),
+              _segment_number(0),
+              _descriptor_number(0),
+              _descriptor_size(0),
+              _shutting_down(false),
+              _clean_requested(false) {}
+
+            ~FilePageStore() override {
+                {
+                    std::lock_guard<std::mutex> lck(_mutex);
+                    _shutting_down = true;
+                    _cleaner_cv.notify_all();
+                }
+                if (_cleaner.joinable()) {
+                    _cleaner.join();
+                }
+                _descriptor_log.reset();
+                if (_segment_file) {
+                    _segment_file->Close();
+                }
+                if (_descriptor_file) {
+                    _descriptor_file->Close();
+                }
+            }
+
+            Status Open(const Options& options);
+
+            Status GetPage(uint64_t page_id, uint64_t snapshot, std::string* page) override;
+
+            // the reads of a segment file go out with one MultiRead()
+            void GetPages(const uint64_t* page_ids, size_t n, uint64_t snapshot,
+                          std::string* pages, Status* statuses) override;
+
+            Status GetMeta(const std::string& key, std::string* value) override {
+                std::lock_guard<std::mutex> lck(_mutex);
+                auto it = _meta.find(key);
+                if (it == _meta.end()) {
+                    return Status::NotFound(key);
+                }
+                *value = it->second;
+                return Status::OK();
+            }
+
+            Status Write(const PageBatch& batch, bool sync) override;
+
+            uint64_t GetDurableSnapshot() override;
+
+            void ReleaseDurableSnapshot(uint64_t snapshot) override;
+
+        private:
+            Status apply_edits(const char* p, const char* limit);
+            void add_version(uint64_t page_id, const PageVersion& v);
+            void drop_version(uint64_t page_id, uint64_t version);
+
+            // REQUIRES: _mutex is held
+            Status find_version(uint64_t page_id, uint64_t snapshot, PageVersion* v, RandomAccessFilePtr* file);
+
+            Status read_page(uint64_t page_id, const PageVersion& v, const RandomAccessFilePtr& file,
+                             std::string* page) const;
+            // the record of the page read at v
+            Status check_page(uint64_t page_id, const PageVersion& v, const Slice& result,
+                              std::string* page) const;
+
+            // REQUIRES: _mutex is held by all of the following
+            Status append_page(uint64_t page_id, uint64_t version, const std::string& page, PageVersion* v);
+            Status new_segment();
+            Status log_edits(const std::string& edits, bool sync);
+            Status write_descriptor();
+            // called once the edits of the descriptor are applied in memory
+            void maybe_compact_descriptor();
+            void collect_garbage(std::string* edits);
+            bool need_clean() const;
+
+            void clean_loop();
+            void clean_segment(std::unique_lock<std::mutex>& lck, uint64_t number);
+
+            Env* const _env;
+            const std::string _dirname;
+            const size_t _segment_size;
+
+            std::mutex _mutex;
+            std::unordered_map<uint64_t, std::vector<PageVersion>> _pages;  // newest first
+            std::map<std::string, std::string> _meta;
+            std::map<uint64_t, Segment> _segments;
+            uint64_t _epoch;                // version of the writes, never pinned
+            std::set<uint64_t> _snapshots;  // pinned since the store was opened
+            std::set<uint64_t> _rewritten;  // pages that may have old versions
+
+            uint64_t _next_file_number;
+            uint64_t _segment_number;
+            WritableFilePtr _segment_file;
+            uint64_t _descriptor_number;
+            WritableFilePtr _descriptor_file;
+            std::unique_ptr<log::Writer> _descriptor_log;
+            uint64_t _descriptor_size;  // bytes of edits in the descriptor
+
+            std::condition_variable _cleaner_cv;
+            bool _shutting_down;
+            bool _clean_requested;
+            std::thread _cleaner;
+        };
+
+        Status FilePageStore::Open(const Options& options) {
+            _env->CreateDir(_dirname);
+
+            const std::string current = CurrentFileName(_dirname);
+            if (!_env->FileExists(current)) {
+                if (!options.create_if_missing) {
+                    return Status::InvalidArgument(_dirname + " does not exist (create_if_missing is false)");
+                }
+            } else if (options.error_if_exists) {
+                return Status::InvalidArgument(_dirname + " exists (error_if_exists is true)");
+            } else {
+                std::string name;
+                Status s = ReadFileToString(_env, current, &name);
+                if (!s.ok()) {
+                    return s;
+                }
+                uint64_t number;
+                FileType type;
+                if (name.empty() || name.back() != '\n' ||
+                    !ParseFileName(name.substr(0, name.size() - 1), &number, &type) ||
+                    type != kDescriptorFile) {
+                    return Status::Corruption("CURRENT file of the page store is broken");
+                }
+
+                SequentialFilePtr file;
+                s = _env->NewSequentialFile(DescriptorFileName(_dirname, number), file);
+                if (!s.ok()) {
+                    return s;
+                }
+                struct Reporter : public log::Reader::Reporter {
+                    Status status;
+                    void Corruption(size_t, const Status& s) override {
+                        if (status.ok()) {
+                            status = s;
+                        }
+                    }
+                } reporter;
+                log::Reader reader(file, &reporter, true /*checksum*/, 0 /*initial_offset*/);
+                Slice record;
+                std::string scratch;
+                while (reader.ReadRecord(&record, &scratch) && s.ok()) {
+                    s = apply_edits(record.c_string(), record.c_string() + record.size());
+                }
+                if (s.ok()) {
+                    s = reporter.status;
+                }
+                if (!s.ok()) {
+                    LOG(ERROR) << "Fail to read the descriptor of the page store: " << s.string();
+                    return s;
+                }
+            }
+
+            // the versions of the open epoch were never pinned
+            std::vector<std::pair<uint64_t, uint64_t>> unpinned;
+            for (auto& page : _pages) {
+                for (auto& v : page.second) {
+                    if (v.version >= _epoch) {
+                        unpinned.emplace_back(page.first, v.version);
+                    }
+                }
+            }
+            for (auto& v : unpinned) {
+                drop_version(v.first, v.second);
+            }
+            // the old versions left by the earlier sessions
+            for (auto& page : _pages) {
+                if (page.second.size() > 1) {
+                    _rewritten.insert(page.first);
+                }
+            }
+            // the segments left with no version are removed with the files
+            // that are not in the index
+            for (auto it = _segments.begin(); it != _segments.end();) {
+                if (it->second.live == 0) {
+                    it = _segments.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+
+            std::vector<std::string> filenames;
+            Status s = _env->GetChildren(_dirname, &filenames);
+            if (!s.ok()) {
+                return s;
+            }
+            std::vector<std::string> obsolete;
+            uint64_t number;
+            FileType type;
+            for (auto& filename : filenames) {
+                if (!ParseFileName(filename, &number, &type)) {
+                    continue;
+                }
+                _next_file_number = std::max(_next_file_number, number + 1);
+                if (type == kPageSegmentFile) {
+                    auto it = _segments.find(number);
+                    if (it == _segments.end()) {
+                        obsolete.push_back(filename);
+                        continue;
+                    }
+                    const std::string fname = PageSegmentFileName(_dirname, number);
+                    s = _env->NewRandomAccessFile(fname, it->second.file);
+                    if (s.ok()) {
+                        s = _env->GetFileSize(fname, &it->second.size);
+                    }
+                    if (!s.ok()) {
+                        return s;
+                    }
+                } else if (type == kDescriptorFile || type == kTempFile) {
+                    obsolete.push_back(filename);
+                }
+            }
+            for (auto& segment : _segments) {
+                if (segment.second.file == nullptr) {
+                    return Status::Corruption("missing segment file of the page store: " +
+                                              PageSegmentFileName(_dirname, segment.first));
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lck(_mutex);
+                s = write_descriptor();
+                if (s.ok()) {
+                    s = new_segment();
+                }
+            }
+            if (!s.ok()) {
+                return s;
+            }
+            for (auto& filename : obsolete) {
+                _env->RemoveFile(_dirname + "/" + filename);
+            }
+
+            _clean_requested = need_clean();
+            _cleaner = std::thread(&FilePageStore::clean_loop, this);
+            return Status::OK();
+        }
+
+        Status FilePageStore::apply_edits(const char* p, const char* limit) {
+            while (p != nullptr && p < limit) {
+                const char tag = *p++;
+                uint64_t page_id;
+                PageVersion v;
+                std::string key;
+                std::string value;
+                switch (tag) {
+                    case kPageEdit:
+                        if ((p = GetVarint64Ptr(p, limit, &page_id)) != nullptr &&
+                            (p = GetVarint64Ptr(p, limit, &v.version)) != nullptr &&
+                            (p = GetVarint64Ptr(p, limit, &v.segment)) != nullptr &&
+                            (p = GetVarint64Ptr(p, limit, &v.offset)) != nullptr &&
+                            (p = GetVarint32Ptr(p, limit, &v.size)) != nullptr) {
+                            add_version(page_id, v);
+                        }
+                        break;
+                    case kDropEdit:
+                        if ((p = GetVarint64Ptr(p, limit, &page_id)) != nullptr &&
+                            (p = GetVarint64Ptr(p, limit, &v.version)) != nullptr) {
+                            drop_version(page_id, v.version);
+                        }
+                        break;
+                    case kMetaEdit:
+                        if ((p = DecodeString(p, limit, &key)) != nullptr &&
+                            (p = DecodeString(p, limit, &value)) != nullptr) {
+                            _meta[key] = value;
+                        }
+                        break;
+                    case kMetaDeleteEdit:
+                        if ((p = DecodeString(p, limit, &key)) != nullptr) {
+                            _meta.erase(key);
+                        }
+                        break;
+                    case kEpochEdit:
+                        p = GetVarint64Ptr(p, limit, &_epoch);
+                        break;
+                    default:
+                        p = nullptr;
+                        break;
+                }
+            }
+            return p == nullptr ? Status::Corruption("bad edit of the page store") : Status::OK();
+        }
+
+        void FilePageStore::add_version(uint64_t page_id, const PageVersion& v) {
+            std::vector<PageVersion>& versions = _pages[page_id];
+            auto it = versions.begin();
+            while (it != versions.end() && it->version > v.version) {
+                ++it;
+            }
+            if (it != versions.end() && it->version == v.version) {
+                // rewritten in the same epoch, or moved by the cleaner
+                if (it->segment != 0) {
+                    _segments[it->segment].live -= RecordSize(*it);
+                }
+                *it = v;
+            } else {
+                versions.insert(it, v);
+            }
+            if (v.segment != 0) {
+                _segments[v.segment].live += RecordSize(v);
+            }
+        }
+
+        void FilePageStore::drop_version(uint64_t page_id, uint64_t version) {
+            auto page = _pages.find(page_id);
+            if (page == _pages.end()) {
+                return;
+            }
+            std::vector<PageVersion>& versions = page->second;
+            for (auto it = versions.begin(); it != versions.end(); ++it) {
+                if (it->version == version) {
+                    if (it->segment != 0) {
+                        _segments[it->segment].live -= RecordSize(*it);
+                    }
+                    versions.erase(it);
+                    break;
+                }
+            }
+            if (versions.empty()) {
+                _pages.erase(page);
+            }
+        }
+
+        Status FilePageStore::find_version(uint64_t page_id, uint64_t snapshot, PageVersion* v,
+                                           RandomAccessFilePtr* file) {
+            auto it = _pages.find(page_id);
+            if (it == _pages.end()) {
+                return Status::NotFound("page not found");
+            }
+            const std::vector<PageVersion>& versions = it->second;
+            auto found = versions.begin();
+            while (found != versions.end() && snapshot != 0 && found->version > snapshot) {
+                ++found;
+            }
+            if (found == versions.end()) {
+                return Status::NotFound("page not found");
+            }
+            if (found->segment == 0) {
+                return Status::NotFound("page deleted");
+            }
+            *v = *found;
+            *file = _segments[v->segment].file;
+            return Status::OK();
+        }
+
+        Status FilePageStore::GetPage(uint64_t page_id, uint64_t snapshot, std::string* page) {
+            PageVersion v;
+            RandomAccessFilePtr file;
+            {
+                std::lock_guard<std::mutex> lck(_mutex);
+                Status s = find_version(page_id, snapshot, &v, &file);
+                if (!s.ok()) {
+                    return s;
+                }
+            }
+            // the file stays readable even if the cleaner removes it meanwhile
+            return read_page(page_id, v, file, page);
+        }
+
+        void FilePageStore::GetPages(const uint64_t* page_ids, size_t n, uint64_t snapshot,
+                                     std::string* pages, Status* statuses) {
+            std::vector<PageVersion> versions(n);
+            // the requests of each file, by the index of their page
+            std::map<RandomAccessFile*, std::pair<RandomAccessFilePtr, std::vector<size_t>>> reads;
+            {
+                std::lock_guard<std::mutex> lck(_mutex);
+                for (size_t i = 0; i < n; i++) {
+                    RandomAccessFilePtr file;
+                    statuses[i] = find_version(page_ids[i], snapshot, &versions[i], &file);
+                    if (statuses[i].ok()) {
+                        auto& read = reads[file.get()];
+                        read.first = file;
+                        read.second.push_back(i);
+                    }
+                }
+            }
+            for (auto& read : reads) {
+                const std::vector<size_t>& indexes = read.second.second;
+                std::vector<RandomAccessFile::ReadRequest> reqs(indexes.size());
+                for (size_t j = 0; j < indexes.size(); j++) {
+                    const PageVersion& v = versions[indexes[j]];
+                    reqs[j].offset = v.offset;
+                    reqs[j].n = kRecordHeaderSize + v.size;
+                }
+                read.second.first->MultiRead(reqs.data(), reqs.size());
+                for (size_t j = 0; j < indexes.size(); j++) {
+                    const size_t i = indexes[j];
+                    statuses[i] = reqs[j].status.ok() ? check_page(page_ids[i], versions[i], reqs[j].result, &pages[i])
+                                                      : reqs[j].status;
+                }
+            }
+        }
+
+        Status FilePageStore::read_page(uint64_t page_id, const PageVersion& v, const RandomAccessFilePtr& file,
+                                        std::string* page) const {
+            Slice result;
+            Status s = file->Read(v.offset, kRecordHeaderSize + v.size, result);
+            if (!s.ok()) {
+                return s;
+            }
+            return check_page(page_id, v, result, page);
+        }
+
+        Status FilePageStore::check_page(uint64_t page_id, const PageVersion& v, const Slice& result,
+                                         std::string* page) const {
+            const size_t n = kRecordHeaderSize + v.size;
+            if (result.size() != n) {
+                return Status::Corruption("truncated page in the page store");
+            }
+            const char* data = result.c_string();
+            uint32_t crc = crc32c::Unmask(DecodeFixed32(data));
+            if (crc != crc32c::Value(data + 4, n - 4)) {
+                return Status::Corruption("checksum mismatch of a page in the page store");
+            }
+            if (DecodeFixed64(data + 4) != page_id || DecodeFixed64(data + 12) != v.version) {
+                return Status::Corruption("misplaced page in the page store");
+            }
+            page->assign(data + kRecordHeaderSize, v.size);
+            return Status::OK();
+        }
+
+        Status FilePageStore::Write(const PageBatch& batch, bool sync) {
+            std::lock_guard<std::mutex> lck(_mutex);
+            std::string edits;
+            std::vector<std::pair<uint64_t, PageVersion>> versions;
+            for (const PageBatch::Op& op : batch.ops()) {
+                PageVersion v{_epoch, 0, 0, 0};
+                switch (op.type) {
+                    case PageBatch::kPutPage: {
+                        Status s = append_page(op.page_id, _epoch, op.value, &v);
+                        if (!s.ok()) {
+                            return s;
+                        }
+                        EncodePageEdit(&edits, op.page_id, v);
+                        versions.emplace_back(op.page_id, v);
+                        break;
+                    }
+                    case PageBatch::kDeletePage:
+                        EncodePageEdit(&edits, op.page_id, v);
+                        versions.emplace_back(op.page_id, v);
+                        break;
+                    case PageBatch::kPutMeta:
+                        edits.push_back(static_cast<char>(kMetaEdit));
+                        EncodeString(&edits, op.key);
+                        EncodeString(&edits, op.value);
+                        break;
+                    case PageBatch::kDeleteMeta:
+                        edits.push_back(static_cast<char>(kMetaDeleteEdit));
+                        EncodeString(&edits, op.key);
+                        break;
+                }
+            }
+
+            Status s = log_edits(edits, sync);
+            if (!s.ok()) {
+                return s;
+            }
+            for (auto& v : versions) {
+                add_version(v.first, v.second);
+                _rewritten.insert(v.first);
+            }
+            for (const PageBatch::Op& op : batch.ops()) {
+                if (op.type == PageBatch::kPutMeta) {
+                    _meta[op.key] = op.value;
+                } else if (op.type == PageBatch::kDeleteMeta) {
+                    _meta.erase(op.key);
+                }
+            }
+            maybe_compact_descriptor();
+            return Status::OK();
+        }
+
+        uint64_t FilePageStore::GetDurableSnapshot() {
+            std::lock_guard<std::mutex> lck(_mutex);
+            uint64_t snapshot = _epoch;
+            std::string edits;
+            edits.push_back(static_cast<char>(kEpochEdit));
+            PutVarint64(&edits, snapshot + 1);
+            Status s = log_edits(edits, true /* sync */);
+            if (!s.ok()) {
+                LOG(FATAL) << "Fail to persist the epoch of the page store: " << s.string();
+            }
+            _epoch = snapshot + 1;
+            _snapshots.insert(snapshot);
+            maybe_compact_descriptor();
+            return snapshot;
+        }
+
+        void FilePageStore::ReleaseDurableSnapshot(uint64_t snapshot) {
+            if (snapshot == 0) {
+                return;
+            }
+            std::lock_guard<std::mutex> lck(_mutex);
+            _snapshots.erase(snapshot);
+            std::string edits;
+            collect_garbage(&edits);
+            if (edits.empty()) {
+                return;
+            }
+            // the versions are dropped by a later release if this fails
+            Status s = log_edits(edits, false);
+            if (!s.ok()) {
+                LOG(ERROR) << "Fail to drop old page versions: " << s.string();
+                return;
+            }
+            apply_edits(edits.data(), edits.data() + edits.size());
+            maybe_compact_descriptor();
+            if (need_clean()) {
+                _clean_requested = true;
+                _cleaner_cv.notify_all();
+            }
+        }
+
+        void FilePageStore::collect_garbage(std::string* edits) {
+            for (auto page = _rewritten.begin(); page != _rewritten.end();) {
+                auto found = _pages.find(*page);
+                if (found == _pages.end()) {
+                    page = _rewritten.erase(page);
+                    continue;
+                }
+                // the versions newest first and the snapshots highest first,
+                // see RocksDBPageStore
+                const std::vector<PageVersion>& versions = found->second;
+                auto snapshot = _snapshots.rbegin();
+                std::vector<const PageVersion*> kept;
+                for (size_t i = 0; i < versions.size(); i++) {
+                    bool keep = (i == 0);
+                    while (snapshot != _snapshots.rend() && versions[i].version <= *snapshot) {
+                        keep = true;
+                        ++snapshot;
+                    }
+                    if (keep) {
+                        kept.push_back(&versions[i]);
+                    } else {
+                        EncodeDropEdit(edits, *page, versions[i].version);
+                    }
+                }
+                if (!kept.empty() && kept.back()->segment == 0) {
+                    // nothing older is left, reading it is the same as
+                    // finding no version
+                    EncodeDropEdit(edits, *page, kept.back()->version);
+                    kept.pop_back();
+                }
+                if (kept.size() <= 1) {
+                    page = _rewritten.erase(page);
+                } else {
+                    ++page;
+                }
+            }
+        }
+
+        Status FilePageStore::append_page(uint64_t page_id, uint64_t version, const std::string& page,
+                                          PageVersion* v) {
+            if (_segments[_segment_number].size >= _segment_size) {
+                Status s = new_segment();
+                if (!s.ok()) {
+                    return s;
+                }
+            }
+            std::string record(kRecordHeaderSize, '\0');
+            EncodeFixed64(&record[4], page_id);
+            EncodeFixed64(&record[12], version);
+            EncodeFixed32(&record[20], page.size());
+            record.append(page);
+            uint32_t crc = crc32c::Value(record.data() + 4, record.size() - 4);
+            EncodeFixed32(&record[0], crc32c::Mask(crc));
+
+            Segment& segment = _segments[_segment_number];
+            const uint64_t record_size = record.size();
+            Status s = _segment_file->Append(Slice(std::move(record)));
+            if (!s.ok()) {
+                return s;
+            }
+            v->version = version;
+            v->segment = _segment_number;
+            v->offset = segment.size;
+            v->size = page.size();
+            segment.size += record_size;
+            return Status::OK();
+        }
+
+        Status FilePageStore::new_segment() {
+            if (_segment_file) {
+                // the edits pointing into it may be synced without it
+                Status s = _segment_file->Sync();
+                if (s.ok()) {
+                    s = _segment_file->Close();
+                }
+                if (!s.ok()) {
+                    return s;
+                }
+                _segment_file.reset();
+            }
+            const uint64_t number = _next_file_number++;
+            const std::string fname = PageSegmentFileName(_dirname, number);
+            WritableFilePtr file;
+            RandomAccessFilePtr reader;
+            Status s = _env->NewWritableFile(fname, file);
+            if (s.ok()) {
+                s = _env->NewRandomAccessFile(fname, reader);
+            }
+            if (!s.ok()) {
+                return s;
+            }
+            _segment_file = file;
+            _segment_number = number;
+            _segments[number].file = reader;
+            return Status::OK();
+        }
+
+        Status FilePageStore::log_edits(const std::string& edits, bool sync) {
+            // the readers look at the segment through another file
+            Status s = _segment_file->Flush();
+            if (s.ok() && sync) {
+                s = _segment_file->Sync();
+            }
+            if (s.ok() && !edits.empty()) {
+                s = _descriptor_log->AddRecord(edits);
+                _descriptor_size += edits.size();
+            }
+            if (s.ok() && sync) {
+                s = _descriptor_file->Sync();
+            }
+            return s;
+        }
+
+        void FilePageStore::maybe_compact_descriptor() {
+            if (_descriptor_size < kMinCompactSize ||
+                _descriptor_size < kCompactRatio * (_meta.size() * 64 + _pages.size() * 32)) {
+                return;
+            }
+            // the edits are all in the old descriptor, which is kept on failure
+            Status s = write_descriptor();
+            if (!s.ok()) {
+                LOG(ERROR) << "Fail to rewrite the descriptor of the page store: " << s.string();
+            }
+        }
+
+        Status FilePageStore::write_descriptor() {
+            const uint64_t number = _next_file_number++;
+            const std::string fname = DescriptorFileName(_dirname, number);
+            WritableFilePtr file;
+            Status s = _env->NewWritableFile(fname, file);
+            if (!s.ok()) {
+                return s;
+            }
+            std::unique_ptr<log::Writer> writer(new log::Writer(file));
+            uint64_t size = 0;
+
+            std::string edits;
+            edits.push_back(static_cast<char>(kEpochEdit));
+            PutVarint64(&edits, _epoch);
+            for (auto& meta : _meta) {
+                edits.push_back(static_cast<char>(kMetaEdit));
+                EncodeString(&edits, meta.first);
+                EncodeString(&edits, meta.second);
+            }
+            size_t n = 0;
+            for (auto& page : _pages) {
+                for (auto& v : page.second) {
+                    EncodePageEdit(&edits, page.first, v);
+                    if (++n % kVersionsPerRecord == 0 && s.ok()) {
+                        s = writer->AddRecord(edits);
+                        size += edits.size();
+                        edits.clear();
+                    }
+                }
+            }
+            if (s.ok() && !edits.empty()) {
+                s = writer->AddRecord(edits);
+                size += edits.size();
+            }
+            if (s.ok()) {
+                s = file->Sync();
+            }
+            if (s.ok()) {
+                s = SetCurrentFile(_env, _dirname, number);
+            }
+            if (!s.ok()) {
+                file->Close();
+                _env->RemoveFile(fname);
+                return s;
+            }
+
+            if (_descriptor_file) {
+                _descriptor_log.reset();
+                _descriptor_file->Close();
+                _env->RemoveFile(DescriptorFileName(_dirname, _descriptor_number));
+            }
+            _descriptor_number = number;
+            _descriptor_file = file;
+            _descriptor_log = std::move(writer);
+            _descriptor_size = size;
+            return Status::OK();
+        }
+
+        bool FilePageStore::need_clean() const {
+            for (auto& segment : _segments) {
+                if (segment.first != _segment_number &&
+                    segment.second.live * kCleanRatio < segment.second.size) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void FilePageStore::clean_loop() {
+            std::unique_lock<std::mutex> lck(_mutex);
+            while (true) {
+                _cleaner_cv.wait(lck, [this]() { return _shutting_down || _clean_requested; });
+                if (_shutting_down) {
+                    break;
+                }
+                _clean_requested = false;
+                std::vector<uint64_t> numbers;
+                for (auto& segment : _segments) {
+                    if (segment.first != _segment_number &&
+                        segment.second.live * kCleanRatio < segment.second.size) {
+                        numbers.push_back(segment.first);
+                    }
+                }
+                for (uint64_t number : numbers) {
+                    if (_shutting_down) {
+                        break;
+                    }
+                    clean_segment(lck, number);
+                }
+            }
+        }
+
+        void FilePageStore::clean_segment(std::unique_lock<std::mutex>& lck, uint64_t number) {
+            struct Move {
+                uint64_t page_id;
+                PageVersion v;
+                std::string page;
+            };
+            std::vector<Move> moves;
+            for (auto& page : _pages) {
+                for (auto& v : page.second) {
+                    if (v.segment == number) {
+                        moves.push_back(Move{page.first, v, std::string()});
+                    }
+                }
+            }
+            RandomAccessFilePtr file = _segments[number].file;
+
+            // only the cleaner removes segments, the file stays there
+            lck.unlock();
+            Status s;
+            for (auto& move : moves) {
+                s = read_page(move.page_id, move.v, file, &move.page);
+                if (!s.ok()) {
+                    break;
+                }
+            }
+            lck.lock();
+            if (!s.ok()) {
+                LOG(ERROR) << "Fail to read segment " << number << " of the page store: " << s.string();
+                return;
+            }
+
+            std::string edits;
+            std::vector<std::pair<uint64_t, PageVersion>> moved;
+            for (auto& move : moves) {
+                // skip the versions dropped while the lock was released
+                auto page = _pages.find(move.page_id);
+                if (page == _pages.end()) {
+                    continue;
+                }
+                bool found = false;
+                for (auto& v : page->second) {
+                    if (v.version == move.v.version && v.segment == number && v.offset == move.v.offset) {
+                        found = true;
+                        break;
+                    }
+                }
+                if (!found) {
+                    continue;
+                }
+                PageVersion v;
+                s = append_page(move.page_id, move.v.version, move.page, &v);
+                if (!s.ok()) {
+                    break;
+                }
+                EncodePageEdit(&edits, move.page_id, v);
+                moved.emplace_back(move.page_id, v);
+            }
+            // the segment can only be removed once the new locations and the
+            // drops of its versions are durable
+            if (s.ok()) {
+                s = log_edits(edits, true /* sync */);
+            }
+            if (!s.ok()) {
+                LOG(ERROR) << "Fail to clean segment " << number << " of the page store: " << s.string();
+                return;
+            }
+            for (auto& v : moved) {
+                add_version(v.first, v.second);
+            }
+            maybe_compact_descriptor();
+
+            auto segment = _segments.find(number);
+            if (segment != _segments.end() && segment->second.live == 0) {
+                _segments.erase(segment);
+                _env->RemoveFile(PageSegmentFileName(_dirname, number));
+            }
+        }
+    }
+
+    Status OpenFilePageStore(const Options& options, const std::string& name, PageStore** result) {
+        FilePageStore* store = new FilePageStore(options, name);
+        Status s = store->Open(options);
+        if (!s.ok()) {
+            LOG(ERROR) << "Fail to open the page store " << name << ": " << s.string();
+            delete store;
+            return s;
+        }
+        *result = store;
+        return Status::OK();
+    }
+
+    Status DestroyFilePageStore(const Options& options, const std::string& name) {
+        Env* env = options.env;
+        std::vector<std::string> filenames;
+        Status result = env->GetChildren(name, &filenames);
+        if (!result.ok()) {
+            // Ignore error in case directory does not exist
+            return Status::OK();
+        }
+        uint64_t number;
+        FileType type;
+        for (auto& filename : filenames) {
+            if (ParseFileName(filename, &number, &type)) {
+                Status del = env->RemoveFile(name + "/" + filename);
+                if (result.ok() && !del.ok()) {
+                    result = del;
+                }
+            }
+        }
+        env->RemoveDir(name);  // Ignore error in case dir contains other files
+        return result;
+    }
+}
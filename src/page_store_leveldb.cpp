@@ -0,0 +1,102 @@
+#include "page_store.h"
+
+#include "coding.h"
+#include "glog/logging.h"
+#include "leveldb/db.h"
+#include "leveldb/write_batch.h"
+
+namespace cowbpt {
+
+    namespace {
+        Status FromLevelDB(const leveldb::Status& s) {
+            if (s.ok()) {
+                return Status::OK();
+            } else if (s.IsNotFound()) {
+                return Status::NotFound(s.ToString());
+            } else if (s.IsCorruption()) {
+                return Status::Corruption(s.ToString());
+            }
+            return Status::IOError(s.ToString());
+        }
+
+        // Pages and metadata share the key space of one leveldb, the page
+        // keys are the fixed64 node ids, the metadata keys are longer.  The
+        // durable snapshots are the ones of the leveldb fork, which keeps
+        // the versions they pin across reopens.
+        class LevelDBPageStore : public PageStore {
+        public:
+            explicit LevelDBPageStore(leveldb::DB* db) : _db(db) {}
+
+            ~LevelDBPageStore() override {
+                delete _db;
+            }
+
+            Status GetPage(uint64_t page_id, uint64_t snapshot, std::string* page) override {
+                std::string key;
+                PutFixed64(&key, page_id);
+                return FromLevelDB(_db->Get(leveldb::ReadOptions(), key, page, snapshot));
+            }
+
+            Status GetMeta(const std::string& key, std::string* value) override {
+                return FromLevelDB(_db->Get(leveldb::ReadOptions(), key, value));
+            }
+
+            Status Write(const PageBatch& batch, bool sync) override {
+                leveldb::WriteBatch wb;
+                std::string key;
+                for (const PageBatch::Op& op : batch.ops()) {
+                    switch (op.type) {
+                        case PageBatch::kPutPage:
+                            key.clear();
+                            PutFixed64(&key, op.page_id);
+                            wb.Put(key, op.value);
+                            break;
+                        case PageBatch::kDeletePage:
+                            key.clear();
+                            PutFixed64(&key, op.page_id);
+                            wb.Delete(key);
+                            break;
+                        case PageBatch::kPutMeta:
+                            wb.Put(op.key, op.value);
+                            break;
+                        case PageBatch::kDeleteMeta:
+                            wb.Delete(op.key);
+                            break;
+                    }
+                }
+                leveldb::WriteOptions options;
+                options.sync = sync;
+                return FromLevelDB(_db->Write(options, &wb));
+            }
+
+            uint64_t GetDurableSnapshot() override {
+                return _db->GetDurableSnapshot();
+            }
+
+            void ReleaseDurableSnapshot(uint64_t snapshot) override {
+                _db->ReleaseDurableSnapshot(snapshot);
+            }
+
+        private:
+            leveldb::DB* const _db;
+        };
+    }
+
+    Status OpenLevelDBPageStore(const Options& options, const std::string& name, PageStore** result) {
+        leveldb::Options level_options;
+        level_options.create_if_missing = options.create_if_missing;
+        level_options.error_if_exists = options.error_if_exists;
+        leveldb::DB* db = nullptr;
+        leveldb::Status level_status = leveldb::DB::Open(level_options, name, &db);
+        if (!level_status.ok()) {
+            LOG(ERROR) << "Fail to open internal leveldb: " << level_status.ToString();
+            return FromLevelDB(level_status);
+        }
+        *result = new LevelDBPageStore(db);
+        return Status::OK();
+    }
+
+    Status DestroyLevelDBPageStore(const std::string& name) {
+        return FromLevelDB(leveldb::DestroyDB(name, leveldb::Options()));
+    }
+}
@@ -0,0 +1,396 @@
+#include "page_store.h"
+
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <utility>
+
+#include "coding.h"
+#include "glog/logging.h"
+#include "rocksdb/cache.h"
+#include "rocksdb/db.h"
+#include "rocksdb/filter_policy.h"
+#include "rocksdb/iterator.h"
+#include "rocksdb/slice_transform.h"
+#include "rocksdb/table.h"
+#include "rocksdb/write_batch.h"
+
+namespace cowbpt {
+
+    namespace {
+        // Every version of a page is a key of its own:
+        //     'p' | big endian page id | big endian ~version
+        // so that the versions of a page are adjacent, newest first, and a
+        // seek finds the newest version not above a snapshot.  A deleted
+        // page is a version with an empty value, pages are never empty.
+        const char kPageTag = 'p';
+        const char kMetaTag = 'm';
+        // 'r' | big endian page id, for each page that may have old
+        // versions, written with the page
+        const char kRewrittenTag = 'r';
+        const size_t kPagePrefixSize = 1 + 8;
+        const size_t kPageKeySize = kPagePrefixSize + 8;
+
+        // the version the writes are stamped with, persisted so that a
+        // snapshot is never written again after a reopen.  Tagged 's'.
+        const char kEpochKey[] = "sEpoch";
+
+        void PutBigEndian64(std::string* dst, uint64_t value) {
+            char buf[8];
+            for (int i = 7; i >= 0; i--) {
+                buf[i] = static_cast<char>(value & 0xff);
+                value >>= 8;
+            }
+            dst->append(buf, 8);
+        }
+
+        uint64_t DecodeBigEndian64(const char* ptr) {
+            uint64_t result = 0;
+            for (int i = 0; i < 8; i++) {
+                result = (result << 8) | static_cast<unsigned char>(ptr[i]);
+            }
+            return result;
+        }
+
+        std::string PagePrefix(uint64_t page_id) {
+            std::string key(1, kPageTag);
+            PutBigEndian64(&key, page_id);
+            return key;
+        }
+
+        std::string PageKey(uint64_t page_id, uint64_t version) {
+            std::string key = PagePrefix(page_id);
+            PutBigEndian64(&key, ~version);
+            return key;
+        }
+
+        std::string MetaKey(const std::string& key) {
+            return std::string(1, kMetaTag) + key;
+        }
+
+        std::string RewrittenKey(uint64_t page_id) {
+            std::string key(1, kRewrittenTag);
+            PutBigEndian64(&key, page_id);
+            return key;
+        }
+
+        uint64_t PageVersionOf(const rocksdb::Slice& page_key) {
+            return ~DecodeBigEndian64(page_key.data() + kPagePrefixSize);
+        }
+
+        bool HasPrefix(const rocksdb::Slice& key, const std::string& prefix) {
+            return key.size() >= prefix.size() &&
+                   memcmp(key.data(), prefix.data(), prefix.size()) == 0;
+        }
+
+        Status FromRocksDB(const rocksdb::Status& s) {
+            if (s.ok()) {
+                return Status::OK();
+            } else if (s.IsNotFound()) {
+                return Status::NotFound(s.ToString());
+            } else if (s.IsCorruption()) {
+                return Status::Corruption(s.ToString());
+            }
+            return Status::IOError(s.ToString());
+        }
+
+        // Keeps the versions of the pages in a RocksDB, which brings its
+        // block cache, prefix bloom filters on the page ids and block
+        // compression.
+        //
+        // The snapshots taken since the store was opened are pinned in
+        // memory.  ReleaseDurableSnapshot() drops the versions of the
+        // rewritten pages that no pinned snapshot reads and that are older
+        // than the newest one.  The rewritten pages are kept as keys of
+        // their own, so that the versions left by an earlier session are
+        // dropped too.
+        //
+        // The writes made after the last snapshot before the store was
+        // closed, e.g. by a checkpoint cut short by a crash, must not show up
+        // in the snapshots taken after the reopen.  The open deletes them,
+        // and the writes go on in the next epoch.
+        class RocksDBPageStore : public PageStore {
+        public:
+            RocksDBPageStore(rocksdb::DB* db, uint64_t epoch, std::set<uint64_t> rewritten)
+            : _db(db), _epoch(epoch), _rewritten(std::move(rewritten)) {}
+
+            ~RocksDBPageStore() override {
+                delete _db;
+            }
+
+            Status GetPage(uint64_t page_id, uint64_t snapshot, std::string* page) override {
+                const std::string prefix = PagePrefix(page_id);
+                rocksdb::ReadOptions options;
+                options.prefix_same_as_start = true;
+                std::unique_ptr<rocksdb::Iterator> it(_db->NewIterator(options));
+                it->Seek(PageKey(page_id, snapshot == 0 ? UINT64_MAX : snapshot));
+                if (!it->Valid() || !HasPrefix(it->key(), prefix)) {
+                    if (!it->status().ok()) {
+                        return FromRocksDB(it->status());
+                    }
+                    return Status::NotFound("page not found");
+                }
+                rocksdb::Slice value = it->value();
+                if (value.empty()) {
+                    return Status::NotFound("page deleted");
+                }
+                page->assign(value.data(), value.size());
+                return Status::OK();
+            }
+
+            Status GetMeta(const std::string& key, std::string* value) override {
+                return FromRocksDB(_db->Get(rocksdb::ReadOptions(), MetaKey(key), value));
+            }
+
+            Status Write(const PageBatch& batch, bool sync) override {
+                // held while writing, so that a snapshot taken concurrently
+                // sees either all or none of the batch
+                std::lock_guard<std::mutex> lck(_mutex);
+                rocksdb::WriteBatch wb;
+                for (const PageBatch::Op& op : batch.ops()) {
+                    switch (op.type) {
+                        case PageBatch::kPutPage:
+                            wb.Put(PageKey(op.page_id, _epoch), op.value);
+                            add_rewritten(op.page_id, &wb);
+                            break;
+                        case PageBatch::kDeletePage:
+                            wb.Put(PageKey(op.page_id, _epoch), rocksdb::Slice());
+                            add_rewritten(op.page_id, &wb);
+                            break;
+                        case PageBatch::kPutMeta:
+                            wb.Put(MetaKey(op.key), op.value);
+                            break;
+                        case PageBatch::kDeleteMeta:
+                            wb.Delete(MetaKey(op.key));
+                            break;
+                    }
+                }
+                rocksdb::WriteOptions options;
+                options.sync = sync;
+                return FromRocksDB(_db->Write(options, &wb));
+            }
+
+            uint64_t GetDurableSnapshot() override {
+                std::lock_guard<std::mutex> lck(_mutex);
+                uint64_t snapshot = _epoch;
+                std::string value;
+                PutFixed64(&value, snapshot + 1);
+                rocksdb::WriteOptions options;
+                options.sync = true;
+                rocksdb::Status s = _db->Put(options, kEpochKey, value);
+                if (!s.ok()) {
+                    LOG(FATAL) << "Fail to persist the epoch of the page store: " << s.ToString();
+                }
+                _epoch = snapshot + 1;
+                _snapshots.insert(snapshot);
+                return snapshot;
+            }
+
+            void ReleaseDurableSnapshot(uint64_t snapshot) override {
+                if (snapshot == 0) {
+                    return;
+                }
+                std::lock_guard<std::mutex> lck(_mutex);
+                _snapshots.erase(snapshot);
+                collect_garbage();
+            }
+
+        private:
+            // REQUIRES: _mutex is held
+            // The key is written again with every version, it is lost with
+            // the batch if the write fails.
+            void add_rewritten(uint64_t page_id, rocksdb::WriteBatch* wb) {
+                wb->Put(RewrittenKey(page_id), rocksdb::Slice());
+                _rewritten.insert(page_id);
+            }
+
+            // REQUIRES: _mutex is held
+            void collect_garbage() {
+                rocksdb::WriteBatch wb;
+                rocksdb::ReadOptions options;
+                options.prefix_same_as_start = true;
+                options.fill_cache = false;
+                std::unique_ptr<rocksdb::Iterator> it(_db->NewIterator(options));
+
+                for (auto page = _rewritten.begin(); page != _rewritten.end();) {
+                    const std::string prefix = PagePrefix(*page);
+                    // walk the versions newest first and the snapshots
+                    // highest first, a version is kept if it is the newest
+                    // one or the newest one not above some snapshot
+                    auto snapshot = _snapshots.rbegin();
+                    std::string oldest_kept;
+                    bool oldest_kept_deleted = false;
+                    size_t kept = 0;
+                    bool newest = true;
+                    for (it->Seek(prefix); it->Valid() && HasPrefix(it->key(), prefix); it->Next()) {
+                        if (it->key().size() != kPageKeySize) {
+                            continue;
+                        }
+                        uint64_t version = PageVersionOf(it->key());
+                        bool keep = newest;
+                        newest = false;
+                        while (snapshot != _snapshots.rend() && version <= *snapshot) {
+                            keep = true;
+                            ++snapshot;
+                        }
+                        if (keep) {
+                            kept++;
+                            oldest_kept = it->key().ToString();
+                            oldest_kept_deleted = it->value().empty();
+                        } else {
+                            wb.Delete(it->key());
+                        }
+                    }
+                    if (!it->status().ok()) {
+                        LOG(ERROR) << "Fail to scan the versions of page " << *page << ": " << it->status().ToString();
+                        return;
+                    }
+                    if (kept > 0 && oldest_kept_deleted) {
+                        // nothing older is left, reading it is the same as
+                        // finding no version
+                        wb.Delete(oldest_kept);
+                        kept--;
+                    }
+                    if (kept <= 1) {
+                        wb.Delete(RewrittenKey(*page));
+                        page = _rewritten.erase(page);
+                    } else {
+                        ++page;
+                    }
+                }
+
+                if (wb.Count() > 0) {
+                    rocksdb::Status s = _db->Write(rocksdb::WriteOptions(), &wb);
+                    if (!s.ok()) {
+                        // the versions are dropped by a later release
+                        LOG(ERROR) << "Fail to drop old page versions: " << s.ToString();
+                    }
+                }
+            }
+
+            rocksdb::DB* const _db;
+            std::mutex _mutex;
+            uint64_t _epoch;               // version of the writes, never pinned
+            std::set<uint64_t> _snapshots;  // pinned since the store was opened
+            std::set<uint64_t> _rewritten;  // pages that may have old versions
+        };
+
+        // The pages that may have old versions, from their 'r' keys.
+        rocksdb::Status LoadRewrittenPages(rocksdb::DB* db, std::set<uint64_t>* pages) {
+            rocksdb::ReadOptions options;
+            options.total_order_seek = true;
+            options.fill_cache = false;
+            std::unique_ptr<rocksdb::Iterator> it(db->NewIterator(options));
+            const std::string tag(1, kRewrittenTag);
+            for (it->Seek(tag); it->Valid() && HasPrefix(it->key(), tag); it->Next()) {
+                if (it->key().size() == 1 + 8) {
+                    pages->insert(DecodeBigEndian64(it->key().data() + 1));
+                }
+            }
+            return it->status();
+        }
+
+        // Put in wb the deletes of the versions written in epoch, only the
+        // rewritten pages can have them.
+        rocksdb::Status DeleteVersionsOf(rocksdb::DB* db, const std::set<uint64_t>& pages,
+                                         uint64_t epoch, rocksdb::WriteBatch* wb) {
+            rocksdb::ReadOptions options;
+            options.prefix_same_as_start = true;
+            options.fill_cache = false;
+            std::unique_ptr<rocksdb::Iterator> it(db->NewIterator(options));
+            for (uint64_t page_id : pages) {
+                const std::string key = PageKey(page_id, epoch);
+                it->Seek(key);
+                if (it->Valid() && it->key().size() == key.size() && HasPrefix(it->key(), key)) {
+                    wb->Delete(key);
+                }
+            }
+            return it->status();
+        }
+
+        rocksdb::Options RocksDBOptions(const Options& options) {
+            rocksdb::Options rocks_options;
+            rocks_options.create_if_missing = options.create_if_missing;
+            rocks_options.error_if_exists = options.error_if_exists;
+            switch (options.rocksdb_compression) {
+                case kSnappyCompression:
+                    rocks_options.compression = rocksdb::kSnappyCompression;
+                    break;
+                default:
+                    rocks_options.compression = rocksdb::kNoCompression;
+                    break;
+            }
+            // the pages are looked up by seeking inside the versions of one
+            // page id, so the bloom filters are built on the prefix
+            rocks_options.prefix_extractor.reset(rocksdb::NewFixedPrefixTransform(kPagePrefixSize));
+
+            rocksdb::BlockBasedTableOptions table_options;
+            if (options.rocksdb_block_cache_size > 0) {
+                table_options.block_cache = rocksdb::NewLRUCache(options.rocksdb_block_cache_size);
+            } else {
+                table_options.no_block_cache = true;
+            }
+            if (options.rocksdb_bloom_bits_per_key > 0) {
+                table_options.filter_policy.reset(rocksdb::NewBloomFilterPolicy(options.rocksdb_bloom_bits_per_key));
+            }
+            table_options.whole_key_filtering = false;
+            rocks_options.table_factory.reset(rocksdb::NewBlockBasedTableFactory(table_options));
+            return rocks_options;
+        }
+    }
+
+    Status OpenRocksDBPageStore(const Options& options, const std::string& name, PageStore** result) {
+        rocksdb::DB* db = nullptr;
+        rocksdb::Status s = rocksdb::DB::Open(RocksDBOptions(options), name, &db);
+        if (!s.ok()) {
+            LOG(ERROR) << "Fail to open internal rocksdb: " << s.ToString();
+            return FromRocksDB(s);
+        }
+
+        uint64_t epoch = 1;
+        std::string value;
+        s = db->Get(rocksdb::ReadOptions(), kEpochKey, &value);
+        if (s.ok() && value.size() == 8) {
+            epoch = DecodeFixed64(value.c_str());
+        } else if (s.ok() || !s.IsNotFound()) {
+            LOG(ERROR) << "Fail to read the epoch of the page store: " << s.ToString();
+            delete db;
+            return s.ok() ? Status::Corruption("bad epoch of the page store") : FromRocksDB(s);
+        }
+
+        // nothing pins the versions of the current epoch
+        rocksdb::WriteBatch wb;
+        std::set<uint64_t> rewritten;
+        s = LoadRewrittenPages(db, &rewritten);
+        if (s.ok()) {
+            s = DeleteVersionsOf(db, rewritten, epoch, &wb);
+        }
+        if (!s.ok()) {
+            LOG(ERROR) << "Fail to find the rewritten pages of the page store: " << s.ToString();
+            delete db;
+            return FromRocksDB(s);
+        }
+
+        // the writes go on in a new epoch
+        epoch++;
+        value.clear();
+        PutFixed64(&value, epoch);
+        wb.Put(kEpochKey, value);
+        rocksdb::WriteOptions sync_options;
+        sync_options.sync = true;
+        s = db->Write(sync_options, &wb);
+        if (!s.ok()) {
+            LOG(ERROR) << "Fail to start a new epoch of the page store: " << s.ToString();
+            delete db;
+            return FromRocksDB(s);
+        }
+
+        *result = new RocksDBPageStore(db, epoch, std::move(rewritten));
+        return Status::OK();
+    }
+
+    Status DestroyRocksDBPageStore(const std::string& name) {
+        return FromRocksDB(rocksdb::DestroyDB(name, rocksdb::Options()));
+    }
+}
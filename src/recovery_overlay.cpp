@@ -0,0 +1,109 @@
+#include "recovery_overlay.h"
+
+#include "bpt.h"
+
+namespace cowbpt {
+
+    // only used before the db is opened, no lock is needed
+    class RecoveryOverlay::Indexer : public WriteBatch::Handler {
+    public:
+        explicit Indexer(RecoveryOverlay* overlay) : _overlay(overlay) {}
+
+        void Put(const Slice& key, const Slice& value) override {
+            _overlay->_entries[key] = Entry{value, false};
+        }
+        void Delete(const Slice& key) override {
+            _overlay->_entries[key] = Entry{Slice(), true};
+        }
+
+    private:
+        RecoveryOverlay* _overlay;
+    };
+
+    class RecoveryOverlay::Writer : public WriteBatch::Handler {
+    public:
+        Writer(RecoveryOverlay* overlay, Bpt* bpt) : _overlay(overlay), _bpt(bpt) {}
+
+        // erase the key and write the tree in one step, so that a reader
+        // never sees the old value of the log after the new write
+        void Put(const Slice& key, const Slice& value) override {
+            std::lock_guard<std::mutex> lck(_overlay->_mutex);
+            _overlay->_entries.erase(key);
+            update(_bpt->put(key, value));
+        }
+        void Delete(const Slice& key) override {
+            std::lock_guard<std::mutex> lck(_overlay->_mutex);
+            _overlay->_entries.erase(key);
+            update(_bpt->erase(key));
+        }
+
+        // the first page that could not be read back
+        Status status() const { return _status; }
+
+    private:
+        void update(const Status& s) {
+            if (_status.ok() && !s.ok()) {
+                _status = s;
+            }
+        }
+
+        RecoveryOverlay* _overlay;
+        Bpt* _bpt;
+        Status _status;
+    };
+
+    RecoveryOverlay::RecoveryOverlay(const Comparator* cmp)
+    : _entries(KeyLess{cmp}) {}
+
+    Status RecoveryOverlay::Add(const WriteBatch* batch) {
+        Indexer indexer(this);
+        return batch->Iterate(&indexer);
+    }
+
+    bool RecoveryOverlay::Get(const Slice& key, Slice* value, bool* deleted) {
+        std::lock_guard<std::mutex> lck(_mutex);
+        auto it = _entries.find(key);
+        if (it == _entries.end()) {
+            return false;
+        }
+        *deleted = it->second.deleted;
+        *value = it->second.value;
+        return true;
+    }
+
+    Status RecoveryOverlay::Apply(const WriteBatch* batch, Bpt* bpt) {
+        Writer writer(this, bpt);
+        Status s = batch->Iterate(&writer);
+        return s.ok() ? writer.status() : s;
+    }
+
+    Status RecoveryOverlay::Fold(Bpt* bpt, size_t n, bool* done) {
+        *done = false;
+        for (size_t i = 0; i < n; i++) {
+            // the tree is written under the lock, like Writer does, and the
+            // readers and writers get it back between the operations
+            std::lock_guard<std::mutex> lck(_mutex);
+            // in key order, consecutive operations mostly land in the same leaf
+            auto it = _entries.begin();
+            if (it == _entries.end()) {
+                break;
+            }
+            Status s = it->second.deleted ? bpt->erase(it->first)
+                                          : bpt->put(it->first, it->second.value);
+            if (!s.ok()) {
+                // the log is needed until the operation is in the tree
+                LOG(ERROR) << "Fail to fold " << it->first.string() << " into the tree: " << s.string();
+                return s;
+            }
+            _entries.erase(it);
+        }
+        std::lock_guard<std::mutex> lck(_mutex);
+        *done = _entries.empty();
+        return Status::OK();
+    }
+
+    size_t RecoveryOverlay::Size() {
+        std::lock_guard<std::mutex> lck(_mutex);
+        return _entries.size();
+    }
+}
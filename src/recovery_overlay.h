@@ -0,0 +1,68 @@
+#ifndef RECOVERY_OVERLAY_H
+#define RECOVERY_OVERLAY_H
+
+#include <map>
+#include <mutex>
+
+#include "comparator.h"
+#include "slice.h"
+#include "status.h"
+#include "write_batch.h"
+
+namespace cowbpt {
+
+    class Bpt;
+
+    // The operations of the write ahead log that have not been applied to
+    // the tree yet, so that the db can be opened before the log is replayed.
+    //
+    // Only the last operation of every key is kept.  Reads look here before
+    // the tree, and a background thread folds the operations into the tree
+    // with Fold().  New writes go through Apply(), which drops the key from
+    // the overlay when it writes the tree, so an older operation of the log
+    // is never folded over a newer write.
+    class RecoveryOverlay {
+    public:
+        explicit RecoveryOverlay(const Comparator* cmp);
+
+        RecoveryOverlay(const RecoveryOverlay&) = delete;
+        RecoveryOverlay& operator=(const RecoveryOverlay&) = delete;
+
+        // Add the operations of a batch read from the log, batches have to be
+        // added in log order.
+        Status Add(const WriteBatch* batch);
+
+        // Return true if the overlay has an operation on key.  *deleted is set
+        // if it is a deletion, else *value is set to the value.
+        bool Get(const Slice& key, Slice* value, bool* deleted);
+
+        // Apply a new batch to the tree.
+        Status Apply(const WriteBatch* batch, Bpt* bpt);
+
+        // Move at most n operations into the tree, one per lock of the
+        // overlay.  *done is set if the overlay is empty.  An operation the
+        // tree fails to take is kept, and its error returned.
+        Status Fold(Bpt* bpt, size_t n, bool* done);
+
+        size_t Size();
+
+    private:
+        struct Entry {
+            Slice value;
+            bool deleted;
+        };
+
+        struct KeyLess {
+            const Comparator* cmp;
+            bool operator()(const Slice& a, const Slice& b) const { return (*cmp)(a, b); }
+        };
+
+        class Indexer;
+        class Writer;
+
+        std::mutex _mutex;
+        std::map<Slice, Entry, KeyLess> _entries;
+    };
+}
+
+#endif
@@ -0,0 +1,180 @@
+#include "replay.h"
+
+#include <algorithm>
+
+#include "bpt.h"
+#include "comparator.h"
+#include "write_batch_internal.h"
+
+namespace cowbpt {
+
+    namespace {
+        // batches read ahead of the decoder
+        const size_t kMaxQueuedBatches = 1024;
+        // operations handed to an applier at once
+        const size_t kChunkOps = 4096;
+        // chunks queued for every applier
+        const size_t kMaxQueuedChunks = 16;
+        // operations looked at to pick the key ranges of the appliers
+        const size_t kSampleOps = 64 * 1024;
+    }
+
+    class LogReplayer::Router : public WriteBatch::Handler {
+    public:
+        explicit Router(LogReplayer* replayer) : _replayer(replayer) {}
+
+        void Put(const Slice& key, const Slice& value) override {
+            _replayer->route(Op{key, value, false});
+        }
+        void Delete(const Slice& key) override {
+            _replayer->route(Op{key, Slice(), true});
+        }
+
+    private:
+        LogReplayer* _replayer;
+    };
+
+    LogReplayer::LogReplayer(Bpt* bpt, const Comparator* cmp, int threads, bool sorted_apply)
+    : _bpt(bpt),
+      _cmp(cmp),
+      _sorted_apply(sorted_apply),
+      _finished(false),
+      _batches(kMaxQueuedBatches),
+      _bounds_picked(false),
+      _pending(std::max(threads, 1)) {
+        for (size_t i = 0; i < _pending.size(); i++) {
+            _chunks.emplace_back(new BoundedQueue<Chunk>(kMaxQueuedChunks));
+        }
+        for (size_t i = 0; i < _pending.size(); i++) {
+            _appliers.push_back(std::thread(&LogReplayer::apply_loop, this, _chunks[i].get()));
+        }
+        _decoder = std::thread(&LogReplayer::decode_loop, this);
+    }
+
+    LogReplayer::~LogReplayer() {
+        assert(_finished);
+    }
+
+    void LogReplayer::Add(std::unique_ptr<WriteBatch> batch) {
+        assert(!_finished);
+        _batches.Push(std::move(batch));
+    }
+
+    Status LogReplayer::Finish() {
+        assert(!_finished);
+        _finished = true;
+        _batches.Close();
+        _decoder.join();
+        for (auto& t : _appliers) {
+            t.join();
+        }
+        return _status.ok() ? _apply_status : _status;
+    }
+
+    void LogReplayer::decode_loop() {
+        std::unique_ptr<WriteBatch> batch;
+        Router router(this);
+        while (_batches.Pop(&batch)) {
+            if (!_status.ok()) {
+                // keep draining so that Add() never blocks forever
+                continue;
+            }
+            Status s = batch->Iterate(&router);
+            if (!s.ok()) {
+                LOG(ERROR) << "Fail to decode a batch when recovering : " << s.string();
+                _status = s;
+            }
+        }
+
+        if (!_bounds_picked) {
+            // the whole log is shorter than the sample
+            pick_bounds();
+        }
+        for (size_t i = 0; i < _pending.size(); i++) {
+            if (!_pending[i].empty()) {
+                _chunks[i]->Push(std::move(_pending[i]));
+            }
+            _chunks[i]->Close();
+        }
+    }
+
+    void LogReplayer::apply_loop(BoundedQueue<Chunk>* queue) {
+        Chunk chunk;
+        while (queue->Pop(&chunk)) {
+            if (_sorted_apply) {
+                // stable, so the operations on the same key keep the log order
+                const Comparator* cmp = _cmp;
+                std::stable_sort(chunk.begin(), chunk.end(), [cmp](const Op& a, const Op& b) {
+                    return (*cmp)(a.key, b.key);
+                });
+            }
+            for (auto& op : chunk) {
+                Status s = op.is_delete ? _bpt->erase(op.key) : _bpt->put(op.key, op.value);
+                if (!s.ok()) {
+                    std::lock_guard<std::mutex> lck(_apply_mutex);
+                    if (_apply_status.ok()) {
+                        LOG(ERROR) << "Fail to apply the log when recovering : " << s.string();
+                        _apply_status = s;
+                    }
+                }
+            }
+            chunk.clear();
+        }
+    }
+
+    void LogReplayer::route(Op&& op) {
+        if (_bounds_picked) {
+            dispatch(std::move(op));
+            return;
+        }
+        _sample.push_back(std::move(op));
+        if (_sample.size() >= kSampleOps) {
+            pick_bounds();
+        }
+    }
+
+    void LogReplayer::pick_bounds() {
+        assert(!_bounds_picked);
+        const size_t n = _pending.size();
+        if (n > 1 && !_sample.empty()) {
+            std::vector<Slice> keys;
+            keys.reserve(_sample.size());
+            for (auto& op : _sample) {
+                keys.push_back(op.key);
+            }
+            const Comparator* cmp = _cmp;
+            auto less = [cmp](const Slice& a, const Slice& b) { return (*cmp)(a, b); };
+            std::sort(keys.begin(), keys.end(), less);
+            for (size_t i = 1; i < n; i++) {
+                const Slice& bound = keys[i * keys.size() / n];
+                if (_bounds.empty() || less(_bounds.back(), bound)) {
+                    _bounds.push_back(bound);
+                }
+            }
+        }
+        _bounds_picked = true;
+
+        Chunk sample;
+        sample.swap(_sample);
+        for (auto& op : sample) {
+            dispatch(std::move(op));
+        }
+    }
+
+    void LogReplayer::dispatch(Op&& op) {
+        size_t i = partition(op.key);
+        _pending[i].push_back(std::move(op));
+        if (_pending[i].size() >= kChunkOps) {
+            _chunks[i]->Push(std::move(_pending[i]));
+            _pending[i] = Chunk();
+            _pending[i].reserve(kChunkOps);
+        }
+    }
+
+    size_t LogReplayer::partition(const Slice& key) const {
+        const Comparator* cmp = _cmp;
+        return std::upper_bound(_bounds.begin(), _bounds.end(), key,
+                                [cmp](const Slice& a, const Slice& b) { return (*cmp)(a, b); })
+               - _bounds.begin();
+    }
+}
@@ -0,0 +1,135 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "slice.h"
+#include "status.h"
+#include "write_batch.h"
+
+namespace cowbpt {
+
+    class Bpt;
+    class Comparator;
+
+    // Replays the write ahead log into a Bpt with several threads.
+    //
+    // The recovering thread reads and checks the records and hands them over
+    // with Add().  A decoder thread splits every batch into its operations and
+    // routes each one to the applier thread that owns the key's range, and the
+    // appliers put them into the tree.  A key always goes to the same applier
+    // and is queued in log order, so the final value of every key is the same
+    // as after a serial replay.
+    //
+    // The key ranges are picked from the first operations of the log, so that
+    // the appliers mostly work on different subtrees.
+    class LogReplayer {
+    public:
+        // threads: the number of applier threads, at least 1
+        // sorted_apply: apply every chunk of operations in key order, so that
+        //               consecutive operations mostly land in the same leaf
+        LogReplayer(Bpt* bpt, const Comparator* cmp, int threads, bool sorted_apply);
+
+        LogReplayer(const LogReplayer&) = delete;
+        LogReplayer& operator=(const LogReplayer&) = delete;
+
+        // REQUIRES: Finish() has been called
+        ~LogReplayer();
+
+        // Queue a batch read from the log, batches have to be added in log
+        // order.  Blocks while the pipeline is full.
+        void Add(std::unique_ptr<WriteBatch> batch);
+
+        // Wait until every queued batch has been applied and stop the threads.
+        // Return the first error met while decoding the batches.
+        Status Finish();
+
+    private:
+        struct Op {
+            Slice key;
+            Slice value;
+            bool is_delete;
+        };
+        typedef std::vector<Op> Chunk;
+
+        // A blocking single producer single consumer queue with a bounded size
+        template <typename T>
+        class BoundedQueue {
+        public:
+            explicit BoundedQueue(size_t capacity) : _capacity(capacity), _closed(false) {}
+
+            void Push(T&& item) {
+                std::unique_lock<std::mutex> lck(_mutex);
+                _not_full.wait(lck, [this]() { return _items.size() < _capacity; });
+                _items.push_back(std::move(item));
+                _not_empty.notify_one();
+            }
+
+            // return false if the queue is closed and drained
+            bool Pop(T* item) {
+                std::unique_lock<std::mutex> lck(_mutex);
+                _not_empty.wait(lck, [this]() { return !_items.empty() || _closed; });
+                if (_items.empty()) {
+                    return false;
+                }
+                *item = std::move(_items.front());
+                _items.pop_front();
+                _not_full.notify_one();
+                return true;
+            }
+
+            void Close() {
+                std::lock_guard<std::mutex> lck(_mutex);
+                _closed = true;
+                _not_empty.notify_all();
+            }
+
+        private:
+            const size_t _capacity;
+            std::mutex _mutex;
+            std::condition_variable _not_empty;
+            std::condition_variable _not_full;
+            std::deque<T> _items;
+            bool _closed;
+        };
+
+        class Router;
+
+        void decode_loop();
+        void apply_loop(BoundedQueue<Chunk>* queue);
+
+        // called by the decoder thread
+        void route(Op&& op);
+        void pick_bounds();
+        void dispatch(Op&& op);
+        size_t partition(const Slice& key) const;
+
+        Bpt* const _bpt;
+        const Comparator* const _cmp;
+        const bool _sorted_apply;
+        bool _finished;
+
+        BoundedQueue<std::unique_ptr<WriteBatch>> _batches;
+        std::vector<std::unique_ptr<BoundedQueue<Chunk>>> _chunks;  // one per applier
+
+        // only accessed by the decoder thread
+        Chunk _sample;  // operations seen before the bounds are picked
+        std::vector<Slice> _bounds;  // applier i owns [_bounds[i-1], _bounds[i])
+        bool _bounds_picked;
+        std::vector<Chunk> _pending;  // chunks being filled, one per applier
+        Status _status;
+
+        std::mutex _apply_mutex;
+        Status _apply_status;  // the first operation the appliers could not apply
+
+        std::thread _decoder;
+        std::vector<std::thread> _appliers;
+    };
+}
+
+#endif
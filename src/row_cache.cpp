@@ -0,0 +1,98 @@
+#include "row_cache.h"
+
+#include <iterator>
+
+#include "hash.h"
+
+namespace cowbpt {
+
+    size_t RowCache::SliceHash::operator()(const Slice& s) const {
+        return Hash(s.c_string(), s.size(), 0);
+    }
+
+    RowCache::RowCache(size_t capacity) : _capacity(capacity) {
+        const size_t per_shard = (capacity + (kNumShards - 1)) / kNumShards;
+        for (int i = 0; i < kNumShards; i++) {
+            _shards[i].capacity = per_shard;
+        }
+    }
+
+    RowCache::Shard& RowCache::shard_of(const Slice& key) {
+        // the table of the shard uses the low bits
+        uint32_t hash = Hash(key.c_string(), key.size(), 0);
+        return _shards[hash >> (32 - kNumShardBits)];
+    }
+
+    void RowCache::remove(Shard& shard, std::list<Entry>::iterator it) {
+        shard.usage -= it->key.size() + it->value.size();
+        shard.table.erase(it->key);
+        shard.lru.erase(it);
+    }
+
+    bool RowCache::Lookup(const Slice& key, Slice* value, uint64_t* ticket) {
+        Shard& shard = shard_of(key);
+        std::lock_guard<std::mutex> lck(shard.mutex);
+        auto found = shard.table.find(key);
+        if (found == shard.table.end()) {
+            shard.misses++;
+            *ticket = shard.erases;
+            return false;
+        }
+        shard.hits++;
+        shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+        *value = found->second->value;
+        return true;
+    }
+
+    void RowCache::Insert(const Slice& key, const Slice& value, uint64_t ticket) {
+        const size_t charge = key.size() + value.size();
+        Shard& shard = shard_of(key);
+        std::lock_guard<std::mutex> lck(shard.mutex);
+        if (shard.erases != ticket || charge > shard.capacity) {
+            return;
+        }
+        auto found = shard.table.find(key);
+        if (found != shard.table.end()) {
+            // read by another Get at the same time
+            remove(shard, found->second);
+        }
+        while (shard.usage + charge > shard.capacity) {
+            remove(shard, std::prev(shard.lru.end()));
+            shard.evictions++;
+        }
+        // the key and the value may share their bytes with a bigger buffer,
+        // a page or a write batch, copy them so that the charge is all the
+        // entry keeps alive
+        Entry entry;
+        Slice::CopyPair(key, value, &entry.key, &entry.value);
+        shard.lru.push_front(std::move(entry));
+        shard.table.emplace(shard.lru.front().key, shard.lru.begin());
+        shard.usage += charge;
+        shard.inserts++;
+    }
+
+    void RowCache::Erase(const Slice& key) {
+        Shard& shard = shard_of(key);
+        std::lock_guard<std::mutex> lck(shard.mutex);
+        shard.erases++;
+        auto found = shard.table.find(key);
+        if (found != shard.table.end()) {
+            remove(shard, found->second);
+        }
+    }
+
+    RowCache::Stats RowCache::GetStats() {
+        Stats stats;
+        for (int i = 0; i < kNumShards; i++) {
+            Shard& shard = _shards[i];
+            std::lock_guard<std::mutex> lck(shard.mutex);
+            stats.hits += shard.hits;
+            stats.misses += shard.misses;
+            stats.inserts += shard.inserts;
+            stats.evictions += shard.evictions;
+            stats.entries += shard.table.size();
+            stats.usage += shard.usage;
+        }
+        return stats;
+    }
+}
@@ -0,0 +1,93 @@
+#ifndef ROW_CACHE_H
+#define ROW_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "slice.h"
+
+namespace cowbpt {
+
+    // Caches the values of the keys read by DB::Get, so that reading a hot
+    // key again is a hash lookup instead of a walk down the tree.  Each key
+    // is copied together with its value into one allocation, so the cache
+    // does not pin the page or write batch the value came from.  The least
+    // recently used keys are dropped when the keys and values take more
+    // than capacity bytes.
+    //
+    // The keys are split into shards by hash, each with its own lock and
+    // its share of the capacity.  Safe for concurrent use.
+    class RowCache {
+    public:
+        explicit RowCache(size_t capacity);
+
+        RowCache(const RowCache&) = delete;
+        RowCache& operator=(const RowCache&) = delete;
+
+        // Return true and set *value if key is cached.  Otherwise set
+        // *ticket to what the Insert() of the value read from the tree
+        // has to pass.
+        bool Lookup(const Slice& key, Slice* value, uint64_t* ticket);
+
+        // Cache the value of key read from the tree after a Lookup() that
+        // returned ticket.  Nothing is cached if a key of the same shard
+        // was erased since, the value may be older than the write.
+        void Insert(const Slice& key, const Slice& value, uint64_t ticket);
+
+        // Drop key, called once a write of key is in the tree
+        void Erase(const Slice& key);
+
+        struct Stats {
+            uint64_t hits = 0;
+            uint64_t misses = 0;
+            uint64_t inserts = 0;
+            uint64_t evictions = 0;
+            size_t entries = 0;
+            size_t usage = 0;    // bytes of the cached keys and values
+        };
+        Stats GetStats();
+
+        size_t capacity() const { return _capacity; }
+
+    private:
+        static const int kNumShardBits = 4;
+        static const int kNumShards = 1 << kNumShardBits;
+
+        struct SliceHash {
+            size_t operator()(const Slice& s) const;
+        };
+
+        struct Entry {
+            Slice key;
+            Slice value;
+        };
+
+        struct Shard {
+            std::mutex mutex;
+            size_t capacity = 0;
+            size_t usage = 0;
+            // most recently used first
+            std::list<Entry> lru;
+            std::unordered_map<Slice, std::list<Entry>::iterator, SliceHash> table;
+            // bumped by every Erase(), see Insert()
+            uint64_t erases = 0;
+            uint64_t hits = 0;
+            uint64_t misses = 0;
+            uint64_t inserts = 0;
+            uint64_t evictions = 0;
+        };
+
+        Shard& shard_of(const Slice& key);
+        // REQUIRES: shard.mutex is held
+        static void remove(Shard& shard, std::list<Entry>::iterator it);
+
+        const size_t _capacity;
+        Shard _shards[kNumShards];
+    };
+}
+
+#endif
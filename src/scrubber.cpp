@@ -0,0 +1,103 @@
+#include "scrubber.h"
+
+#include <algorithm>
+
+#include "coding.h"
+#include "filename.h"
+#include "glog/logging.h"
+#include "page_format.h"
+
+namespace cowbpt {
+
+    PageScrubber::PageScrubber(PageStore* page_store, size_t pages_per_sec)
+    : _page_store(page_store),
+      _interval(1000000 / std::max<size_t>(pages_per_sec, 1)),
+      _stopped(false),
+      _scrubbed(0),
+      _damaged(0),
+      _passes(0) {}
+
+    PageScrubber::~PageScrubber() {
+        Stop();
+    }
+
+    void PageScrubber::Start() {
+        assert(!_thread.joinable());
+        _next_due = std::chrono::steady_clock::now();
+        _thread = std::thread(&PageScrubber::run, this);
+    }
+
+    void PageScrubber::Stop() {
+        {
+            std::lock_guard<std::mutex> lck(_mutex);
+            _stopped = true;
+            _cv.notify_all();
+        }
+        if (_thread.joinable()) {
+            _thread.join();
+        }
+    }
+
+    void PageScrubber::run() {
+        while (throttle()) {
+            // written together by a checkpoint, a checkpoint in between
+            // makes the walk start again
+            std::string value;
+            uint64_t snapshot = 0;
+            uint64_t root_page_id = 0;
+            if (_page_store->GetMeta(LastCheckpointSnapshotSeqKey(), &value).ok()) {
+                snapshot = DecodeFixed64(value.c_str());
+            }
+            value.clear();
+            if (_page_store->GetMeta(RootPageIDKey(), &value).ok()) {
+                root_page_id = DecodeFixed64(value.c_str());
+            }
+            if (snapshot == 0 || value.empty()) {
+                // no checkpoint yet
+                continue;
+            }
+            if (scrub(snapshot, root_page_id)) {
+                _passes.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool PageScrubber::scrub(uint64_t snapshot, uint64_t root_page_id) {
+        std::vector<uint64_t> pending = {root_page_id};
+        std::string page;
+        while (!pending.empty()) {
+            uint64_t page_id = pending.back();
+            pending.pop_back();
+            if (!throttle()) {
+                return false;
+            }
+            page.clear();
+            Status s = _page_store->GetPage(page_id, snapshot, &page);
+            if (s.IsNotFound()) {
+                return false;
+            } else if (!s.ok()) {
+                LOG(ERROR) << "Fail to scrub page " << page_id << ": " << s.string();
+                return false;
+            }
+            _scrubbed.fetch_add(1, std::memory_order_relaxed);
+            uint32_t flags;
+            s = UnsealPage(page_id, true /* verify_checksum */, &page, &flags);
+            if (s.ok() && (flags & kInternalPage) != 0) {
+                s = GetChildPageIDs(page_id, page, &pending);
+            }
+            if (!s.ok()) {
+                _damaged.fetch_add(1, std::memory_order_relaxed);
+                LOG(ERROR) << "Scrubber found a damaged page at snapshot " << snapshot << ": " << s.string();
+            }
+        }
+        return true;
+    }
+
+    bool PageScrubber::throttle() {
+        std::unique_lock<std::mutex> lck(_mutex);
+        // do not make up for the time spent reading or between walks
+        _next_due = std::max(_next_due + _interval, std::chrono::steady_clock::now());
+        _cv.wait_until(lck, _next_due, [this]() { return _stopped; });
+        return !_stopped;
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef SCRUBBER_H
+#define SCRUBBER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "page_store.h"
+
+namespace cowbpt {
+
+    // Reads the pages of the last checkpoint back in the background and
+    // verifies their checksums, so that a damaged page is found before a
+    // request needs it.  The tree is walked again and again from the root
+    // page, at most pages_per_sec pages a second.  A walk that finds a page
+    // gone, because a newer checkpoint dropped it, starts again from the
+    // newer checkpoint.
+    class PageScrubber {
+    public:
+        // pages_per_sec: the most pages read per second, at least 1
+        PageScrubber(PageStore* page_store, size_t pages_per_sec);
+
+        PageScrubber(const PageScrubber&) = delete;
+        PageScrubber& operator=(const PageScrubber&) = delete;
+
+        // Stop()
+        ~PageScrubber();
+
+        void Start();
+
+        // Stop reading pages and wait for the thread.
+        void Stop();
+
+        size_t scrubbed_pages() const { return _scrubbed.load(std::memory_order_relaxed); }
+        size_t damaged_pages() const { return _damaged.load(std::memory_order_relaxed); }
+        // walks of a whole checkpoint
+        size_t passes() const { return _passes.load(std::memory_order_relaxed); }
+
+    private:
+        void run();
+        // return false if the walk has to start again
+        bool scrub(uint64_t snapshot, uint64_t root_page_id);
+        // return false if stopped
+        bool throttle();
+
+        PageStore* const _page_store;
+        const std::chrono::microseconds _interval;
+        std::chrono::steady_clock::time_point _next_due;
+
+        std::thread _thread;
+        std::mutex _mutex;
+        std::condition_variable _cv;
+        bool _stopped;
+
+        std::atomic<size_t> _scrubbed;
+        std::atomic<size_t> _damaged;
+        std::atomic<size_t> _passes;
+    };
+}
+
+#endif
@@ -1,6 +1,8 @@
+#include <atomic>
 #include <string>
-#include <memory>
+#include <new>
 #include <cassert>
+#include <cstdint>
 #include <cstring>
 
 
@@ -10,69 +12,250 @@
 #define EMPTYSLICE Slice()
 
 namespace cowbpt {
+    class Slice;
+
+    // A pointer and a length, that does not own the bytes it points to.
+    // For the keys and values only looked at for a moment, e.g. compared
+    // or decoded, that don't have to be kept.  The bytes have to outlive
+    // the view.
+    class SliceView {
+    public:
+        SliceView() : _data(""), _len(0) {}
+        SliceView(const char* data, size_t n) : _data(data), _len(n) {}
+        SliceView(const char* c_string) : _data(c_string), _len(strlen(c_string)) {}
+        SliceView(const std::string& s) : _data(s.data()), _len(s.size()) {}
+        inline SliceView(const Slice& s);
+
+        const char* data() const { return _data; }
+
+        size_t size() const { return _len; }
+
+        bool empty() const { return _len == 0; }
+
+        std::string string() const { return std::string(_data, _len); }
+
+        char operator[](size_t n) const {
+            assert(n < _len);
+            return _data[n];
+        }
+
+        void remove_prefix(size_t n) {
+            assert(n <= _len);
+            _data += n;
+            _len -= n;
+        }
+
+        // <0 if *this < b, 0 if they are equal, >0 if *this > b, bytes are
+        // compared as unsigned chars
+        int compare(const SliceView& b) const {
+            const size_t min_len = (_len < b._len) ? _len : b._len;
+            int r = memcmp(_data, b._data, min_len);
+            if (r == 0) {
+                if (_len < b._len) {
+                    r = -1;
+                } else if (_len > b._len) {
+                    r = +1;
+                }
+            }
+            return r;
+        }
+
+        // Return true iff "x" is a prefix of "*this"
+        bool starts_with(const SliceView& x) const {
+            return ((_len >= x._len) && (memcmp(_data, x._data, x._len) == 0));
+        }
+
+    private:
+        const char* _data;
+        size_t _len;
+    };
+
+    // Bytes that are shared by the Slices copied from each other, and freed
+    // with the last of them.  Slices can be copied between threads.
+    //
+    // The bytes are allocated once with their reference count.  A Slice
+    // built from a pointer or a string copies the bytes, a Slice of the
+    // bytes of another one shares them, e.g. the keys and values of a
+    // page read back share the page.  An empty Slice allocates nothing.
     class Slice {
     public:
-        Slice(const Slice& s) = default;
-        Slice(Slice&& s) = default;
-        Slice& operator = (const Slice& s) = default;
-        Slice& operator = (Slice&& s) = default;
+        Slice(const Slice& s) : _rep(s._rep), _data(s._data), _len(s._len) {
+            ref();
+        }
+        Slice(Slice&& s) noexcept : _rep(s._rep), _data(s._data), _len(s._len) {
+            s.reset();
+        }
+        Slice& operator = (const Slice& s) {
+            if (this != &s) {
+                s.ref();
+                unref();
+                _rep = s._rep;
+                _data = s._data;
+                _len = s._len;
+            }
+            return *this;
+        }
+        Slice& operator = (Slice&& s) noexcept {
+            if (this != &s) {
+                unref();
+                _rep = s._rep;
+                _data = s._data;
+                _len = s._len;
+                s.reset();
+            }
+            return *this;
+        }
+
+        ~Slice() {
+            unref();
+        }
 
-        Slice(const char* c_string) : _s(std::make_shared<const std::string>(c_string)), _pos(0), _len(_s->size()) {};
-        Slice(const char* c_string, size_t n) : _s(std::make_shared<const std::string>(c_string, n)), _pos(0), _len(_s->size()) {};
+        Slice(const char* c_string) { init(c_string, strlen(c_string)); }
+        Slice(const char* c_string, size_t n) { init(c_string, n); }
 
-        Slice(std::string&& s): _s(std::make_shared<const std::string>(std::move(s))), _pos(0), _len(_s->size()) {};
-        Slice(const std::string& s): _s(std::make_shared<const std::string>(s)), _pos(0), _len(_s->size()) {};
+        // s is left empty
+        Slice(std::string&& s) {
+            init(s.data(), s.size());
+            std::string().swap(s);
+        }
+        Slice(const std::string& s) { init(s.data(), s.size()); }
+
+        explicit Slice(const SliceView& v) { init(v.data(), v.size()); }
+
+        Slice() : _rep(nullptr), _data(""), _len(0) {} // empty slice
+
+        Slice(const Slice& s, size_t len) : _rep(s._rep), _data(s._data), _len(len) {
+            assert(len <= s.size());
+            ref();
+        }
 
-        Slice() : _s(std::make_shared<const std::string>()), _pos(0), _len(_s->size()) {}; // empty slice
+        // Copy a and b next to each other in one allocation, *ra and *rb
+        // share it
+        static void CopyPair(const SliceView& a, const SliceView& b, Slice* ra, Slice* rb) {
+            Slice both;
+            both.init(nullptr, a.size() + b.size());
+            char* data = const_cast<char*>(both._data);
+            memcpy(data, a.data(), a.size());
+            memcpy(data + a.size(), b.data(), b.size());
+            *rb = both;
+            rb->remove_prefix(a.size());
+            *ra = std::move(both);
+            ra->_len = a.size();
+        }
 
-        Slice(const Slice& s, size_t len) : _s(s._s), _pos(s._pos), _len(len) { assert(len <= s.size()); }
+        // a followed by b, in one allocation
+        static Slice Concat(const SliceView& a, const SliceView& b) {
+            Slice s;
+            s.init(nullptr, a.size() + b.size());
+            char* data = const_cast<char*>(s._data);
+            memcpy(data, a.data(), a.size());
+            memcpy(data + a.size(), b.data(), b.size());
+            return s;
+        }
 
-        bool empty() const { 
-            return _len == 0; 
+        bool empty() const {
+            return _len == 0;
         }
 
         const std::string string() const {
-            return std::string(_s->begin()+_pos, _s->begin()+_pos+_len);
+            return std::string(_data, _len);
         }
 
         size_t size() const {
             return _len;
         }
-        
+
         // dangerous api, the Slice instance calling this function, must out lives the returnd char* value
         // use this api very calfully
         const char* c_string() const {
-            return _s->c_str() + _pos; 
+            return _data;
         }
 
         void remove_prefix(size_t n) {
             assert(n <= _len);
-            _pos += n;
+            _data += n;
             _len -= n;
         }
-        
+
         void clear() {
-            _s.reset(new std::string());
-            _pos = 0;
-            _len = 0;
+            unref();
+            reset();
         }
-        
+
         char operator[](size_t n) const {
             assert(n < _len);
-            return _s->c_str()[n + _pos];
+            return _data[n];
+        }
+
+        int compare(const Slice& b) const {
+            return SliceView(*this).compare(SliceView(b));
         }
-        
+
         // Return true iff "x" is a prefix of "*this"
         bool starts_with(const Slice& x) const {
             return ((size() >= x.size()) && (memcmp(c_string(), x.c_string(), x.size()) == 0));
         }
-        
+
     private:
-        std::shared_ptr<const std::string> _s;
-        size_t _pos;
+        // the reference count, followed by the bytes
+        struct Rep {
+            std::atomic<uint32_t> refs;
+
+            char* data() { return reinterpret_cast<char*>(this + 1); }
+        };
+
+        // copy data[0, n-1] into a new Rep, nothing is copied if data is
+        // null
+        void init(const char* data, size_t n) {
+            if (n == 0) {
+                reset();
+                return;
+            }
+            // with a '\0' after the bytes, for the callers of c_string()
+            void* mem = ::operator new(sizeof(Rep) + n + 1);
+            _rep = new (mem) Rep;
+            _rep->refs.store(1, std::memory_order_relaxed);
+            if (data != nullptr) {
+                memcpy(_rep->data(), data, n);
+            }
+            _rep->data()[n] = '\0';
+            _data = _rep->data();
+            _len = n;
+        }
+
+        void reset() {
+            _rep = nullptr;
+            _data = "";
+            _len = 0;
+        }
+
+        void ref() const {
+            if (_rep != nullptr) {
+                _rep->refs.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        void unref() {
+            if (_rep != nullptr && _rep->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                _rep->~Rep();
+                ::operator delete(_rep);
+            }
+        }
+
+        Rep* _rep;
+        const char* _data;
         size_t _len;
     };
 
+    inline SliceView::SliceView(const Slice& s) : _data(s.c_string()), _len(s.size()) {}
+
+    inline bool operator==(const SliceView& x, const SliceView& y) {
+        return ((x.size() == y.size()) &&
+                (memcmp(x.data(), y.data(), x.size()) == 0));
+    }
+
+    inline bool operator!=(const SliceView& x, const SliceView& y) { return !(x == y); }
+
     inline bool operator==(const Slice& x, const Slice& y) {
         return ((x.size() == y.size()) &&
                 (memcmp(x.c_string(), y.c_string(), x.size()) == 0));
@@ -82,4 +265,4 @@ namespace cowbpt {
 
 }
 
-#endif
\ No newline at end of file
+#endif
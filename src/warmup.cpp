@@ -0,0 +1,169 @@
+#include "warmup.h"
+
+#include <algorithm>
+#include <unordered_set>
+
+#include "coding.h"
+
+namespace cowbpt {
+
+    namespace {
+        // pages read with one request to the page store
+        const size_t kWarmupBatchPages = 32;
+    }
+
+    void EncodeWarmupManifest(const WarmupManifest& manifest, std::string* dst) {
+        PutVarint32(dst, manifest.size());
+        for (auto& level : manifest) {
+            PutVarint32(dst, level.size());
+            for (uint64_t page_id : level) {
+                PutVarint64(dst, page_id);
+            }
+        }
+    }
+
+    bool DecodeWarmupManifest(Slice input, WarmupManifest* manifest) {
+        uint32_t levels;
+        if (!GetVarint32(&input, &levels)) {
+            return false;
+        }
+        manifest->clear();
+        manifest->resize(levels);
+        for (auto& level : *manifest) {
+            uint32_t n;
+            if (!GetVarint32(&input, &n)) {
+                return false;
+            }
+            level.resize(n);
+            for (uint64_t& page_id : level) {
+                if (!GetVarint64(&input, &page_id)) {
+                    return false;
+                }
+            }
+        }
+        return input.empty();
+    }
+
+    void TrimWarmupManifest(WarmupManifest* manifest, size_t max_pages) {
+        size_t pages = 0;
+        for (size_t depth = 0; depth < manifest->size(); depth++) {
+            auto& level = (*manifest)[depth];
+            if (pages + level.size() >= max_pages) {
+                level.resize(max_pages - pages);
+                manifest->resize(depth + 1);
+                return;
+            }
+            pages += level.size();
+        }
+    }
+
+    PageWarmer::PageWarmer(NodeManager* nm, int threads, size_t pages_per_sec)
+    : _nm(nm),
+      _threads(std::max(threads, 1)),
+      _pages_per_sec(pages_per_sec),
+      _stopped(false),
+      _fetched(0),
+      _issued(0) {}
+
+    PageWarmer::~PageWarmer() {
+        Stop();
+    }
+
+    void PageWarmer::Start(const NodePtr& root, WarmupManifest manifest) {
+        assert(!_thread.joinable());
+        _manifest = std::move(manifest);
+        _start = std::chrono::steady_clock::now();
+        _thread = std::thread(&PageWarmer::run, this, root);
+    }
+
+    void PageWarmer::Wait() {
+        if (_thread.joinable()) {
+            _thread.join();
+        }
+    }
+
+    void PageWarmer::Stop() {
+        _stopped.store(true, std::memory_order_release);
+        Wait();
+    }
+
+    void PageWarmer::run(NodePtr root) {
+        std::vector<NodePtr> level = {root};
+        for (size_t depth = 1; depth < _manifest.size() && !level.empty(); depth++) {
+            std::unordered_set<uint64_t> wanted(_manifest[depth].begin(), _manifest[depth].end());
+            std::vector<NodePtr> next_level;
+            for (auto& p : level) {
+                if (_stopped.load(std::memory_order_acquire)) {
+                    return;
+                }
+                p->lock();
+                if (p->is_in_memory() && p->is_internalnode()) {
+                    for (auto& child : p->get_child_nodes()) {
+                        if (wanted.count(child->get_node_id()) != 0) {
+                            next_level.push_back(child);
+                        }
+                    }
+                }
+                p->unlock();
+            }
+
+            std::atomic<size_t> next(0);
+            std::vector<std::thread> fetchers;
+            for (int i = 1; i < _threads; i++) {
+                fetchers.push_back(std::thread(&PageWarmer::fetch_pages, this, &next_level, &next));
+            }
+            fetch_pages(&next_level, &next);
+            for (auto& t : fetchers) {
+                t.join();
+            }
+            level.swap(next_level);
+        }
+        LOG(INFO) << "Finish warming up, " << fetched_pages() << " pages fetched";
+    }
+
+    void PageWarmer::fetch_pages(const std::vector<NodePtr>* nodes, std::atomic<size_t>* next) {
+        size_t begin;
+        std::vector<NodePtr> batch;
+        std::vector<Status> statuses;
+        while ((begin = next->fetch_add(kWarmupBatchPages, std::memory_order_relaxed)) < nodes->size()) {
+            const size_t end = std::min(nodes->size(), begin + kWarmupBatchPages);
+            batch.clear();
+            for (size_t i = begin; i < end; i++) {
+                if (_stopped.load(std::memory_order_acquire)) {
+                    return;
+                }
+                const NodePtr& p = (*nodes)[i];
+                if (p->is_in_memory()) {
+                    // a request got there first
+                    continue;
+                }
+                throttle();
+                batch.push_back(p);
+            }
+            if (batch.empty()) {
+                continue;
+            }
+            // the reads of the batch are issued together, see
+            // RandomAccessFile::MultiRead()
+            _fetched.fetch_add(_nm->fetch(batch, &statuses), std::memory_order_relaxed);
+            for (size_t i = 0; i < batch.size(); i++) {
+                if (!statuses[i].ok()) {
+                    // left for a request to fail on
+                    LOG(ERROR) << "Fail to warm up page " << batch[i]->get_node_id() << ": " << statuses[i].string();
+                }
+            }
+        }
+    }
+
+    void PageWarmer::throttle() {
+        if (_pages_per_sec == 0) {
+            return;
+        }
+        size_t n = _issued.fetch_add(1, std::memory_order_relaxed);
+        auto due = _start + std::chrono::microseconds(n * 1000000 / _pages_per_sec);
+        // wake up now and then, so that Stop() does not wait for the budget
+        while (std::chrono::steady_clock::now() < due && !_stopped.load(std::memory_order_acquire)) {
+            std::this_thread::sleep_until(std::min(due, std::chrono::steady_clock::now() + std::chrono::milliseconds(100)));
+        }
+    }
+}
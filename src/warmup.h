@@ -0,0 +1,77 @@
+#ifndef WARMUP_H
+#define WARMUP_H
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bpt.h"
+#include "slice.h"
+
+namespace cowbpt {
+
+    // The ids of the pages that were in memory at a checkpoint, by their
+    // depth in the tree, the root first.
+    typedef std::vector<std::vector<uint64_t>> WarmupManifest;
+
+    void EncodeWarmupManifest(const WarmupManifest& manifest, std::string* dst);
+
+    // Return false if input is not an encoded manifest.
+    bool DecodeWarmupManifest(Slice input, WarmupManifest* manifest);
+
+    // Keep at most max_pages pages, the deepest ones are dropped first.
+    void TrimWarmupManifest(WarmupManifest* manifest, size_t max_pages);
+
+    // Reads the pages of a manifest back in the background after the db has
+    // been opened, so that requests do not have to fault them in one by one.
+    //
+    // The tree is walked a level at a time from the root: the children of the
+    // pages warmed so far that are in the manifest are fetched by several
+    // threads, then the warmer goes one level down.
+    class PageWarmer {
+    public:
+        typedef Bpt::NodePtr NodePtr;
+
+        // threads: the number of threads fetching pages, at least 1
+        // pages_per_sec: the most pages fetched per second, 0 means no limit
+        PageWarmer(NodeManager* nm, int threads, size_t pages_per_sec);
+
+        PageWarmer(const PageWarmer&) = delete;
+        PageWarmer& operator=(const PageWarmer&) = delete;
+
+        // Stop()
+        ~PageWarmer();
+
+        void Start(const NodePtr& root, WarmupManifest manifest);
+
+        // Wait until every page has been fetched.
+        void Wait();
+
+        // Stop fetching pages and wait for the threads.
+        void Stop();
+
+        size_t fetched_pages() const { return _fetched.load(std::memory_order_relaxed); }
+
+    private:
+        void run(NodePtr root);
+        void fetch_pages(const std::vector<NodePtr>* nodes, std::atomic<size_t>* next);
+        void throttle();
+
+        NodeManager* const _nm;
+        const int _threads;
+        const size_t _pages_per_sec;
+        WarmupManifest _manifest;
+
+        std::thread _thread;
+        std::atomic<bool> _stopped;
+        std::atomic<size_t> _fetched;
+
+        // pacing of pages_per_sec
+        std::chrono::steady_clock::time_point _start;
+        std::atomic<size_t> _issued;
+    };
+}
+
+#endif
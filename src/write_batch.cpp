@@ -34,13 +34,13 @@ void WriteBatch::Clear() {
 size_t WriteBatch::ApproximateSize() const { return rep_.size(); }
 
 Status WriteBatch::Iterate(Handler* handler) const {
-  Slice input(rep_);
+  SliceView input(rep_);
   if (input.size() < kHeader) {
     return Status::Corruption("malformed WriteBatch (too small)");
   }
 
   input.remove_prefix(kHeader);
-  Slice key, value;
+  SliceView key, value;
   int found = 0;
   while (!input.empty()) {
     found++;
@@ -50,14 +50,18 @@ Status WriteBatch::Iterate(Handler* handler) const {
       case kTypeValue:
         if (GetLengthPrefixedSlice(&input, &key) &&
             GetLengthPrefixedSlice(&input, &value)) {
-          handler->Put(key, value);
+          // The tree keeps the key and the value, they are copied once
+          // into a buffer of their own instead of sharing the batch.
+          Slice key_copy, value_copy;
+          Slice::CopyPair(key, value, &key_copy, &value_copy);
+          handler->Put(key_copy, value_copy);
         } else {
           return Status::Corruption("bad WriteBatch Put");
         }
         break;
       case kTypeDeletion:
         if (GetLengthPrefixedSlice(&input, &key)) {
-          handler->Delete(key);
+          handler->Delete(Slice(key));
         } else {
           return Status::Corruption("bad WriteBatch Delete");
         }
@@ -89,14 +93,14 @@ void WriteBatchInternal::SetSequence(WriteBatch* b, SequenceNumber seq) {
   EncodeFixed64(&b->rep_[0], seq);
 }
 
-void WriteBatch::Put(const Slice& key, const Slice& value) {
+void WriteBatch::Put(const SliceView& key, const SliceView& value) {
   WriteBatchInternal::SetCount(this, WriteBatchInternal::Count(this) + 1);
   rep_.push_back(static_cast<char>(kTypeValue));
   PutLengthPrefixedSlice(&rep_, key);
   PutLengthPrefixedSlice(&rep_, value);
 }
 
-void WriteBatch::Delete(const Slice& key) {
+void WriteBatch::Delete(const SliceView& key) {
   WriteBatchInternal::SetCount(this, WriteBatchInternal::Count(this) + 1);
   rep_.push_back(static_cast<char>(kTypeDeletion));
   PutLengthPrefixedSlice(&rep_, key);
@@ -111,15 +115,23 @@ class BptInserter : public WriteBatch::Handler {
  public:
   SequenceNumber sequence_; // TODO: use this value
   Bpt* bpt_;
+  Status status_; // the first page that could not be read back
 
   void Put(const Slice& key, const Slice& value) override {
-    bpt_->put(key, value);
+    Update(bpt_->put(key, value));
     sequence_++;
   }
   void Delete(const Slice& key) override {
-    bpt_->erase(key);
+    Update(bpt_->erase(key));
     sequence_++;
   }
+
+ private:
+  void Update(const Status& s) {
+    if (status_.ok() && !s.ok()) {
+      status_ = s;
+    }
+  }
 };
 }  // namespace
 
@@ -127,7 +139,11 @@ Status WriteBatchInternal::InsertInto(const WriteBatch* b, Bpt* bpt) {
   BptInserter inserter;
   inserter.sequence_ = WriteBatchInternal::Sequence(b);
   inserter.bpt_ = bpt;
-  return b->Iterate(&inserter);
+  Status s = b->Iterate(&inserter);
+  if (s.ok()) {
+    s = inserter.status_;
+  }
+  return s;
 }
 
 void WriteBatchInternal::SetContents(WriteBatch* b, const Slice& contents) {
@@ -24,6 +24,7 @@
 namespace cowbpt {
 
 class Slice;
+class SliceView;
 
 class WriteBatch {
  private:
@@ -46,10 +47,10 @@ class WriteBatch {
   ~WriteBatch();
 
   // Store the mapping "key->value" in the database.
-  void Put(const Slice& key, const Slice& value);
+  void Put(const SliceView& key, const SliceView& value);
 
   // If the database contains a mapping for "key", erase it.  Else do nothing.
-  void Delete(const Slice& key);
+  void Delete(const SliceView& key);
 
   // Clear all updates buffered in this batch.
   void Clear();
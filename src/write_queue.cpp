@@ -0,0 +1,133 @@
+#include "write_queue.h"
+
+#include <cassert>
+#include <thread>
+
+namespace cowbpt {
+
+    namespace {
+        // a leader usually commits a small group in a few microseconds, spin for
+        // about that long before falling back to yield and then to the cv
+        const int kSpinIterations = 200;
+        const int kYieldIterations = 100;
+
+        inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#elif defined(__aarch64__)
+            asm volatile("yield" ::: "memory");
+#endif
+        }
+    }
+
+    bool WriteQueue::LinkOne(Writer* w) {
+        Writer* writers = _newest_writer.load(std::memory_order_relaxed);
+        while (true) {
+            w->link_older = writers;
+            if (_newest_writer.compare_exchange_weak(writers, w)) {
+                return writers == nullptr;
+            }
+        }
+    }
+
+    void WriteQueue::CreateMissingNewerLinks(Writer* head) {
+        while (true) {
+            Writer* next = head->link_older;
+            if (next == nullptr || next->link_newer != nullptr) {
+                assert(next == nullptr || next->link_newer == head);
+                break;
+            }
+            next->link_newer = head;
+            head = next;
+        }
+    }
+
+    uint8_t WriteQueue::AwaitState(Writer* w, uint8_t goal_mask) {
+        uint8_t state;
+        for (int i = 0; i < kSpinIterations; i++) {
+            state = w->state.load(std::memory_order_acquire);
+            if (state & goal_mask) {
+                return state;
+            }
+            CpuRelax();
+        }
+
+        for (int i = 0; i < kYieldIterations; i++) {
+            state = w->state.load(std::memory_order_acquire);
+            if (state & goal_mask) {
+                return state;
+            }
+            std::this_thread::yield();
+        }
+
+        // Park.  kLockedWaiting tells SetState that it has to take the mutex
+        // and notify us instead of just storing the new state.
+        std::unique_lock<std::mutex> lck(w->mutex);
+        state = w->state.load(std::memory_order_acquire);
+        if (!(state & goal_mask) &&
+            w->state.compare_exchange_strong(state, kLockedWaiting)) {
+            while (!((state = w->state.load(std::memory_order_relaxed)) & goal_mask)) {
+                w->cv.wait(lck);
+            }
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        assert(state & goal_mask);
+        return state;
+    }
+
+    void WriteQueue::SetState(Writer* w, uint8_t new_state) {
+        uint8_t state = w->state.load(std::memory_order_acquire);
+        if (state == kLockedWaiting ||
+            !w->state.compare_exchange_strong(state, new_state)) {
+            assert(state == kLockedWaiting);
+            std::lock_guard<std::mutex> lck(w->mutex);
+            assert(w->state.load(std::memory_order_relaxed) != new_state);
+            w->state.store(new_state, std::memory_order_release);
+            w->cv.notify_one();
+        }
+    }
+
+    bool WriteQueue::JoinBatchGroup(Writer* w) {
+        assert(w->state.load(std::memory_order_relaxed) == kWaiting);
+        if (LinkOne(w)) {
+            // the queue was empty, we are the leader
+            w->state.store(kLeader, std::memory_order_relaxed);
+            return true;
+        }
+        return AwaitState(w, kLeader | kCompleted) == kLeader;
+    }
+
+    WriteQueue::Writer* WriteQueue::LinkGroup(Writer* leader) {
+        assert(leader->link_older == nullptr);
+        Writer* newest = _newest_writer.load(std::memory_order_acquire);
+        CreateMissingNewerLinks(newest);
+        return newest;
+    }
+
+    void WriteQueue::ExitAsBatchGroupLeader(Writer* leader, Writer* last_writer, const Status& status) {
+        assert(leader->link_older == nullptr);
+
+        // Hand over the leadership first, nobody will touch the writers in
+        // [leader, last_writer] once they are completed.
+        Writer* head = _newest_writer.load(std::memory_order_acquire);
+        if (head != last_writer ||
+            !_newest_writer.compare_exchange_strong(head, nullptr)) {
+            // Someone joined after last_writer, so the queue can't be empty.
+            assert(head != nullptr);
+            CreateMissingNewerLinks(head);
+            Writer* next_leader = last_writer->link_newer;
+            assert(next_leader != nullptr && next_leader->link_older == last_writer);
+            next_leader->link_older = nullptr;
+            SetState(next_leader, kLeader);
+        }
+
+        // complete the followers from the newest to the oldest, read the link
+        // before completing a writer since its owner may return right away
+        while (last_writer != leader) {
+            Writer* next = last_writer->link_older;
+            last_writer->status = status;
+            SetState(last_writer, kCompleted);
+            last_writer = next;
+        }
+    }
+}
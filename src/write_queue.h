@@ -0,0 +1,98 @@
+#ifndef WRITE_QUEUE_H
+#define WRITE_QUEUE_H
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+#include "status.h"
+
+namespace cowbpt {
+
+    class WriteBatch;
+
+    // A lock free multi producer queue of pending writers.
+    //
+    // Writers are pushed onto an intrusive singly linked list whose head is the
+    // newest writer.  The writer that finds the list empty becomes the leader,
+    // every other writer is a follower that waits until the leader has either
+    // committed its batch or handed leadership to it.  Only the leader walks the
+    // list, so building a batch group does not need any global mutex.
+    class WriteQueue {
+    public:
+        enum State : uint8_t {
+            // Waiting to be picked by a leader or to become the leader
+            kWaiting = 1,
+            // A follower that gave up spinning and is blocked on its cv
+            kLockedWaiting = 2,
+            // The writer is the leader of the next batch group
+            kLeader = 4,
+            // A leader has committed the writer's batch, status is valid
+            kCompleted = 8,
+        };
+
+        // Information kept for every waiting writer
+        struct Writer {
+            Writer()
+                : batch(nullptr),
+                  sync(false),
+                  state(kWaiting),
+                  link_older(nullptr),
+                  link_newer(nullptr) {}
+
+            Writer(const Writer&) = delete;
+            Writer& operator=(const Writer&) = delete;
+
+            Status status;
+            // nullptr means the writer wants to run alone as the leader,
+            // without any batch, e.g. to switch the log file
+            WriteBatch* batch;
+            bool sync;
+            std::atomic<uint8_t> state;
+            Writer* link_older;  // set when the writer is pushed
+            Writer* link_newer;  // lazily set by the leader
+
+            // only used when a follower gives up spinning
+            std::mutex mutex;
+            std::condition_variable cv;
+        };
+
+        WriteQueue() : _newest_writer(nullptr) {}
+
+        WriteQueue(const WriteQueue&) = delete;
+        WriteQueue& operator=(const WriteQueue&) = delete;
+
+        ~WriteQueue() = default;
+
+        // Push w onto the queue and block until w either becomes the leader or
+        // is committed by another leader.
+        // Return true if w is the leader, w->status is valid otherwise.
+        bool JoinBatchGroup(Writer* w);
+
+        // Return the newest writer in the queue, and link every writer from
+        // leader up to it through link_newer so that the leader can walk them.
+        // REQUIRES: leader is the current leader
+        Writer* LinkGroup(Writer* leader);
+
+        // Complete every writer in (leader, last_writer] with status and hand
+        // the leadership to the writer right after last_writer, if any.
+        // REQUIRES: leader is the current leader
+        void ExitAsBatchGroupLeader(Writer* leader, Writer* last_writer, const Status& status);
+
+    private:
+        // push w onto the list, return true if w is the only writer in the list
+        bool LinkOne(Writer* w);
+
+        // set link_newer of every writer older than head that misses it
+        void CreateMissingNewerLinks(Writer* head);
+
+        // spin, then yield, then block until w->state is one of goal_mask
+        uint8_t AwaitState(Writer* w, uint8_t goal_mask);
+
+        void SetState(Writer* w, uint8_t new_state);
+
+        std::atomic<Writer*> _newest_writer;
+    };
+}
+
+#endif
@@ -4,6 +4,7 @@
 
 #include <algorithm>
 #include <memory>
+#include <vector>
 
 #include "gtest/gtest.h"
 #include "gmock/gmock.h"
@@ -90,6 +91,79 @@ TEST_F(EnvTest, ReadWrite) {
   ASSERT_EQ(read_result, data);
 }
 
+TEST_F(EnvTest, AsyncSync) {
+  Random rnd(test::RandomSeed());
+  std::string test_dir;
+  ASSERT_COWBPT_OK(env_->GetTestDirectory(&test_dir));
+  std::string test_file_name = test_dir + "/async_sync.txt";
+
+  for (Env* env : {Env::Default(), IoUringEnv()}) {
+    WritableFilePtr writable_file;
+    ASSERT_COWBPT_OK(env->NewWritableFile(test_file_name, writable_file));
+    std::string data;
+    while (data.size() < 1048576) {
+      std::string r;
+      test::RandomString(&rnd, rnd.Skewed(17), &r);
+      ASSERT_COWBPT_OK(writable_file->Append(r));
+      data += r;
+      if (rnd.OneIn(5)) {
+        ASSERT_COWBPT_OK(writable_file->Flush());
+      } else if (rnd.OneIn(5)) {
+        ASSERT_COWBPT_OK(writable_file->AsyncSync());
+        ASSERT_COWBPT_OK(writable_file->WaitForSync());
+      }
+    }
+    ASSERT_COWBPT_OK(writable_file->Close());
+
+    // appends continue at the end of the file
+    ASSERT_COWBPT_OK(env->NewAppendableFile(test_file_name, writable_file));
+    ASSERT_COWBPT_OK(writable_file->Append("tail"));
+    ASSERT_COWBPT_OK(writable_file->Sync());
+    ASSERT_COWBPT_OK(writable_file->Close());
+    data += "tail";
+
+    std::string read_result;
+    ASSERT_COWBPT_OK(ReadFileToString(env, test_file_name, &read_result));
+    ASSERT_EQ(read_result, data);
+    env->RemoveFile(test_file_name);
+  }
+}
+
+TEST_F(EnvTest, MultiRead) {
+  Random rnd(test::RandomSeed());
+  std::string test_dir;
+  ASSERT_COWBPT_OK(env_->GetTestDirectory(&test_dir));
+  std::string test_file_name = test_dir + "/multi_read.txt";
+
+  WritableFilePtr writable_file;
+  ASSERT_COWBPT_OK(env_->NewWritableFile(test_file_name, writable_file));
+  std::string data;
+  test::RandomString(&rnd, 1048576, &data);
+  ASSERT_COWBPT_OK(writable_file->Append(data));
+  ASSERT_COWBPT_OK(writable_file->Close());
+
+  for (Env* env : {Env::Default(), IoUringEnv()}) {
+    RandomAccessFilePtr file;
+    ASSERT_COWBPT_OK(env->NewRandomAccessFile(test_file_name, file));
+    ASSERT_TRUE(file != nullptr);
+
+    // more requests than an io_uring queue holds, the last one reads past eof
+    std::vector<RandomAccessFile::ReadRequest> reqs(200);
+    for (size_t i = 0; i < reqs.size(); i++) {
+      reqs[i].offset = rnd.Uniform(data.size());
+      reqs[i].n = rnd.Uniform(8192);
+    }
+    reqs.back().offset = data.size() - 10;
+    reqs.back().n = 100;
+    ASSERT_COWBPT_OK(file->MultiRead(reqs.data(), reqs.size()));
+    for (auto& req : reqs) {
+      ASSERT_COWBPT_OK(req.status);
+      ASSERT_EQ(req.result.string(), data.substr(req.offset, req.n));
+    }
+  }
+  env_->RemoveFile(test_file_name);
+}
+
 // TEST_F(EnvTest, RunImmediately) {
 //   struct RunState {
 //     port::Mutex mu;
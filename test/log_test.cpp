@@ -6,6 +6,7 @@
 #include "coding.h"
 #include "crc32c.h"
 #include "random.h"
+#include "compression.h"
 
 #include <memory>
 #include <iostream>
@@ -82,6 +83,21 @@ class LogTest : public testing::Test {
     writer_ = new Writer(dest_, dest_->contents_.size());
   }
 
+  void UseCompression(size_t min_size) {
+    delete writer_;
+    writer_ = new Writer(dest_, dest_->contents_.size(), kSnappyCompression,
+                         min_size);
+  }
+
+  int RecordTypeAt(size_t header_offset) const {
+    return dest_->contents_[header_offset + 6];
+  }
+
+  static bool SnappySupported() {
+    std::string out;
+    return Snappy_Compress("x", 1, &out);
+  }
+
   void Write(const std::string& msg) {
     ASSERT_TRUE(!reading_) << "Write() after starting to read";
     writer_->AddRecord(Slice(msg));
@@ -192,8 +208,8 @@ class LogTest : public testing::Test {
     Status Close() override { return Status::OK(); }
     Status Flush() override { return Status::OK(); }
     Status Sync() override { return Status::OK(); }
-    Status Append(const Slice& slice) override {
-      contents_.append(slice.c_string(), slice.size());
+    Status Append(const SliceView& slice) override {
+      contents_.append(slice.data(), slice.size());
       return Status::OK();
     }
 
@@ -409,6 +425,70 @@ TEST_F(LogTest, BadRecordType) {
   ASSERT_EQ("OK", MatchError("unknown record type"));
 }
 
+TEST_F(LogTest, CompressedReadWrite) {
+  UseCompression(100);
+  Write("small");
+  Write(BigString("medium", 1000));
+  Write(BigString("large", 100000));
+  Write(BigString("small", 50));
+  const size_t raw_bytes = 5 + 1000 + 100000 + 50;
+  if (SnappySupported()) {
+    ASSERT_LT(WrittenBytes(), raw_bytes);
+    // The first record is below the threshold
+    ASSERT_EQ(kFullType, RecordTypeAt(0));
+    ASSERT_EQ(kCompressedFullType, RecordTypeAt(kHeaderSize + 5));
+  } else {
+    ASSERT_GT(WrittenBytes(), raw_bytes);
+  }
+  ASSERT_EQ("small", Read());
+  ASSERT_EQ(BigString("medium", 1000), Read());
+  ASSERT_EQ(BigString("large", 100000), Read());
+  ASSERT_EQ(BigString("small", 50), Read());
+  ASSERT_EQ("EOF", Read());
+  ASSERT_EQ(0, DroppedBytes());
+}
+
+TEST_F(LogTest, CompressedFragmentation) {
+  // Incompressible prefix so that the compressed record still spans blocks
+  Random rnd(301);
+  std::string record;
+  for (int i = 0; i < 3 * kBlockSize; i++) {
+    record.push_back(static_cast<char>(' ' + rnd.Uniform(95)));
+  }
+  record.append(BigString("abc", 3 * kBlockSize));
+  UseCompression(100);
+  Write(record);
+  Write("foo");
+  if (SnappySupported()) {
+    ASSERT_EQ(kCompressedFirstType, RecordTypeAt(0));
+  }
+  ASSERT_EQ(record, Read());
+  ASSERT_EQ("foo", Read());
+  ASSERT_EQ("EOF", Read());
+}
+
+TEST_F(LogTest, IncompressibleRecordIsStoredRaw) {
+  Random rnd(301);
+  std::string record;
+  for (int i = 0; i < 1000; i++) {
+    record.push_back(static_cast<char>(rnd.Next()));
+  }
+  UseCompression(100);
+  Write(record);
+  ASSERT_EQ(kHeaderSize + record.size(), WrittenBytes());
+  ASSERT_EQ(kFullType, RecordTypeAt(0));
+  ASSERT_EQ(record, Read());
+}
+
+TEST_F(LogTest, CorruptedCompressedRecord) {
+  Write("foo");
+  SetByte(6, kCompressedFullType);
+  FixChecksum(0, 3);
+  ASSERT_EQ("EOF", Read());
+  ASSERT_EQ(3, DroppedBytes());
+  ASSERT_EQ("OK", MatchError("corrupted compressed record"));
+}
+
 TEST_F(LogTest, TruncatedTrailingRecordIsIgnored) {
   Write("foo");
   ShrinkSize(4);  // Drop all payload as well as a header byte
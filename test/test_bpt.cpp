@@ -318,4 +318,126 @@ TEST(BptTest, BptRandomCurrentCRUD) {
     
     // std::cout << b.dump() << std::endl;
 
-}
\ No newline at end of file
+}
+void count_leaves(const Bpt::NodePtr& node, size_t* leaves, size_t* entries) {
+    if (node->is_leafnode()) {
+        (*leaves)++;
+        *entries += node->size();
+        return;
+    }
+    for (auto& child : node->get_child_nodes()) {
+        count_leaves(child, leaves, entries);
+    }
+}
+
+size_t min_leaf_entries(const Bpt::NodePtr& node) {
+    if (node->is_leafnode()) {
+        return node->size();
+    }
+    size_t n = SIZE_MAX;
+    for (auto& child : node->get_child_nodes()) {
+        n = std::min(n, min_leaf_entries(child));
+    }
+    return n;
+}
+
+void append_thread(Bpt* bt, int thread, int n) {
+    char buf[32];
+    for (int i = 0; i < n; i++) {
+        snprintf(buf, sizeof(buf), "key_%08d_%02d", i, thread);
+        bt->put(buf, buf);
+    }
+}
+
+TEST(BptTest, BptAppend) {
+    // nodes big enough for the left halves to keep 90%
+    const int32_t node_b_size = FLAGS_COWBPT_NODE_B_SZIE;
+    FLAGS_COWBPT_NODE_B_SZIE = 16;
+    Bpt b(&cmp);
+    const int n = 10000;
+    char buf[32];
+    for (int i = 0; i < n; i++) {
+        snprintf(buf, sizeof(buf), "key_%08d", i);
+        b.put(buf, buf);
+        if (i == n / 2) {
+            // the leaf at the end is copied before its next write
+            Bpt::NodePtr snapshot = b.snaphot();
+            ASSERT_NE(b._tail_version, b._shape_version.load());
+        }
+        if (i % 1000 == 999) {
+            // fixes the leaves at the end
+            for (int j = i - 10; j < i; j++) {
+                snprintf(buf, sizeof(buf), "key_%08d", j);
+                b.erase(buf);
+            }
+        }
+    }
+    ASSERT_NE(b._tail, nullptr);
+    // not at the end
+    b.put("key_", "key_");
+    b.put("key_00000010_", "key_00000010_");
+
+    for (int i = 0; i < n; i++) {
+        snprintf(buf, sizeof(buf), "key_%08d", i);
+        bool erased = i % 1000 >= 989 && i % 1000 < 999;
+        EXPECT_EQ(b.get(buf).string(), erased ? "" : buf);
+    }
+    EXPECT_EQ(b.get("key_").string(), "key_");
+    EXPECT_EQ(b.get("key_00000010_").string(), "key_00000010_");
+
+    // the left halves of the splits at the end are full, instead of half full
+    size_t leaves = 0, entries = 0;
+    count_leaves(b._root, &leaves, &entries);
+    size_t max_entries = b._root->max_entries();
+    EXPECT_GT(entries, leaves * (max_entries - 1) * 3 / 4);
+    FLAGS_COWBPT_NODE_B_SZIE = node_b_size;
+
+    Bpt c(&cmp);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; t++) {
+        threads.push_back(std::thread(append_thread, &c, t, 2000));
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    for (int t = 0; t < 8; t++) {
+        for (int i = 0; i < 2000; i++) {
+            snprintf(buf, sizeof(buf), "key_%08d_%02d", i, t);
+            EXPECT_EQ(c.get(buf).string(), buf);
+        }
+    }
+}
+
+TEST(BptTest, BptAppendAfterErase) {
+    Bpt b(&cmp);
+    char buf[32];
+    for (int i = 0; i < 1000; i++) {
+        snprintf(buf, sizeof(buf), "key_%08d", i);
+        b.put(buf, buf);
+    }
+    // the right halves of the splits at the end keep 2 entries
+    ASSERT_GE(min_leaf_entries(b._root), 2);
+    ASSERT_NE(b._tail, nullptr);
+
+    // down past the leaf at the end, the leaves are merged and borrowed from
+    const uint64_t shape_version = b._shape_version.load();
+    for (int i = 999; i >= 900; i--) {
+        snprintf(buf, sizeof(buf), "key_%08d", i);
+        b.erase(buf);
+    }
+    ASSERT_GT(b._shape_version.load(), shape_version);
+    ASSERT_NE(b._tail_version, b._shape_version.load());
+
+    for (int i = 900; i < 2000; i++) {
+        snprintf(buf, sizeof(buf), "key_%08d", i);
+        b.put(buf, buf);
+    }
+    for (int i = 0; i < 2000; i++) {
+        snprintf(buf, sizeof(buf), "key_%08d", i);
+        EXPECT_EQ(b.get(buf).string(), buf);
+    }
+    size_t leaves = 0, entries = 0;
+    count_leaves(b._root, &leaves, &entries);
+    EXPECT_EQ(entries, 2000);
+    EXPECT_GE(min_leaf_entries(b._root), 2);
+}
@@ -1,7 +1,10 @@
 #include "gtest/gtest.h"
 #include "gmock/gmock.h"
+#include <algorithm>
+#include <map>
 #include <unordered_set>
 #include <mutex>
+#include <random>
 #include <thread>
 
 #define private public
@@ -10,6 +13,8 @@
 #include "db.h"
 #include "comparator.h"
 #include "db_impl.h"
+#include "filename.h"
+#include "random.h"
 
 using namespace cowbpt;
 
@@ -614,4 +619,951 @@ TEST(DBImplTest, DBImplIterator) {
     iter->Next();
     ASSERT_FALSE(iter->Valid());
 }
-} 
\ No newline at end of file
+
+TEST(DBImplTest, DBImplDisableWAL) {
+    testdb_name = "DBImplDisableWAL";
+    DestroyDB(testdb_name, Options());
+    // close without a checkpoint, like a crash
+    Options options;
+    options.checkpoint_on_close = false;
+    DB* db;
+    ASSERT_COWBPT_OK(DB::Open(options, testdb_name, &db));
+
+    WriteOptions unlogged;
+    unlogged.disable_wal = true;
+    WriteOptions logged;
+
+    ASSERT_COWBPT_OK(db->Put(unlogged, "1", "one"));
+    ASSERT_COWBPT_OK(db->Put(logged, "2", "two"));
+    ASSERT_COWBPT_OK(db->Put(unlogged, "3", "three"));
+    std::string result;
+    ASSERT_COWBPT_OK(db->Get(ReadOptions(), "1", &result));
+    ASSERT_EQ(result, "one");
+    ASSERT_COWBPT_OK(db->Get(ReadOptions(), "3", &result));
+    ASSERT_EQ(result, "three");
+    ASSERT_EQ(static_cast<DBImpl*>(db)->LastSequence(), 3);
+
+    WriteOptions bad = unlogged;
+    bad.sync = true;
+    ASSERT_TRUE(db->Put(bad, "4", "four").IsInvalidArgument());
+
+    // unlogged writes are durable once a checkpoint has finished
+    ASSERT_COWBPT_OK(db->ManualCheckPoint());
+    ASSERT_COWBPT_OK(db->Put(unlogged, "5", "five"));
+    ASSERT_COWBPT_OK(db->Put(logged, "6", "six"));
+    delete db;
+
+    ASSERT_COWBPT_OK(DB::Open(options, testdb_name, &db));
+    ASSERT_COWBPT_OK(db->Get(ReadOptions(), "1", &result));
+    ASSERT_EQ(result, "one");
+    ASSERT_COWBPT_OK(db->Get(ReadOptions(), "2", &result));
+    ASSERT_EQ(result, "two");
+    ASSERT_COWBPT_OK(db->Get(ReadOptions(), "3", &result));
+    ASSERT_EQ(result, "three");
+    ASSERT_TRUE(db->Get(ReadOptions(), "5", &result).IsNotFound());
+    ASSERT_COWBPT_OK(db->Get(ReadOptions(), "6", &result));
+    ASSERT_EQ(result, "six");
+    // the logged write after the lost one keeps its sequence
+    ASSERT_EQ(static_cast<DBImpl*>(db)->LastSequence(), 5);
+    delete db;
+    DestroyDB(testdb_name, Options());
+}
+
+TEST(DBImplTest, DBImplWALCompression) {
+    testdb_name = "DBImplWALCompression";
+    DestroyDB(testdb_name, Options());
+    Options options;
+    options.wal_compression = kSnappyCompression;
+    options.wal_compression_min_size = 64;
+    DB* db;
+    ASSERT_COWBPT_OK(DB::Open(options, testdb_name, &db));
+
+    std::string big_value;
+    while (big_value.size() < 4096) {
+        big_value.append("{\"name\": \"cowbpt\", \"type\": \"value\"}, ");
+    }
+    for (int i = 0; i < 100; i++) {
+        ASSERT_COWBPT_OK(db->Put(WriteOptions(), std::to_string(i), std::to_string(i) + big_value));
+    }
+    ASSERT_COWBPT_OK(db->Put(WriteOptions(), "small", "v"));
+    delete db;
+
+    // recover from the compressed log only
+    ASSERT_COWBPT_OK(DB::Open(options, testdb_name, &db));
+    std::string result;
+    for (int i = 0; i < 100; i++) {
+        ASSERT_COWBPT_OK(db->Get(ReadOptions(), std::to_string(i), &result));
+        ASSERT_EQ(result, std::to_string(i) + big_value);
+    }
+    ASSERT_COWBPT_OK(db->Get(ReadOptions(), "small", &result));
+    ASSERT_EQ(result, "v");
+    delete db;
+    DestroyDB(testdb_name, Options());
+}
+
+TEST(DBImplTest, DBImplIoUringEnv) {
+    testdb_name = "DBImplIoUringEnv";
+    DestroyDB(testdb_name, Options());
+    Options options;
+    options.env = IoUringEnv();
+    DB* db;
+    ASSERT_COWBPT_OK(DB::Open(options, testdb_name, &db));
+
+    // sync writers from several threads, so that leaders sync whole groups
+    WriteOptions sync_write;
+    sync_write.sync = true;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.push_back(std::thread([db, t, sync_write]() {
+            for (int i = 0; i < 100; i++) {
+                std::string key = std::to_string(t) + "-" + std::to_string(i);
+                ASSERT_COWBPT_OK(db->Put(sync_write, key, key));
+            }
+        }));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    delete db;
+
+    ASSERT_COWBPT_OK(DB::Open(options, testdb_name, &db));
+    std::string result;
+    for (int t = 0; t < 4; t++) {
+        for (int i = 0; i < 100; i++) {
+            std::string key = std::to_string(t) + "-" + std::to_string(i);
+            ASSERT_COWBPT_OK(db->Get(ReadOptions(), key, &result));
+            ASSERT_EQ(result, key);
+        }
+    }
+    delete db;
+    DestroyDB(testdb_name, Options());
+}
+
+TEST(DBImplTest, DBImplParallelRecovery) {
+    testdb_name = "DBImplParallelRecovery";
+    DestroyDB(testdb_name, Options());
+    std::map<std::string, std::string> expected;
+    Random rnd(301);
+    DB* db;
+    // keep the logs of every session
+    Options no_checkpoint;
+    no_checkpoint.checkpoint_on_close = false;
+
+    // spread the writes over several log files
+    for (int session = 0; session < 3; session++) {
+        ASSERT_COWBPT_OK(DB::Open(no_checkpoint, testdb_name, &db));
+        WriteBatch batch;
+        for (int i = 0; i < 30000; i++) {
+            std::string key = std::to_string(rnd.Uniform(3000));
+            if (rnd.OneIn(5)) {
+                batch.Delete(key);
+                expected.erase(key);
+            } else {
+                std::string value = key + "-" + std::to_string(session) + "-" + std::to_string(i);
+                batch.Put(key, value);
+                expected[key] = value;
+            }
+            if (rnd.OneIn(10)) {
+                ASSERT_COWBPT_OK(db->Write(WriteOptions(), &batch));
+                batch.Clear();
+            }
+        }
+        ASSERT_COWBPT_OK(db->Write(WriteOptions(), &batch));
+        delete db;
+    }
+
+    ASSERT_COWBPT_OK(DB::Open(no_checkpoint, testdb_name, &db));
+    const uint64_t serial_last_sequence = static_cast<DBImpl*>(db)->LastSequence();
+    delete db;
+
+    for (bool sorted_apply : {false, true}) {
+        Options options = no_checkpoint;
+        options.recovery_threads = 4;
+        options.recovery_sorted_apply = sorted_apply;
+        ASSERT_COWBPT_OK(DB::Open(options, testdb_name, &db));
+        ASSERT_EQ(static_cast<DBImpl*>(db)->LastSequence(), serial_last_sequence);
+        std::string result;
+        for (int i = 0; i < 3000; i++) {
+            std::string key = std::to_string(i);
+            auto it = expected.find(key);
+            if (it == expected.end()) {
+                ASSERT_TRUE(db->Get(ReadOptions(), key, &result).IsNotFound());
+            } else {
+                ASSERT_COWBPT_OK(db->Get(ReadOptions(), key, &result));
+                ASSERT_EQ(result, it->second);
+            }
+        }
+        delete db;
+    }
+    DestroyDB(testdb_name, Options());
+}
+
+TEST(DBImplTest, DBImplBackgroundRecovery) {
+    testdb_name = "DBImplBackgroundRecovery";
+    DestroyDB(testdb_name, Options());
+    std::map<std::string, std::string> expected;
+    Random rnd(301);
+    DB* db;
+    Options no_checkpoint;
+    no_checkpoint.checkpoint_on_close = false;
+
+    ASSERT_COWBPT_OK(DB::Open(no_checkpoint, testdb_name, &db));
+    for (int i = 0; i < 2000; i++) {
+        ASSERT_COWBPT_OK(db->Put(WriteOptions(), std::to_string(i), "checkpointed"));
+        expected[std::to_string(i)] = "checkpointed";
+    }
+    ASSERT_COWBPT_OK(db->ManualCheckPoint());
+    for (int i = 0; i < 50000; i++) {
+        std::string key = std::to_string(rnd.Uniform(4000));
+        if (rnd.OneIn(4)) {
+            ASSERT_COWBPT_OK(db->Delete(WriteOptions(), key));
+            expected.erase(key);
+        } else {
+            std::string value = "logged-" + std::to_string(i);
+            ASSERT_COWBPT_OK(db->Put(WriteOptions(), key, value));
+            expected[key] = value;
+        }
+    }
+    const uint64_t last_sequence = static_cast<DBImpl*>(db)->LastSequence();
+    delete db;
+
+    Options options = no_checkpoint;
+    options.background_recovery = true;
+    ASSERT_COWBPT_OK(DB::Open(options, testdb_name, &db));
+    DBImpl* impl = static_cast<DBImpl*>(db);
+    ASSERT_NE(impl->_overlay, nullptr);
+    ASSERT_EQ(impl->LastSequence(), last_sequence);
+
+    // writes and reads while the log is applied
+    std::string result;
+    for (int i = 0; i < 4000; i++) {
+        std::string key = std::to_string(i);
+        if (i % 3 == 0) {
+            ASSERT_COWBPT_OK(db->Put(WriteOptions(), key, "new"));
+            expected[key] = "new";
+        } else if (i % 3 == 1) {
+            ASSERT_COWBPT_OK(db->Delete(WriteOptions(), key));
+            expected.erase(key);
+        }
+        auto it = expected.find(key);
+        if (it == expected.end()) {
+            ASSERT_TRUE(db->Get(ReadOptions(), key, &result).IsNotFound());
+        } else {
+            ASSERT_COWBPT_OK(db->Get(ReadOptions(), key, &result));
+            ASSERT_EQ(result, it->second);
+        }
+    }
+
+    // waits for the log to be applied
+    Iterator* iter = db->NewIterator(ReadOptions());
+    ASSERT_FALSE(impl->_overlay_active.load());
+    ASSERT_EQ(impl->_overlay->Size(), 0);
+    auto expected_it = expected.begin();
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+        ASSERT_NE(expected_it, expected.end());
+        ASSERT_EQ(iter->key().string(), expected_it->first);
+        ASSERT_EQ(iter->value().string(), expected_it->second);
+        expected_it++;
+    }
+    ASSERT_EQ(expected_it, expected.end());
+    delete iter;
+    ASSERT_COWBPT_OK(db->ManualCheckPoint());
+    delete db;
+
+    ASSERT_COWBPT_OK(DB::Open(Options(), testdb_name, &db));
+    for (int i = 0; i < 4000; i++) {
+        std::string key = std::to_string(i);
+        auto it = expected.find(key);
+        if (it == expected.end()) {
+            ASSERT_TRUE(db->Get(ReadOptions(), key, &result).IsNotFound());
+        } else {
+            ASSERT_COWBPT_OK(db->Get(ReadOptions(), key, &result));
+            ASSERT_EQ(result, it->second);
+        }
+    }
+    delete db;
+    DestroyDB(testdb_name, Options());
+}
+
+TEST(DBImplTest, DBImplCleanShutdown) {
+    testdb_name = "DBImplCleanShutdown";
+    DestroyDB(testdb_name, Options());
+    DB* db;
+    ASSERT_COWBPT_OK(DB::Open(Options(), testdb_name, &db));
+    for (int i = 0; i < 1000; i++) {
+        ASSERT_COWBPT_OK(db->Put(WriteOptions(), std::to_string(i), "v" + std::to_string(i)));
+    }
+    ASSERT_COWBPT_OK(db->ManualCheckPoint());
+    for (int i = 0; i < 1000; i += 2) {
+        ASSERT_COWBPT_OK(db->Delete(WriteOptions(), std::to_string(i)));
+    }
+    delete db;
+
+    // the last checkpoint has everything, the logs are not needed anymore
+    Env* env = Env::Default();
+    std::vector<std::string> filenames;
+    ASSERT_COWBPT_OK(env->GetChildren(testdb_name, &filenames));
+    uint64_t number;
+    FileType type;
+    for (auto& filename : filenames) {
+        if (ParseFileName(filename, &number, &type)) {
+            ASSERT_COWBPT_OK(env->RemoveFile(testdb_name + "/" + filename));
+        }
+    }
+
+    Options no_checkpoint;
+    no_checkpoint.checkpoint_on_close = false;
+    ASSERT_COWBPT_OK(DB::Open(no_checkpoint, testdb_name, &db));
+    ASSERT_EQ(static_cast<DBImpl*>(db)->LastSequence(), 1500);
+    std::string result;
+    for (int i = 0; i < 1000; i++) {
+        if (i % 2 == 0) {
+            ASSERT_TRUE(db->Get(ReadOptions(), std::to_string(i), &result).IsNotFound());
+        } else {
+            ASSERT_COWBPT_OK(db->Get(ReadOptions(), std::to_string(i), &result));
+            ASSERT_EQ(result, "v" + std::to_string(i));
+        }
+    }
+    // closed without a checkpoint, the log of this session has to be replayed
+    ASSERT_COWBPT_OK(db->Put(WriteOptions(), "1000", "v1000"));
+    delete db;
+
+    ASSERT_COWBPT_OK(DB::Open(Options(), testdb_name, &db));
+    ASSERT_EQ(static_cast<DBImpl*>(db)->LastSequence(), 1501);
+    ASSERT_COWBPT_OK(db->Get(ReadOptions(), "1000", &result));
+    ASSERT_EQ(result, "v1000");
+    ASSERT_COWBPT_OK(db->Get(ReadOptions(), "999", &result));
+    ASSERT_EQ(result, "v999");
+    delete db;
+    DestroyDB(testdb_name, Options());
+}
+
+TEST(DBImplTest, DBImplWarmup) {
+    testdb_name = "DBImplWarmup";
+    DestroyDB(testdb_name, Options());
+    DB* db;
+    ASSERT_COWBPT_OK(DB::Open(Options(), testdb_name, &db));
+    for (int i = 0; i < 20000; i++) {
+        ASSERT_COWBPT_OK(db->Put(WriteOptions(), std::to_string(i), "v" + std::to_string(i)));
+    }
+    delete db;
+
+    // every page was in memory when the db was closed
+    std::string value;
+    WarmupManifest manifest;
+    PageStore* page_store;
+    ASSERT_COWBPT_OK(OpenPageStore(Options(), InternalDBName(testdb_name), &page_store));
+    ASSERT_COWBPT_OK(page_store->GetMeta(WarmupManifestKey(), &value));
+    delete page_store;
+    ASSERT_TRUE(DecodeWarmupManifest(value, &manifest));
+    ASSERT_GE(manifest.size(), 2);
+    ASSERT_EQ(manifest[0].size(), 1);
+    size_t pages = 0;
+    for (auto& level : manifest) {
+        pages += level.size();
+    }
+
+    WarmupManifest trimmed = manifest;
+    TrimWarmupManifest(&trimmed, manifest[0].size() + manifest[1].size() + 1);
+    ASSERT_EQ(trimmed.size(), 3);
+    ASSERT_EQ(trimmed[1], manifest[1]);
+    ASSERT_EQ(trimmed[2].size(), 1);
+
+    Options options;
+    options.warmup_threads = 4;
+    ASSERT_COWBPT_OK(DB::Open(options, testdb_name, &db));
+    DBImpl* impl = static_cast<DBImpl*>(db);
+    ASSERT_NE(impl->_warmer, nullptr);
+    impl->_warmer->Wait();
+    // the root is read by Open
+    ASSERT_EQ(impl->_warmer->fetched_pages(), pages - 1);
+    std::string result;
+    for (int i = 0; i < 20000; i++) {
+        ASSERT_COWBPT_OK(db->Get(ReadOptions(), std::to_string(i), &result));
+        ASSERT_EQ(result, "v" + std::to_string(i));
+    }
+    delete db;
+
+    // the warmup is stopped when the db is closed
+    options.warmup_pages_per_sec = 10;
+    ASSERT_COWBPT_OK(DB::Open(options, testdb_name, &db));
+    delete db;
+    DestroyDB(testdb_name, Options());
+}
+
+namespace {
+    void check_page_store(PageStoreType type, const std::string& name) {
+        testdb_name = name;
+        Options options;
+        options.page_store = type;
+        // the puts after the last checkpoint are only in the log
+        options.checkpoint_on_close = false;
+        DestroyDB(testdb_name, options);
+        DB* db;
+        ASSERT_COWBPT_OK(DB::Open(options, testdb_name, &db));
+        for (int i = 0; i < 5000; i++) {
+            ASSERT_COWBPT_OK(db->Put(WriteOptions(), std::to_string(i), "v" + std::to_string(i)));
+        }
+        ASSERT_COWBPT_OK(db->ManualCheckPoint());
+        // rewrite the pages, the versions of the first checkpoint are dropped
+        for (int i = 0; i < 5000; i += 2) {
+            ASSERT_COWBPT_OK(db->Delete(WriteOptions(), std::to_string(i)));
+        }
+        ASSERT_COWBPT_OK(db->ManualCheckPoint());
+        for (int i = 1; i < 5000; i += 4) {
+            ASSERT_COWBPT_OK(db->Put(WriteOptions(), std::to_string(i), "w" + std::to_string(i)));
+        }
+        delete db;
+
+        // the last checkpoint and the log
+        ASSERT_COWBPT_OK(DB::Open(options, testdb_name, &db));
+        ASSERT_FALSE(static_cast<DBImpl*>(db)->_clean_shutdown);
+        ASSERT_EQ(static_cast<DBImpl*>(db)->LastSequence(), 5000 + 2500 + 1250);
+        std::string result;
+        for (int i = 0; i < 5000; i++) {
+            Status s = db->Get(ReadOptions(), std::to_string(i), &result);
+            if (i % 2 == 0) {
+                ASSERT_TRUE(s.IsNotFound());
+            } else {
+                ASSERT_COWBPT_OK(s);
+                ASSERT_EQ(result, (i % 4 == 1 ? "w" : "v") + std::to_string(i));
+            }
+        }
+        delete db;
+        DestroyDB(testdb_name, options);
+    }
+}
+
+TEST(DBImplTest, DBImplRocksDBPageStore) {
+    check_page_store(kRocksDBPageStore, "DBImplRocksDBPageStore");
+}
+
+TEST(DBImplTest, DBImplFilePageStore) {
+    check_page_store(kFilePageStore, "DBImplFilePageStore");
+}
+
+TEST(DBImplTest, DBImplReassignPageIds) {
+    testdb_name = "DBImplReassignPageIds";
+    Options options;
+    options.checkpoint_reassign_page_ids = true;
+    DestroyDB(testdb_name, options);
+    DB* db;
+    ASSERT_COWBPT_OK(DB::Open(options, testdb_name, &db));
+    std::vector<int> keys;
+    for (int i = 0; i < 5000; i++) {
+        keys.push_back(i);
+    }
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(301));
+    for (int i : keys) {
+        ASSERT_COWBPT_OK(db->Put(WriteOptions(), std::to_string(i), "v" + std::to_string(i)));
+    }
+    ASSERT_COWBPT_OK(db->ManualCheckPoint());
+
+    // the leaves were split in random order, they are numbered in key
+    // order by the checkpoint, with their parent after them
+    auto leaf_ids = [](DBImpl* impl) {
+        std::vector<uint64_t> ids;
+        std::vector<Bpt::NodePtr> level{impl->_bpt->get_root_node()};
+        while (level[0]->is_internalnode()) {
+            std::vector<Bpt::NodePtr> next;
+            for (auto& node : level) {
+                for (auto& child : node->get_child_nodes()) {
+                    next.push_back(child);
+                }
+            }
+            level.swap(next);
+        }
+        for (auto& node : level) {
+            ids.push_back(node->get_node_id());
+        }
+        return ids;
+    };
+    std::vector<uint64_t> ids = leaf_ids(static_cast<DBImpl*>(db));
+    ASSERT_GT(ids.size(), 1);
+    for (size_t i = 1; i < ids.size(); i++) {
+        ASSERT_GT(ids[i], ids[i - 1]);
+    }
+
+    for (int i = 0; i < 5000; i += 7) {
+        ASSERT_COWBPT_OK(db->Put(WriteOptions(), std::to_string(i), "w" + std::to_string(i)));
+    }
+    ASSERT_COWBPT_OK(db->ManualCheckPoint());
+    ids = leaf_ids(static_cast<DBImpl*>(db));
+    for (size_t i = 1; i < ids.size(); i++) {
+        ASSERT_NE(ids[i], ids[i - 1]);
+    }
+    delete db;
+
+    ASSERT_COWBPT_OK(DB::Open(options, testdb_name, &db));
+    std::string result;
+    for (int i = 0; i < 5000; i++) {
+        ASSERT_COWBPT_OK(db->Get(ReadOptions(), std::to_string(i), &result));
+        ASSERT_EQ(result, (i % 7 == 0 ? "w" : "v") + std::to_string(i));
+    }
+    delete db;
+    DestroyDB(testdb_name, options);
+}
+
+TEST(DBImplTest, DBImplPageChecksums) {
+    testdb_name = "DBImplPageChecksums";
+    DestroyDB(testdb_name, Options());
+    DB* db;
+    ASSERT_COWBPT_OK(DB::Open(Options(), testdb_name, &db));
+    for (int i = 0; i < 5000; i++) {
+        ASSERT_COWBPT_OK(db->Put(WriteOptions(), std::to_string(i), "v" + std::to_string(i)));
+    }
+    delete db;
+
+    // damage the last byte of the first leaf, and make it part of the
+    // last checkpoint
+    PageStore* page_store;
+    ASSERT_COWBPT_OK(OpenPageStore(Options(), InternalDBName(testdb_name), &page_store));
+    std::string value;
+    ASSERT_COWBPT_OK(page_store->GetMeta(RootPageIDKey(), &value));
+    uint64_t page_id = DecodeFixed64(value.c_str());
+    uint32_t flags;
+    do {
+        ASSERT_COWBPT_OK(page_store->GetPage(page_id, 0, &value));
+        ASSERT_COWBPT_OK(UnsealPage(page_id, true, &value, &flags));
+        if (flags & kInternalPage) {
+            std::vector<uint64_t> child_ids;
+            ASSERT_COWBPT_OK(GetChildPageIDs(page_id, value, &child_ids));
+            page_id = child_ids[0];
+        }
+    } while (flags & kInternalPage);
+    Slice input(value);
+    uint32_t type;
+    Slice key;
+    ASSERT_TRUE(GetVarint32(&input, &type));
+    ASSERT_TRUE(GetLengthPrefixedSlice(&input, &key));
+    ASSERT_COWBPT_OK(page_store->GetPage(page_id, 0, &value));
+    value[value.size() - 5] ^= 0x1;
+    PageBatch batch;
+    batch.PutPage(page_id, value);
+    ASSERT_COWBPT_OK(page_store->Write(batch, true));
+    std::string snapshot;
+    PutFixed64(&snapshot, page_store->GetDurableSnapshot());
+    batch.Clear();
+    batch.PutMeta(LastCheckpointSnapshotSeqKey(), snapshot);
+    ASSERT_COWBPT_OK(page_store->Write(batch, true));
+    delete page_store;
+
+    Options options;
+    options.checkpoint_on_close = false;
+    ASSERT_COWBPT_OK(DB::Open(options, testdb_name, &db));
+    ReadOptions verify;
+    verify.verify_checksums = true;
+    std::string result;
+    ASSERT_TRUE(db->Get(verify, key, &result).IsCorruption());
+    Iterator* it = db->NewIterator(verify);
+    it->SeekToFirst();
+    ASSERT_FALSE(it->Valid());
+    ASSERT_TRUE(it->status().IsCorruption());
+    delete it;
+    // the page is not verified by default
+    ASSERT_COWBPT_OK(db->Get(ReadOptions(), key, &result));
+    delete db;
+
+    options.verify_page_checksums = true;
+    ASSERT_COWBPT_OK(DB::Open(options, testdb_name, &db));
+    ASSERT_TRUE(db->Get(ReadOptions(), key, &result).IsCorruption());
+    ASSERT_TRUE(db->Put(WriteOptions(), key, "w").IsCorruption());
+    // the other leaves are fine
+    ASSERT_COWBPT_OK(db->Get(ReadOptions(), "4999", &result));
+    ASSERT_EQ(result, "v4999");
+    delete db;
+
+    options.verify_page_checksums = false;
+    options.scrub_pages_per_sec = 100000;
+    ASSERT_COWBPT_OK(DB::Open(options, testdb_name, &db));
+    DBImpl* impl = static_cast<DBImpl*>(db);
+    for (int i = 0; i < 1000 && impl->_scrubber->passes() == 0; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_GE(impl->_scrubber->passes(), 1);
+    ASSERT_GE(impl->_scrubber->damaged_pages(), 1);
+    ASSERT_GT(impl->_scrubber->scrubbed_pages(), impl->_scrubber->damaged_pages());
+    delete db;
+
+    // a logged write to the damaged leaf stops the fold of the log, and
+    // stays readable and logged
+    options.scrub_pages_per_sec = 0;
+    ASSERT_COWBPT_OK(DB::Open(options, testdb_name, &db));
+    ASSERT_COWBPT_OK(db->Put(WriteOptions(), key, "logged"));
+    delete db;
+    options.verify_page_checksums = true;
+    options.background_recovery = true;
+    ASSERT_COWBPT_OK(DB::Open(options, testdb_name, &db));
+    ASSERT_TRUE(db->ManualCheckPoint().IsCorruption());
+    ASSERT_COWBPT_OK(db->Get(ReadOptions(), key, &result));
+    ASSERT_EQ(result, "logged");
+    it = db->NewIterator(ReadOptions());
+    ASSERT_TRUE(it->status().IsCorruption());
+    delete it;
+    delete db;
+    options.verify_page_checksums = false;
+    options.background_recovery = false;
+    ASSERT_COWBPT_OK(DB::Open(options, testdb_name, &db));
+    ASSERT_COWBPT_OK(db->Get(ReadOptions(), key, &result));
+    ASSERT_EQ(result, "logged");
+    delete db;
+    DestroyDB(testdb_name, options);
+}
+
+TEST(DBImplTest, DBImplPageCompression) {
+    // pages of a realistic size
+    const int32_t node_b_size = FLAGS_COWBPT_NODE_B_SZIE;
+    FLAGS_COWBPT_NODE_B_SZIE = 32;
+    // the bytes of the pages of one checkpoint
+    auto checkpoint_bytes = [](CompressionType compression) {
+        testdb_name = "DBImplPageCompression";
+        Options options;
+        options.page_store = kFilePageStore;
+        options.page_compression = compression;
+        DestroyDB(testdb_name, options);
+        DB* db;
+        EXPECT_COWBPT_OK(DB::Open(options, testdb_name, &db));
+        char key[32];
+        for (int i = 0; i < 5000; i++) {
+            snprintf(key, sizeof(key), "user_key_%08d", i);
+            EXPECT_COWBPT_OK(db->Put(WriteOptions(), key, "v" + std::to_string(i % 100)));
+        }
+        delete db;
+
+        const std::string dir = InternalDBName(testdb_name);
+        std::vector<std::string> filenames;
+        Env::Default()->GetChildren(dir, &filenames);
+        uint64_t bytes = 0;
+        uint64_t number;
+        FileType type;
+        for (auto& filename : filenames) {
+            uint64_t size;
+            if (ParseFileName(filename, &number, &type) && type == kPageSegmentFile &&
+                Env::Default()->GetFileSize(dir + "/" + filename, &size).ok()) {
+                bytes += size;
+            }
+        }
+
+        // the pages are read back
+        EXPECT_COWBPT_OK(DB::Open(options, testdb_name, &db));
+        std::string result;
+        for (int i = 0; i < 5000; i += 7) {
+            snprintf(key, sizeof(key), "user_key_%08d", i);
+            EXPECT_COWBPT_OK(db->Get(ReadOptions(), key, &result));
+            EXPECT_EQ(result, "v" + std::to_string(i % 100));
+        }
+        // the keys are put back together with the prefix of their leaf
+        Iterator* it = db->NewIterator(ReadOptions());
+        int n = 0;
+        for (it->SeekToFirst(); it->Valid(); it->Next(), n++) {
+            snprintf(key, sizeof(key), "user_key_%08d", n);
+            EXPECT_EQ(it->key().string(), key);
+            EXPECT_EQ(it->value().string(), "v" + std::to_string(n % 100));
+        }
+        EXPECT_EQ(n, 5000);
+        delete it;
+        delete db;
+        DestroyDB(testdb_name, options);
+        return bytes;
+    };
+    uint64_t raw = checkpoint_bytes(kNoCompression);
+    uint64_t compressed = checkpoint_bytes(kSnappyCompression);
+    FLAGS_COWBPT_NODE_B_SZIE = node_b_size;
+    ASSERT_GT(raw, 0);
+    // the leaves store the prefix of their keys once, even uncompressed
+    // the pages take less than the keys
+    ASSERT_LT(raw, 5000 * strlen("user_key_00000000"));
+    ASSERT_LT(compressed, raw);
+}
+
+TEST(DBImplTest, DBImplLeafFilters) {
+    // the leaves read back by Gets of missing keys
+    auto leaves_read = [](int bits_per_key) {
+        testdb_name = "DBImplLeafFilters";
+        Options options;
+        options.leaf_filter_bits_per_key = bits_per_key;
+        DestroyDB(testdb_name, options);
+        DB* db;
+        EXPECT_COWBPT_OK(DB::Open(options, testdb_name, &db));
+        for (int i = 0; i < 5000; i++) {
+            EXPECT_COWBPT_OK(db->Put(WriteOptions(), std::to_string(i * 2), "v" + std::to_string(i)));
+        }
+        delete db;
+
+        EXPECT_COWBPT_OK(DB::Open(options, testdb_name, &db));
+        std::string result;
+        for (int i = 0; i < 5000; i++) {
+            EXPECT_TRUE(db->Get(ReadOptions(), std::to_string(i * 2 + 1), &result).IsNotFound());
+        }
+        size_t leaves = 0;
+        std::vector<Bpt::NodePtr> level{static_cast<DBImpl*>(db)->_bpt->get_root_node()};
+        while (!level.empty()) {
+            std::vector<Bpt::NodePtr> next;
+            for (auto& node : level) {
+                if (!node->is_in_memory()) {
+                    continue;
+                }
+                if (node->is_leafnode()) {
+                    leaves++;
+                    continue;
+                }
+                for (auto& child : node->get_child_nodes()) {
+                    next.push_back(child);
+                }
+            }
+            level.swap(next);
+        }
+        // the keys that are there are still found
+        for (int i = 0; i < 5000; i += 7) {
+            EXPECT_COWBPT_OK(db->Get(ReadOptions(), std::to_string(i * 2), &result));
+            EXPECT_EQ(result, "v" + std::to_string(i));
+        }
+        delete db;
+        DestroyDB(testdb_name, options);
+        return leaves;
+    };
+    size_t unfiltered = leaves_read(0);
+    size_t filtered = leaves_read(10);
+    ASSERT_GT(unfiltered, 1000);
+    ASSERT_LT(filtered, unfiltered / 10);
+}
+
+TEST(DBImplTest, DBImplRowCache) {
+    testdb_name = "DBImplRowCache";
+    Options options;
+    options.row_cache_size = 64 << 10;
+    DestroyDB(testdb_name, options);
+    DB* db;
+    ASSERT_COWBPT_OK(DB::Open(options, testdb_name, &db));
+    for (int i = 0; i < 1000; i++) {
+        ASSERT_COWBPT_OK(db->Put(WriteOptions(), std::to_string(i), "v" + std::to_string(i)));
+    }
+    DBImpl* impl = static_cast<DBImpl*>(db);
+    std::string result;
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < 100; i++) {
+            ASSERT_COWBPT_OK(db->Get(ReadOptions(), std::to_string(i), &result));
+            ASSERT_EQ(result, "v" + std::to_string(i));
+        }
+    }
+    RowCache::Stats stats = impl->_row_cache->GetStats();
+    ASSERT_EQ(stats.misses, 100);
+    ASSERT_EQ(stats.hits, 200);
+
+    // the writes go through the cache
+    WriteBatch batch;
+    batch.Put("1", "w1");
+    batch.Delete("2");
+    ASSERT_COWBPT_OK(db->Write(WriteOptions(), &batch));
+    WriteOptions unlogged;
+    unlogged.disable_wal = true;
+    ASSERT_COWBPT_OK(db->Put(unlogged, "3", "w3"));
+    ASSERT_COWBPT_OK(db->Get(ReadOptions(), "1", &result));
+    ASSERT_EQ(result, "w1");
+    ASSERT_TRUE(db->Get(ReadOptions(), "2", &result).IsNotFound());
+    ASSERT_COWBPT_OK(db->Get(ReadOptions(), "3", &result));
+    ASSERT_EQ(result, "w3");
+    ASSERT_COWBPT_OK(db->Get(ReadOptions(), "4", &result));
+    ASSERT_EQ(result, "v4");
+    std::string value;
+    ASSERT_TRUE(db->GetProperty("cowbpt.row-cache-stats", &value));
+    ASSERT_NE(value.find("hits: 201\n"), std::string::npos) << value;
+
+    for (int i = 3; i < 1000; i++) {
+        ASSERT_COWBPT_OK(db->Get(ReadOptions(), std::to_string(i), &result));
+    }
+    ASSERT_TRUE(db->GetProperty("cowbpt.row-cache-usage", &value));
+    ASSERT_LE(std::stoul(value), options.row_cache_size);
+    ASSERT_FALSE(db->GetProperty("cowbpt.no-such-property", &value));
+    delete db;
+    DestroyDB(testdb_name, options);
+}
+
+TEST(DBImplTest, DBImplGetPinned) {
+    testdb_name = "DBImplGetPinned";
+    DestroyDB(testdb_name, Options());
+    DB* db;
+    ASSERT_COWBPT_OK(DB::Open(Options(), testdb_name, &db));
+    const std::string big(64 << 10, 'a');
+    ASSERT_COWBPT_OK(db->Put(WriteOptions(), "big", big));
+    ASSERT_COWBPT_OK(db->Put(WriteOptions(), "small", "s"));
+
+    Slice value;
+    ASSERT_COWBPT_OK(db->Get(ReadOptions(), "big", &value));
+    ASSERT_EQ(value.string(), big);
+    // the value is not copied
+    Slice again;
+    ASSERT_COWBPT_OK(db->Get(ReadOptions(), "big", &again));
+    ASSERT_EQ(value.c_string(), again.c_string());
+
+    // the handle keeps the value it was given
+    ASSERT_COWBPT_OK(db->Put(WriteOptions(), "big", "b"));
+    ASSERT_COWBPT_OK(db->Delete(WriteOptions(), "small"));
+    ASSERT_EQ(value.string(), big);
+    ASSERT_COWBPT_OK(db->Get(ReadOptions(), "big", &value));
+    ASSERT_EQ(value.string(), "b");
+    ASSERT_TRUE(db->Get(ReadOptions(), "small", &value).IsNotFound());
+    ASSERT_EQ(value.string(), "b");
+
+    std::string copied;
+    ASSERT_COWBPT_OK(db->Get(ReadOptions(), "big", &copied));
+    ASSERT_EQ(copied, "b");
+    delete db;
+    DestroyDB(testdb_name, Options());
+}
+
+TEST(DBImplTest, DBImplNodeCapacity) {
+    testdb_name = "DBImplNodeCapacity";
+    // the levels of the tree and the most bytes of a leaf in memory
+    auto shape = [](DB* db, size_t* max_leaf_bytes) {
+        size_t height = 0;
+        *max_leaf_bytes = 0;
+        std::vector<Bpt::NodePtr> level{static_cast<DBImpl*>(db)->_bpt->get_root_node()};
+        while (!level.empty()) {
+            height++;
+            std::vector<Bpt::NodePtr> next;
+            for (auto& node : level) {
+                if (node->is_leafnode()) {
+                    *max_leaf_bytes = std::max(*max_leaf_bytes, node->bytes());
+                    continue;
+                }
+                for (auto& child : node->get_child_nodes()) {
+                    next.push_back(child);
+                }
+            }
+            level.swap(next);
+        }
+        return height;
+    };
+    auto value_of = [](int i) {
+        return std::string(i % 50 == 0 ? 3000 : 100, 'a' + i % 26);
+    };
+    auto fill = [&](const Options& options, size_t* max_leaf_bytes) {
+        DestroyDB(testdb_name, options);
+        DB* db;
+        EXPECT_COWBPT_OK(DB::Open(options, testdb_name, &db));
+        char key[32];
+        for (int i = 0; i < 3000; i++) {
+            snprintf(key, sizeof(key), "key%06d", i);
+            EXPECT_COWBPT_OK(db->Put(WriteOptions(), key, value_of(i)));
+        }
+        return db;
+    };
+
+    size_t max_leaf_bytes;
+    DB* db = fill(Options(), &max_leaf_bytes);
+    const size_t default_height = shape(db, &max_leaf_bytes);
+    delete db;
+
+    Options options;
+    options.node_target_bytes = 4096;
+    db = fill(options, &max_leaf_bytes);
+    const size_t height = shape(db, &max_leaf_bytes);
+    ASSERT_LE(height, 3);
+    ASSERT_GE(default_height, 2 * height);
+    // split once over the target
+    ASSERT_LE(max_leaf_bytes, options.node_target_bytes + 3100);
+
+    // merged back as the keys go
+    char key[32];
+    for (int i = 0; i < 3000; i++) {
+        if (i % 3 != 0) {
+            snprintf(key, sizeof(key), "key%06d", i);
+            ASSERT_COWBPT_OK(db->Delete(WriteOptions(), key));
+        }
+    }
+    std::string result;
+    for (int i = 0; i < 3000; i += 3) {
+        snprintf(key, sizeof(key), "key%06d", i);
+        ASSERT_COWBPT_OK(db->Get(ReadOptions(), key, &result));
+        ASSERT_EQ(result, value_of(i));
+    }
+    delete db;
+
+    // reopened with other limits, the tree keeps the ones it was built with
+    Options others;
+    others.leaf_node_max_entries = 7;
+    ASSERT_COWBPT_OK(DB::Open(others, testdb_name, &db));
+    DBImpl* impl = static_cast<DBImpl*>(db);
+    ASSERT_EQ(impl->_node_capacity.target_bytes, options.node_target_bytes);
+    ASSERT_EQ(impl->_nm->node_capacity().target_bytes, options.node_target_bytes);
+    for (int i = 0; i < 3000; i++) {
+        snprintf(key, sizeof(key), "key%06d", i);
+        if (i % 3 == 1) {
+            ASSERT_COWBPT_OK(db->Put(WriteOptions(), key, value_of(i)));
+        } else if (i % 3 == 0 && i % 2 == 0) {
+            ASSERT_COWBPT_OK(db->Delete(WriteOptions(), key));
+        }
+    }
+    for (int i = 0; i < 3000; i++) {
+        snprintf(key, sizeof(key), "key%06d", i);
+        Status s = db->Get(ReadOptions(), key, &result);
+        if (i % 3 == 1 || (i % 3 == 0 && i % 2 != 0)) {
+            ASSERT_COWBPT_OK(s);
+            ASSERT_EQ(result, value_of(i));
+        } else {
+            ASSERT_TRUE(s.IsNotFound());
+        }
+    }
+    delete db;
+    DestroyDB(testdb_name, options);
+}
+
+TEST(DBImplTest, DBImplFixed64Keys) {
+    testdb_name = "DBImplFixed64Keys";
+    Options options;
+    options.key_format = kFixed64Keys;
+    DestroyDB(testdb_name, options);
+    DB* db;
+    ASSERT_COWBPT_OK(DB::Open(options, testdb_name, &db));
+    auto key_of = [](uint64_t id) {
+        std::string key;
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            key.push_back(static_cast<char>(id >> shift));
+        }
+        return key;
+    };
+    const uint64_t n = 3000;
+    for (uint64_t i = 0; i < n; i++) {
+        // the high bytes too
+        const uint64_t id = (i * 7919 % n) << 40 | i;
+        ASSERT_COWBPT_OK(db->Put(WriteOptions(), key_of(id), std::to_string(id)));
+    }
+    // other keys are ordered by their bytes
+    ASSERT_COWBPT_OK(db->Put(WriteOptions(), "short", "s"));
+    ASSERT_COWBPT_OK(db->Put(WriteOptions(), std::string(9, '\0'), "nine"));
+    delete db;
+
+    // the db is kept in the order of the format it was created with
+    options.key_format = kVariableKeys;
+    ASSERT_TRUE(DB::Open(options, testdb_name, &db).IsInvalidArgument());
+    // the format has no comparator
+    SliceComparator user_comparator;
+    options.key_format = kFixed64Keys;
+    options.comparator = &user_comparator;
+    ASSERT_TRUE(DB::Open(options, testdb_name, &db).IsInvalidArgument());
+    options.comparator = Options().comparator;
+
+    ASSERT_COWBPT_OK(DB::Open(options, testdb_name, &db));
+    std::string result;
+    for (uint64_t i = 0; i < n; i += 7) {
+        const uint64_t id = (i * 7919 % n) << 40 | i;
+        ASSERT_COWBPT_OK(db->Get(ReadOptions(), key_of(id), &result));
+        ASSERT_EQ(result, std::to_string(id));
+    }
+    ASSERT_TRUE(db->Get(ReadOptions(), key_of(n << 40), &result).IsNotFound());
+    Iterator* it = db->NewIterator(ReadOptions());
+    std::string last;
+    size_t count = 0;
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+        std::string key = it->key().string();
+        ASSERT_LT(last, key);
+        last = key;
+        count++;
+    }
+    ASSERT_EQ(count, n + 2);
+    delete it;
+    delete db;
+    DestroyDB(testdb_name, options);
+}
+}
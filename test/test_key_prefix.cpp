@@ -0,0 +1,52 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "key_prefix.h"
+
+using namespace cowbpt;
+
+TEST(KeyPrefixTest, Order) {
+    std::mt19937 rng(301);
+    std::vector<std::string> keys{"", std::string(1, '\0'), "a", "ab", std::string("ab\0", 3),
+                                  "abcdefgh", "abcdefghi", "abcdefgi", "\xff\xff\xff\xff\xff\xff\xff\xff"};
+    for (int i = 0; i < 1000; i++) {
+        std::string key(rng() % 12, '\0');
+        for (auto& c : key) {
+            // few letters, many keys share their prefixes
+            c = static_cast<char>(rng() % 3 == 0 ? 0xf0 + rng() % 4 : 'a' + rng() % 3);
+        }
+        keys.push_back(key);
+    }
+    for (auto& a : keys) {
+        for (size_t j = 0; j < keys.size(); j += 7) {
+            const std::string& b = keys[j];
+            int64_t pa = KeyPrefix(a.data(), a.size());
+            int64_t pb = KeyPrefix(b.data(), b.size());
+            if (a < b) {
+                ASSERT_LE(pa, pb) << a << " " << b;
+            }
+            if (pa < pb) {
+                ASSERT_LT(a, b);
+            }
+        }
+    }
+}
+
+TEST(KeyPrefixTest, LowerBound) {
+    std::mt19937 rng(302);
+    for (size_t n = 0; n < 100; n++) {
+        std::vector<int64_t> prefixes(n);
+        for (auto& p : prefixes) {
+            // duplicates and both signs
+            p = static_cast<int64_t>(rng() % 64) - 32;
+        }
+        std::sort(prefixes.begin(), prefixes.end());
+        for (int64_t p = -34; p <= 34; p++) {
+            size_t expected = std::lower_bound(prefixes.begin(), prefixes.end(), p) - prefixes.begin();
+            ASSERT_EQ(PrefixLowerBound(prefixes.data(), n, p), expected) << n << " " << p << " " << PrefixSearchKernel();
+        }
+    }
+}
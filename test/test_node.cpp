@@ -353,6 +353,50 @@ TEST(NodeTest, LeafNodeSerialize) {
     EXPECT_TRUE(equal(n2->get_leafnode_value("5", node_version), "five"));
 }
 
+TEST(NodeTest, LeafNodeSerializeKeyPrefix) {
+    std::shared_ptr<Node<SliceComparator>> n(new LeafNode<SliceComparator>(cmp));
+    for (int i = 0; i < 50; i++) {
+        char key[64];
+        snprintf(key, sizeof(key), "tenant:7:table:orders:%04d", i);
+        n->put(key, std::to_string(i));
+    }
+    std::string full;
+    n->serialize(full);
+    EXPECT_EQ(full[0], 0);
+
+    // the prefix is found when the leaf is read back
+    std::shared_ptr<Node<SliceComparator>> n2(new LeafNode<SliceComparator>(cmp));
+    ASSERT_TRUE(n2->deserialize(full).ok());
+    std::string packed;
+    n2->serialize(packed);
+    EXPECT_EQ(packed[0], kPageKeyPrefix);
+    // the keys lose the prefix, the page gets it once, length prefixed
+    const size_t prefix_len = strlen("tenant:7:table:orders:00");
+    EXPECT_EQ(packed.size(), full.size() - 50 * prefix_len + 1 + prefix_len);
+
+    for (CompressionType type : {kNoCompression, kSnappyCompression}) {
+        std::string page = packed;
+        ASSERT_TRUE(SealPage(type, &page).ok());
+        uint32_t flags;
+        ASSERT_TRUE(UnsealPage(1, true, &page, &flags).ok());
+        EXPECT_TRUE(flags & kPageKeyPrefix);
+        ASSERT_EQ(page, packed);
+    }
+
+    std::shared_ptr<Node<SliceComparator>> n3(new LeafNode<SliceComparator>(cmp));
+    ASSERT_TRUE(n3->deserialize(packed).ok());
+    ASSERT_EQ(n3->size(), 50);
+    int node_version;
+    for (size_t i = 0; i < n3->size(); i++) {
+        EXPECT_EQ(n3->get_kv(i), n->get_kv(i));
+        EXPECT_TRUE(equal(n3->get_leafnode_value(n->get_kv(i).first, node_version), n->get_kv(i).second));
+    }
+    EXPECT_TRUE(n3->get_leafnode_value("tenant:7:table:orders:0050", node_version).empty());
+    std::string again;
+    n3->serialize(again);
+    EXPECT_EQ(again, packed);
+}
+
 TEST(NodeTest, InternalNodeSerialize) {
     std::shared_ptr<Node<SliceComparator>> n1(new InternalNode<SliceComparator>(cmp));
     std::shared_ptr<Node<SliceComparator>> leaf1(new LeafNode<SliceComparator>(cmp));
@@ -388,4 +432,38 @@ TEST(NodeTest, InternalNodeSerialize) {
     EXPECT_EQ(n2->get_internalnode_value("4")->get_node_id(),
               n1->get_internalnode_value("4")->get_node_id());
 
-}
\ No newline at end of file
+}
+
+TEST(NodeTest, LeafNodeTargetBytes) {
+    std::shared_ptr<Node<SliceComparator>> n(new LeafNode<SliceComparator>(cmp));
+    n->set_capacity(NodeCapacity{1000, 1000, 200});
+    const std::string big(100, 'b');
+    n->put("1", "one");
+    n->put("2", big);
+    n->put("3", big);
+    // a few entries over the target are not split
+    EXPECT_EQ(n->bytes(), 4 + 101 + 101);
+    EXPECT_FALSE(n->need_split());
+    n->put("4", "four");
+    n->put("5", "five");
+    n->put("6", "six");
+    EXPECT_TRUE(n->need_split());
+    EXPECT_FALSE(n->need_fix(false));
+
+    // cut in the middle of the bytes
+    Slice split_key;
+    auto n2 = n->split(split_key);
+    EXPECT_TRUE(equal(split_key, "4"));
+    EXPECT_EQ(n2->capacity().target_bytes, 200);
+    EXPECT_EQ(n->bytes(), 4 + 101 + 101);
+    EXPECT_EQ(n2->bytes(), 5 + 5 + 4);
+    EXPECT_FALSE(n->need_split());
+
+    // down to a quarter of the target
+    EXPECT_FALSE(n->need_fix(false));
+    n->erase("2");
+    EXPECT_FALSE(n->need_fix(false));
+    n->erase("3");
+    EXPECT_TRUE(n->need_fix(false));
+    EXPECT_TRUE(n2->need_fix(false));
+}
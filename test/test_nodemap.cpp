@@ -107,6 +107,153 @@ TEST(NodeMapTest, LeafNodeMapCRUD) {
   EXPECT_TRUE(equal(p.second, "six"));
 }
 
+// the fingerprints follow the keys through every write of the leaf
+TEST(NodeMapTest, LeafNodeMapFingerprints) {
+  typedef LeafNodeMap<Slice, Slice, SliceComparator> Map;
+  auto check = [](Map* m) {
+    ASSERT_EQ(m->_fingerprints.size(), m->size());
+    for (size_t i = 0; i < m->size(); i++) {
+      const Slice& suffix = m->_v[i].first;
+      ASSERT_EQ(m->_fingerprints[i], KeyFingerprint(suffix.c_string(), suffix.size()));
+      Slice key = m->get_kv(i).first;
+      ASSERT_TRUE(equal(m->get(key), "v" + key.string()));
+    }
+  };
+  std::unique_ptr<Map> m(new Map(cmp));
+  // enough keys for some to share a fingerprint
+  for (int i = 0; i < 600; i++) {
+    std::string key = "key" + std::to_string(i * 7 % 600);
+    m->put(key, Slice("v" + key));
+  }
+  check(m.get());
+  for (int i = 0; i < 600; i += 3) {
+    m->erase("key" + std::to_string(i));
+  }
+  check(m.get());
+  EXPECT_TRUE(m->get("key0").empty());
+  EXPECT_TRUE(m->get("key600").empty());
+
+  Slice split_key;
+  std::unique_ptr<Map> right(m->split(split_key, 150));
+  check(m.get());
+  check(right.get());
+  EXPECT_TRUE(m->get(split_key).empty());
+  Slice k;
+  m->pop_first_leaf_node_value_and_second_key(k);
+  right->pop_last_leaf_node_value_and_last_key();
+  check(m.get());
+  check(right.get());
+  m->append_right(right.get());
+  check(m.get());
+  check(right.get());
+  EXPECT_EQ(m->size(), 398);
+
+  // the probe, around its blocks of 16
+  std::vector<uint8_t> fps(40, 1);
+  fps[3] = 7;
+  fps[16] = 7;
+  fps[39] = 7;
+  EXPECT_EQ(FindFingerprint(fps.data(), fps.size(), 0, 7), 3);
+  EXPECT_EQ(FindFingerprint(fps.data(), fps.size(), 4, 7), 16);
+  EXPECT_EQ(FindFingerprint(fps.data(), fps.size(), 17, 7), 39);
+  EXPECT_EQ(FindFingerprint(fps.data(), fps.size(), 40, 7), 40);
+  EXPECT_EQ(FindFingerprint(fps.data(), fps.size(), 0, 9), 40);
+}
+
+TEST(NodeMapTest, LeafNodeMapShortestSeparator) {
+  EXPECT_EQ(cmp.shortest_separator("apple", "apricot").string(), "apr");
+  EXPECT_EQ(cmp.shortest_separator("ab", "abc").string(), "abc");
+  EXPECT_EQ(cmp.shortest_separator("", "b").string(), "b");
+
+  LeafNodeMap<Slice, Slice, SliceComparator> lnm(cmp);
+  lnm.put("user:0001:profile", Slice("one"));
+  lnm.put("user:0002:profile", Slice("two"));
+  lnm.put("user:0100:profile", Slice("three"));
+  lnm.put("user:0200:profile", Slice("four"));
+  Slice split_key;
+  std::unique_ptr<LeafNodeMap<Slice, Slice, SliceComparator>> right(lnm.split(split_key, 2));
+  // between the last key of the left and the first key of the right
+  EXPECT_EQ(split_key.string(), "user:01");
+  EXPECT_TRUE(equal(lnm.get("user:0002:profile"), "two"));
+  EXPECT_TRUE(equal(right->get("user:0100:profile"), "three"));
+}
+
+// the keys are stored without the bytes they all start with
+TEST(NodeMapTest, LeafNodeMapKeyPrefix) {
+  typedef LeafNodeMap<Slice, Slice, SliceComparator> Map;
+  auto check = [](Map* m, const std::string& prefix) {
+    ASSERT_EQ(m->prefix().string(), prefix);
+    size_t bytes = 0;
+    for (size_t i = 0; i < m->size(); i++) {
+      auto kv = m->get_kv(i);
+      ASSERT_EQ(kv.first.string(), prefix + m->_v[i].first.string());
+      ASSERT_TRUE(equal(m->get(kv.first), kv.second));
+      if (i > 0) {
+        ASSERT_LT(m->get_kv(i - 1).first.compare(kv.first), 0);
+      }
+      bytes += kv.first.size() + kv.second.size();
+    }
+    ASSERT_EQ(m->bytes(), bytes);
+  };
+  std::unique_ptr<Map> m(new Map(cmp));
+  for (int i = 0; i < 20; i++) {
+    char key[64];
+    snprintf(key, sizeof(key), "tenant:7:table:orders:%04d", i * 10);
+    m->put(key, Slice("v" + std::to_string(i)));
+  }
+  // grown only when split, and when the map is read back
+  check(m.get(), "");
+
+  Slice split_key;
+  std::unique_ptr<Map> right(m->split(split_key, 10));
+  EXPECT_EQ(split_key.string(), "tenant:7:table:orders:01");
+  check(m.get(), "tenant:7:table:orders:00");
+  check(right.get(), "tenant:7:table:orders:01");
+  EXPECT_TRUE(m->get("tenant:7:table:orders:0100").empty());
+  EXPECT_TRUE(m->get("tenant:7:table:orders:009").empty());
+  EXPECT_TRUE(m->get("tenant").empty());
+
+  // a key in the prefix is copied without it, with its value
+  Slice key("tenant:7:table:orders:0055");
+  Slice value("v55");
+  m->put(key, value);
+  check(m.get(), "tenant:7:table:orders:00");
+  const auto& kv = m->_v[6];
+  EXPECT_EQ(kv.first.string(), "55");
+  EXPECT_NE(kv.first._rep, key._rep);
+  EXPECT_EQ(kv.first._rep, kv.second._rep);
+  m->erase(key);
+
+  // a key out of the prefix clears it
+  m->put("tenant:7:table:order", Slice("short"));
+  check(m.get(), "");
+  EXPECT_TRUE(equal(m->get("tenant:7:table:order"), "short"));
+  m->erase("tenant:7:table:order");
+  m->erase("tenant:8");
+  check(m.get(), "");
+
+  Slice k;
+  auto p = right->pop_first_leaf_node_value_and_second_key(k);
+  EXPECT_EQ(k.string(), "tenant:7:table:orders:0100");
+  EXPECT_EQ(p.first.string(), "tenant:7:table:orders:0110");
+  p = m->pop_last_leaf_node_value_and_last_key();
+  EXPECT_EQ(p.first.string(), "tenant:7:table:orders:0090");
+  check(m.get(), "");
+  check(right.get(), "tenant:7:table:orders:01");
+
+  m->append_right(right.get());
+  EXPECT_EQ(m->size(), 18);
+  check(m.get(), "tenant:7:table:orders:0");
+  check(right.get(), "");
+
+  std::unique_ptr<Map> c(m->copy());
+  check(c.get(), "tenant:7:table:orders:0");
+  for (size_t i = 0; i < m->size(); i++) {
+    c->erase(m->get_kv(i).first);
+  }
+  check(c.get(), "");
+}
+
 TEST(NodeMapTest, InternalNodeMapCRUD) {
   std::shared_ptr<Node<SliceComparator>> n(new LeafNode<SliceComparator>(cmp));
   n->put("1", "one");
@@ -218,4 +365,51 @@ TEST(NodeMapTest, InternalNodeMapCRUD) {
   // nm3: _                          0.9
   //      | n5 leaf: 0.6, 0.7, 0.8    | n3 leaf: 0.9, 1, 2 
 
-}
\ No newline at end of file
+}
+TEST(NodeMapTest, InternalNodeMapPrefixes) {
+  typedef InternalNodeMap<Slice, std::shared_ptr<Node<SliceComparator>>, SliceComparator> Map;
+  auto check = [](Map* m) {
+    ASSERT_EQ(m->_prefixes.size(), m->size());
+    for (size_t i = 0; i < m->size(); i++) {
+      ASSERT_EQ(m->_prefixes[i], KeyPrefix(m->_v[i].first.c_string(), m->_v[i].first.size())) << i;
+    }
+  };
+  auto key = [](int i) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "key_%08d", i);
+    return Slice(std::string(buf));
+  };
+
+  Map* m = new Map(cmp, nullptr, key(505), nullptr);
+  for (int i = 1; i < 100; i++) {
+    m->put(key(i * 10), nullptr);
+  }
+  check(m);
+  m->erase(key(505));
+  m->erase(key(10));
+  check(m);
+  m->push_front(nullptr, key(5));
+  check(m);
+  m->pop_first_internal_node_value_and_second_key();
+  m->pop_last_internal_node_value_and_last_key();
+  check(m);
+
+  Slice split_key;
+  Map* right = m->split(split_key);
+  check(m);
+  check(right);
+  m->append_right(right, split_key);
+  check(m);
+  check(right);
+  delete right;
+
+  // read back in order
+  Map* copy = new Map(cmp);
+  for (auto& p : m->_v) {
+    copy->push_back(p.first, p.second);
+  }
+  copy->build_prefixes();
+  check(copy);
+  delete copy;
+  delete m;
+}
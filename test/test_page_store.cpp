@@ -0,0 +1,381 @@
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bloom.h"
+#include "coding.h"
+#include "env.h"
+#include "filename.h"
+#include "page_format.h"
+#include "page_store.h"
+
+using namespace cowbpt;
+
+namespace cowbpt {
+
+MATCHER(IsOK, "") { return arg.ok(); }
+
+#define EXPECT_COWBPT_OK(expression) \
+  EXPECT_THAT(expression, cowbpt::IsOK())
+#define ASSERT_COWBPT_OK(expression) \
+  ASSERT_THAT(expression, cowbpt::IsOK())
+
+namespace {
+    void check_versions(PageStoreType type, const std::string& name) {
+        Options options;
+        options.page_store = type;
+        DestroyPageStore(options, name);
+
+        PageStore* store;
+        ASSERT_COWBPT_OK(OpenPageStore(options, name, &store));
+        std::string value;
+        ASSERT_TRUE(store->GetPage(1, 0, &value).IsNotFound());
+        ASSERT_TRUE(store->GetMeta("RootPageID", &value).IsNotFound());
+
+        PageBatch batch;
+        batch.PutPage(1, "page1.v1");
+        batch.PutPage(2, "page2.v1");
+        batch.PutMeta("RootPageID", "1");
+        ASSERT_COWBPT_OK(store->Write(batch, false));
+        uint64_t s1 = store->GetDurableSnapshot();
+        ASSERT_NE(s1, 0);
+
+        batch.Clear();
+        batch.PutPage(1, "page1.v2");
+        batch.DeletePage(2);
+        batch.PutPage(3, "page3.v1");
+        batch.PutMeta("RootPageID", "3");
+        ASSERT_COWBPT_OK(store->Write(batch, true));
+
+        // the snapshot reads the pages as they were when it was taken
+        ASSERT_COWBPT_OK(store->GetPage(1, s1, &value));
+        ASSERT_EQ(value, "page1.v1");
+        ASSERT_COWBPT_OK(store->GetPage(2, s1, &value));
+        ASSERT_EQ(value, "page2.v1");
+        ASSERT_TRUE(store->GetPage(3, s1, &value).IsNotFound());
+        ASSERT_COWBPT_OK(store->GetPage(1, 0, &value));
+        ASSERT_EQ(value, "page1.v2");
+        ASSERT_TRUE(store->GetPage(2, 0, &value).IsNotFound());
+        ASSERT_COWBPT_OK(store->GetMeta("RootPageID", &value));
+        ASSERT_EQ(value, "3");
+
+        // read together, as GetPage() reads them one by one
+        uint64_t page_ids[] = {3, 1, 2, 4};
+        std::string pages[4];
+        Status statuses[4];
+        store->GetPages(page_ids, 4, s1, pages, statuses);
+        ASSERT_TRUE(statuses[0].IsNotFound());
+        ASSERT_COWBPT_OK(statuses[1]);
+        ASSERT_EQ(pages[1], "page1.v1");
+        ASSERT_COWBPT_OK(statuses[2]);
+        ASSERT_EQ(pages[2], "page2.v1");
+        ASSERT_TRUE(statuses[3].IsNotFound());
+
+        uint64_t s2 = store->GetDurableSnapshot();
+        ASSERT_GT(s2, s1);
+        store->ReleaseDurableSnapshot(s1);
+        batch.Clear();
+        batch.PutPage(1, "page1.v3");
+        ASSERT_COWBPT_OK(store->Write(batch, false));
+        ASSERT_COWBPT_OK(store->GetPage(1, s2, &value));
+        ASSERT_EQ(value, "page1.v2");
+        ASSERT_TRUE(store->GetPage(2, s2, &value).IsNotFound());
+        ASSERT_COWBPT_OK(store->GetPage(3, s2, &value));
+        ASSERT_EQ(value, "page3.v1");
+        uint64_t s3 = store->GetDurableSnapshot();
+        delete store;
+
+        // the snapshots taken before closing the store are still readable
+        ASSERT_COWBPT_OK(OpenPageStore(options, name, &store));
+        ASSERT_COWBPT_OK(store->GetPage(1, s2, &value));
+        ASSERT_EQ(value, "page1.v2");
+        ASSERT_COWBPT_OK(store->GetPage(1, s3, &value));
+        ASSERT_EQ(value, "page1.v3");
+        ASSERT_GE(store->GetDurableSnapshot(), s3);
+        delete store;
+        ASSERT_COWBPT_OK(DestroyPageStore(options, name));
+    }
+
+    void check_unpinned_writes(PageStoreType type, const std::string& name) {
+        Options options;
+        options.page_store = type;
+        DestroyPageStore(options, name);
+
+        PageStore* store;
+        ASSERT_COWBPT_OK(OpenPageStore(options, name, &store));
+        PageBatch batch;
+        batch.PutPage(1, "page1.v1");
+        ASSERT_COWBPT_OK(store->Write(batch, false));
+        uint64_t s1 = store->GetDurableSnapshot();
+        // a checkpoint that never finished
+        batch.Clear();
+        batch.PutPage(1, "page1.v2");
+        ASSERT_COWBPT_OK(store->Write(batch, false));
+        delete store;
+
+        ASSERT_COWBPT_OK(OpenPageStore(options, name, &store));
+        batch.Clear();
+        batch.PutPage(2, "page2.v1");
+        ASSERT_COWBPT_OK(store->Write(batch, false));
+        uint64_t s2 = store->GetDurableSnapshot();
+        ASSERT_GT(s2, s1);
+        std::string value;
+        ASSERT_COWBPT_OK(store->GetPage(1, s2, &value));
+        ASSERT_EQ(value, "page1.v1");
+        ASSERT_COWBPT_OK(store->GetPage(1, 0, &value));
+        ASSERT_EQ(value, "page1.v1");
+        delete store;
+        ASSERT_COWBPT_OK(DestroyPageStore(options, name));
+    }
+
+    void check_versions_after_reopen(PageStoreType type, const std::string& name) {
+        Options options;
+        options.page_store = type;
+        DestroyPageStore(options, name);
+
+        PageStore* store;
+        ASSERT_COWBPT_OK(OpenPageStore(options, name, &store));
+        PageBatch batch;
+        batch.PutPage(1, "page1.v1");
+        ASSERT_COWBPT_OK(store->Write(batch, false));
+        uint64_t s1 = store->GetDurableSnapshot();
+        batch.Clear();
+        batch.PutPage(1, "page1.v2");
+        ASSERT_COWBPT_OK(store->Write(batch, false));
+        uint64_t s2 = store->GetDurableSnapshot();
+        delete store;
+
+        // the old version is dropped by a release after the reopen
+        for (int i = 0; i < 3; i++) {
+            ASSERT_COWBPT_OK(OpenPageStore(options, name, &store));
+            delete store;
+        }
+        ASSERT_COWBPT_OK(OpenPageStore(options, name, &store));
+        std::string value;
+        ASSERT_COWBPT_OK(store->GetPage(1, s1, &value));
+        ASSERT_EQ(value, "page1.v1");
+        uint64_t s3 = store->GetDurableSnapshot();
+        store->ReleaseDurableSnapshot(s2);
+        ASSERT_TRUE(store->GetPage(1, s1, &value).IsNotFound());
+        ASSERT_COWBPT_OK(store->GetPage(1, s3, &value));
+        ASSERT_EQ(value, "page1.v2");
+        delete store;
+        ASSERT_COWBPT_OK(DestroyPageStore(options, name));
+    }
+}
+
+TEST(PageStoreTest, LevelDBVersions) {
+    check_versions(kLevelDBPageStore, "PageStoreLevelDBVersions");
+}
+
+TEST(PageStoreTest, RocksDBVersions) {
+    check_versions(kRocksDBPageStore, "PageStoreRocksDBVersions");
+}
+
+TEST(PageStoreTest, RocksDBSkipsUnpinnedWrites) {
+    check_unpinned_writes(kRocksDBPageStore, "PageStoreRocksDBSkipsUnpinnedWrites");
+}
+
+TEST(PageStoreTest, RocksDBVersionsAfterReopen) {
+    check_versions_after_reopen(kRocksDBPageStore, "PageStoreRocksDBVersionsAfterReopen");
+}
+
+TEST(PageStoreTest, FileVersions) {
+    check_versions(kFilePageStore, "PageStoreFileVersions");
+}
+
+TEST(PageStoreTest, FileVersionsAfterReopen) {
+    check_versions_after_reopen(kFilePageStore, "PageStoreFileVersionsAfterReopen");
+}
+
+TEST(PageStoreTest, FileSkipsUnpinnedWrites) {
+    check_unpinned_writes(kFilePageStore, "PageStoreFileSkipsUnpinnedWrites");
+}
+
+TEST(PageStoreTest, FileCleansSegments) {
+    Options options;
+    options.page_store = kFilePageStore;
+    options.page_segment_size = 4096;
+    const std::string name = "PageStoreFileCleansSegments";
+    DestroyPageStore(options, name);
+
+    auto segments = [&]() {
+        std::vector<std::string> filenames;
+        Env::Default()->GetChildren(name, &filenames);
+        size_t n = 0;
+        uint64_t number;
+        FileType type;
+        for (auto& filename : filenames) {
+            if (ParseFileName(filename, &number, &type) && type == kPageSegmentFile) {
+                n++;
+            }
+        }
+        return n;
+    };
+
+    PageStore* store;
+    ASSERT_COWBPT_OK(OpenPageStore(options, name, &store));
+    uint64_t snapshot = 0;
+    for (int round = 0; round < 10; round++) {
+        PageBatch batch;
+        for (uint64_t page = 1; page <= 20; page++) {
+            batch.PutPage(page, std::string(1000, 'a' + round) + std::to_string(page));
+        }
+        ASSERT_COWBPT_OK(store->Write(batch, false));
+        uint64_t next = store->GetDurableSnapshot();
+        store->ReleaseDurableSnapshot(snapshot);
+        snapshot = next;
+    }
+    // 200 pages were written, only the 20 of the last round are live
+    for (int i = 0; i < 1000 && segments() > 14; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_LE(segments(), 14);
+
+    std::string value;
+    for (uint64_t page = 1; page <= 20; page++) {
+        ASSERT_COWBPT_OK(store->GetPage(page, snapshot, &value));
+        ASSERT_EQ(value, std::string(1000, 'j') + std::to_string(page));
+    }
+    delete store;
+
+    ASSERT_COWBPT_OK(OpenPageStore(options, name, &store));
+    for (uint64_t page = 1; page <= 20; page++) {
+        ASSERT_COWBPT_OK(store->GetPage(page, snapshot, &value));
+        ASSERT_EQ(value, std::string(1000, 'j') + std::to_string(page));
+    }
+    delete store;
+    ASSERT_COWBPT_OK(DestroyPageStore(options, name));
+}
+
+
+TEST(PageStoreTest, PageChecksum) {
+    // a leaf with the entry "k" -> "v"
+    std::string node;
+    PutVarint32(&node, 0);
+    PutLengthPrefixedSlice(&node, "k");
+    PutLengthPrefixedSlice(&node, "v");
+
+    std::string page = node;
+    ASSERT_COWBPT_OK(SealPage(kNoCompression, &page));
+    ASSERT_EQ(page.size(), node.size() + 4);
+    uint32_t flags;
+    std::string unsealed = page;
+    ASSERT_COWBPT_OK(UnsealPage(1, true, &unsealed, &flags));
+    ASSERT_EQ(flags, kPageChecksum);
+    ASSERT_EQ(unsealed, node);
+
+    for (size_t i = 0; i < page.size(); i++) {
+        std::string damaged = page;
+        damaged[i] ^= 0x10;
+        ASSERT_TRUE(UnsealPage(1, true, &damaged, &flags).IsCorruption()) << i;
+    }
+
+    // written before the pages had checksums
+    unsealed = node;
+    ASSERT_COWBPT_OK(UnsealPage(1, true, &unsealed, &flags));
+    ASSERT_EQ(flags, 0);
+    ASSERT_EQ(unsealed, node);
+}
+
+
+TEST(PageStoreTest, PageCompression) {
+    std::string leaf;
+    PutVarint32(&leaf, 0);
+    std::string internal;
+    PutVarint32(&internal, 1);
+    PutLengthPrefixedSlice(&internal, "");
+    PutVarint32(&internal, 0);
+    PutVarint64(&internal, 7);
+    for (int i = 0; i < 100; i++) {
+        char key[32];
+        snprintf(key, sizeof(key), "user_key_%08d", i * 3);
+        PutLengthPrefixedSlice(&leaf, key);
+        PutLengthPrefixedSlice(&leaf, std::string(i % 10, 'v'));
+        PutLengthPrefixedSlice(&internal, key);
+        PutVarint32(&internal, 0);
+        PutVarint64(&internal, 1000 + i);
+    }
+
+    for (const std::string& node : {leaf, internal}) {
+        for (CompressionType type : {kNoCompression, kSnappyCompression}) {
+            std::string page = node;
+            ASSERT_COWBPT_OK(SealPage(type, &page));
+            if (type != kNoCompression) {
+                ASSERT_LT(page.size(), node.size() * 2 / 3);
+            }
+            uint32_t flags;
+            ASSERT_COWBPT_OK(UnsealPage(1, true, &page, &flags));
+            ASSERT_EQ(flags & kInternalPage, node[0]);
+            ASSERT_EQ(page, node);
+        }
+    }
+
+    std::vector<uint64_t> child_ids;
+    std::string page = internal;
+    ASSERT_COWBPT_OK(SealPage(kSnappyCompression, &page));
+    uint32_t flags;
+    ASSERT_COWBPT_OK(UnsealPage(1, false, &page, &flags));
+    ASSERT_COWBPT_OK(GetChildPageIDs(1, page, &child_ids));
+    ASSERT_EQ(child_ids.size(), 101);
+    ASSERT_EQ(child_ids[0], 7);
+    ASSERT_EQ(child_ids[100], 1099);
+
+    // a truncated entry is not sealed into a half built page
+    page = leaf.substr(0, leaf.size() - 1);
+    std::string truncated = page;
+    ASSERT_TRUE(SealPage(kSnappyCompression, &page).IsCorruption());
+    ASSERT_EQ(page, truncated);
+}
+
+
+TEST(PageStoreTest, ChildFilters) {
+    std::vector<std::string> keys;
+    for (int i = 0; i < 1000; i++) {
+        keys.push_back("key" + std::to_string(i * 2));
+    }
+    std::vector<Slice> slices(keys.begin(), keys.end());
+    std::string filter;
+    CreateBloomFilter(slices, 10, &filter);
+    for (auto& key : keys) {
+        ASSERT_TRUE(BloomFilterMayMatch(key, filter.data(), filter.size()));
+    }
+    int false_positives = 0;
+    for (int i = 0; i < 1000; i++) {
+        std::string key = "key" + std::to_string(i * 2 + 1);
+        if (BloomFilterMayMatch(key, filter.data(), filter.size())) {
+            false_positives++;
+        }
+    }
+    ASSERT_LT(false_positives, 30);
+    ASSERT_TRUE(BloomFilterMayMatch("key1", "", 0));
+
+    // an internal page with a filter for its second child
+    std::string internal;
+    PutVarint32(&internal, kInternalPage | kPageChildFilters);
+    PutLengthPrefixedSlice(&internal, "");
+    PutVarint32(&internal, 0);
+    PutVarint64(&internal, 7);
+    PutLengthPrefixedSlice(&internal, "");
+    PutLengthPrefixedSlice(&internal, "key1000");
+    PutVarint32(&internal, 0);
+    PutVarint64(&internal, 8);
+    PutLengthPrefixedSlice(&internal, filter);
+
+    for (CompressionType type : {kNoCompression, kSnappyCompression}) {
+        std::string page = internal;
+        ASSERT_COWBPT_OK(SealPage(type, &page));
+        uint32_t flags;
+        ASSERT_COWBPT_OK(UnsealPage(1, true, &page, &flags));
+        ASSERT_TRUE(flags & kPageChildFilters);
+        ASSERT_EQ(page, internal);
+        std::vector<uint64_t> child_ids;
+        ASSERT_COWBPT_OK(GetChildPageIDs(1, page, &child_ids));
+        ASSERT_EQ(child_ids, std::vector<uint64_t>({7, 8}));
+    }
+}
+
+}
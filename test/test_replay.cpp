@@ -0,0 +1,73 @@
+#include <gtest/gtest.h>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "replay.h"
+#include "bpt.h"
+#include "comparator.h"
+#include "random.h"
+#include "write_batch_internal.h"
+
+using namespace cowbpt;
+
+extern SliceComparator cmp;
+
+namespace {
+    void replay_and_check(int threads, bool sorted_apply) {
+        Bpt bpt(&cmp);
+        std::map<std::string, std::string> expected;
+        Random rnd(301);
+
+        LogReplayer replayer(&bpt, &cmp, threads, sorted_apply);
+        // enough operations to go past the sample used to pick the key ranges
+        for (int i = 0; i < 2000; i++) {
+            std::unique_ptr<WriteBatch> batch(new WriteBatch());
+            for (int j = 0; j < 50; j++) {
+                std::string key = std::to_string(rnd.Uniform(5000));
+                if (rnd.OneIn(4)) {
+                    batch->Delete(key);
+                    expected.erase(key);
+                } else {
+                    std::string value = key + "-" + std::to_string(i) + "-" + std::to_string(j);
+                    batch->Put(key, value);
+                    expected[key] = value;
+                }
+            }
+            replayer.Add(std::move(batch));
+        }
+        ASSERT_TRUE(replayer.Finish().ok());
+
+        for (int i = 0; i < 5000; i++) {
+            std::string key = std::to_string(i);
+            auto it = expected.find(key);
+            if (it == expected.end()) {
+                ASSERT_TRUE(bpt.get(key).empty());
+            } else {
+                ASSERT_EQ(bpt.get(key).string(), it->second);
+            }
+        }
+    }
+}
+
+TEST(LogReplayerTest, SingleThread) {
+    replay_and_check(1, false);
+}
+
+TEST(LogReplayerTest, MultipleThreads) {
+    replay_and_check(4, false);
+}
+
+TEST(LogReplayerTest, SortedApply) {
+    replay_and_check(4, true);
+}
+
+TEST(LogReplayerTest, CorruptedBatch) {
+    Bpt bpt(&cmp);
+    LogReplayer replayer(&bpt, &cmp, 2, false);
+    std::unique_ptr<WriteBatch> batch(new WriteBatch());
+    batch->Put("a", "b");
+    WriteBatchInternal::SetCount(batch.get(), 2);
+    replayer.Add(std::move(batch));
+    ASSERT_TRUE(replayer.Finish().IsCorruption());
+}
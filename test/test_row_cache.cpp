@@ -0,0 +1,72 @@
+#include <gtest/gtest.h>
+#include <string>
+
+#include "row_cache.h"
+
+using namespace cowbpt;
+
+TEST(RowCacheTest, LookupAndErase) {
+    RowCache cache(1 << 20);
+    Slice value;
+    uint64_t ticket;
+    ASSERT_FALSE(cache.Lookup("k1", &value, &ticket));
+    cache.Insert("k1", "v1", ticket);
+    ASSERT_TRUE(cache.Lookup("k1", &value, &ticket));
+    ASSERT_EQ(value.string(), "v1");
+
+    cache.Erase("k1");
+    ASSERT_FALSE(cache.Lookup("k1", &value, &ticket));
+
+    RowCache::Stats stats = cache.GetStats();
+    ASSERT_EQ(stats.hits, 1);
+    ASSERT_EQ(stats.misses, 2);
+    ASSERT_EQ(stats.inserts, 1);
+    ASSERT_EQ(stats.entries, 0);
+    ASSERT_EQ(stats.usage, 0);
+}
+
+TEST(RowCacheTest, EraseBeforeInsert) {
+    RowCache cache(1 << 20);
+    Slice value;
+    uint64_t ticket;
+    ASSERT_FALSE(cache.Lookup("k1", &value, &ticket));
+    // a write of k1 lands between the read of the tree and the Insert
+    cache.Erase("k1");
+    cache.Insert("k1", "old", ticket);
+    ASSERT_FALSE(cache.Lookup("k1", &value, &ticket));
+    cache.Insert("k1", "new", ticket);
+    ASSERT_TRUE(cache.Lookup("k1", &value, &ticket));
+    ASSERT_EQ(value.string(), "new");
+}
+
+TEST(RowCacheTest, Capacity) {
+    RowCache cache(16 << 10);
+    Slice value;
+    uint64_t ticket;
+    for (int i = 0; i < 1000; i++) {
+        std::string key = "key" + std::to_string(i);
+        ASSERT_FALSE(cache.Lookup(key, &value, &ticket));
+        cache.Insert(key, std::string(100, 'v'), ticket);
+    }
+    RowCache::Stats stats = cache.GetStats();
+    ASSERT_LE(stats.usage, cache.capacity());
+    ASSERT_GT(stats.evictions, 0);
+    ASSERT_EQ(stats.inserts, stats.entries + stats.evictions);
+    // the last keys are still there
+    ASSERT_TRUE(cache.Lookup("key999", &value, &ticket));
+    ASSERT_FALSE(cache.Lookup("key0", &value, &ticket));
+}
+
+TEST(RowCacheTest, CopiesValue) {
+    RowCache cache(1 << 20);
+    Slice value;
+    uint64_t ticket;
+    // the value of a leaf shares the allocation of its page
+    Slice page(std::string(4096, 'v'));
+    ASSERT_FALSE(cache.Lookup("k1", &value, &ticket));
+    cache.Insert("k1", Slice(page, 10), ticket);
+    ASSERT_TRUE(cache.Lookup("k1", &value, &ticket));
+    ASSERT_EQ(value.string(), std::string(10, 'v'));
+    ASSERT_NE(value.c_string(), page.c_string());
+    ASSERT_EQ(cache.GetStats().usage, 2 + 10);
+}
@@ -37,4 +37,50 @@ TEST(SliceTest, SliceBasic) {
     Slice cnm;
     cnm = Slice("cnm");
     EXPECT_EQ(cnm.string(), "cnm");
-}
\ No newline at end of file
+}
+
+TEST(SliceTest, SliceSharing) {
+    Slice a("hello world");
+    Slice b = a;
+    EXPECT_EQ(a.c_string(), b.c_string());
+    Slice c(a, 5);
+    EXPECT_EQ(c.string(), "hello");
+    EXPECT_EQ(c.c_string(), a.c_string());
+    a.clear();
+    b = Slice();
+    // c still holds the bytes
+    EXPECT_EQ(c.string(), "hello");
+    c.remove_prefix(1);
+    EXPECT_EQ(c.string(), "ello");
+    Slice d(std::move(c));
+    EXPECT_TRUE(c.empty());
+    EXPECT_EQ(d.string(), "ello");
+
+    Slice key, value;
+    Slice::CopyPair("key", "value", &key, &value);
+    EXPECT_EQ(key.string(), "key");
+    EXPECT_EQ(value.string(), "value");
+    EXPECT_EQ(key.c_string() + key.size(), value.c_string());
+    Slice::CopyPair("", "", &key, &value);
+    EXPECT_TRUE(key.empty());
+    EXPECT_TRUE(value.empty());
+}
+
+TEST(SliceTest, SliceCompare) {
+    EXPECT_LT(Slice("abc").compare(Slice("abd")), 0);
+    EXPECT_LT(Slice("ab").compare(Slice("abc")), 0);
+    EXPECT_EQ(Slice("abc").compare(Slice("abc")), 0);
+    EXPECT_GT(Slice("b").compare(Slice("abc")), 0);
+    // bytes are unsigned, like std::string
+    EXPECT_TRUE(less(Slice("\x01"), Slice("\xff")));
+    EXPECT_FALSE(less(Slice("\xff"), Slice("\x01")));
+
+    std::string s = "abc";
+    SliceView v(s);
+    EXPECT_EQ(v.data(), s.data());
+    EXPECT_TRUE(v == SliceView(Slice("abc")));
+    EXPECT_TRUE(v.starts_with("ab"));
+    v.remove_prefix(1);
+    EXPECT_EQ(v.string(), "bc");
+    EXPECT_EQ(Slice(v).string(), "bc");
+}
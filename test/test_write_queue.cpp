@@ -0,0 +1,74 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "write_queue.h"
+#include "write_batch.h"
+
+using namespace cowbpt;
+
+namespace {
+    typedef WriteQueue::Writer Writer;
+
+    // commit every writer that is queued behind the leader as one group
+    void commit_group(WriteQueue* q, Writer* leader, std::atomic<int>* leaders, int* committed) {
+        ASSERT_EQ(leaders->fetch_add(1), 0);
+        Writer* last_writer = leader;
+        Writer* newest = q->LinkGroup(leader);
+        int group_size = 1;
+        while (last_writer != newest && last_writer->link_newer->batch != nullptr) {
+            last_writer = last_writer->link_newer;
+            group_size++;
+        }
+        *committed += group_size;
+        leaders->fetch_sub(1);
+        q->ExitAsBatchGroupLeader(leader, last_writer, Status::OK());
+    }
+}
+
+TEST(WriteQueueTest, SingleWriter) {
+    WriteQueue q;
+    WriteBatch batch;
+    Writer w;
+    w.batch = &batch;
+    ASSERT_TRUE(q.JoinBatchGroup(&w));
+    ASSERT_EQ(q.LinkGroup(&w), &w);
+    q.ExitAsBatchGroupLeader(&w, &w, Status::OK());
+
+    Writer w2;
+    w2.batch = &batch;
+    ASSERT_TRUE(q.JoinBatchGroup(&w2));
+    q.ExitAsBatchGroupLeader(&w2, &w2, Status::OK());
+}
+
+TEST(WriteQueueTest, ConcurrentWriters) {
+    const int kThreads = 16;
+    const int kWritesPerThread = 2000;
+
+    WriteQueue q;
+    WriteBatch batch;
+    std::atomic<int> leaders(0);
+    int committed = 0; // only touched by the leader
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kThreads; i++) {
+        threads.push_back(std::thread([&, i]() {
+            for (int j = 0; j < kWritesPerThread; j++) {
+                Writer w;
+                // every 100th writer runs alone, like a log switch
+                w.batch = (j % 100 == i) ? nullptr : &batch;
+                if (q.JoinBatchGroup(&w)) {
+                    commit_group(&q, &w, &leaders, &committed);
+                } else {
+                    ASSERT_TRUE(w.status.ok());
+                    ASSERT_TRUE(w.batch != nullptr);
+                }
+            }
+        }));
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    ASSERT_EQ(committed, kThreads * kWritesPerThread);
+}